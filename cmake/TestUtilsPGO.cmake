@@ -0,0 +1,142 @@
+# Profile-guided optimization trained by the benchmarks.
+#
+#   test_utils_add_pgo(<name>
+#       SOURCES <file>...                 # benchmarks and the code under test
+#       [LIBRARIES <lib>...]              # linked as is, not instrumented
+#       [INCLUDE_DIRECTORIES <dir>...]
+#       [COMPILE_DEFINITIONS <def>...]
+#       [ARGS <arg>...])                  # arguments of the training and report runs
+#
+# builds the benchmark binary three times from SOURCES:
+#
+#   <name>_base      plain build, the baseline
+#   <name>_pgo_gen   instrumented build (-fprofile-generate)
+#   <name>_pgo       build optimized with the merged profile (-fprofile-use)
+#
+# <name>_pgo_profile runs <name>_pgo_gen with TEST_BENCH_TRAIN=1, so every
+# benchmark only exercises its representative workload (see benchTraining()),
+# and merges the profile (llvm-profdata for Clang; GCC accumulates the runs in
+# its .gcda files, which are copied aside). Training reruns only when
+# <name>_pgo_gen was relinked, and <name>_pgo recompiles only when the
+# profile was rewritten. <name>_pgo_report runs <name>_base and
+# <name>_pgo and prints the before/after medians with test_history -c; the
+# benchmark binary must include test_utils_history.h for this.
+#
+#   cmake --build . --target <name>_pgo_report
+#
+# Only code compiled from SOURCES is optimized; LIBRARIES are linked as built.
+#
+# GCC keys the profile of static functions, and names the .gcda files, after
+# each object's auxiliary output name, which normally derives from the object
+# path and so differs between the two targets. Both are therefore compiled
+# with the same -dumpdir (GCC 11 or newer), which needs the source file names
+# in SOURCES to be unique. A profile that does not match still shows up as
+# -Wmissing-profile warnings.
+
+# cached so the function also finds them when called from a parent directory
+set(TEST_UTILS_PGO_TRAIN_SCRIPT ${CMAKE_CURRENT_LIST_DIR}/TestUtilsPGOTrain.cmake CACHE INTERNAL "")
+set(TEST_UTILS_PGO_HISTORY_SOURCE ${CMAKE_CURRENT_LIST_DIR}/../tools/test_history.c CACHE INTERNAL "")
+
+function(test_utils_add_pgo name)
+    cmake_parse_arguments(PGO "" "" "SOURCES;LIBRARIES;INCLUDE_DIRECTORIES;COMPILE_DEFINITIONS;ARGS" ${ARGN})
+    if(NOT PGO_SOURCES)
+        message(FATAL_ERROR "test_utils_add_pgo(${name}): no SOURCES")
+    endif()
+    if(CMAKE_C_COMPILER_ID MATCHES "Clang")
+        set(compiler clang)
+        get_filename_component(compiler_dir ${CMAKE_C_COMPILER} DIRECTORY)
+        string(REGEX MATCH "^[0-9]+" major ${CMAKE_C_COMPILER_VERSION})
+        find_program(TEST_UTILS_LLVM_PROFDATA NAMES llvm-profdata-${major} llvm-profdata HINTS ${compiler_dir})
+        if(NOT TEST_UTILS_LLVM_PROFDATA)
+            message(FATAL_ERROR "test_utils_add_pgo(${name}): llvm-profdata not found")
+        endif()
+    elseif(CMAKE_C_COMPILER_ID STREQUAL "GNU")
+        set(compiler gcc)
+        if(CMAKE_C_COMPILER_VERSION VERSION_LESS 11)
+            message(FATAL_ERROR "test_utils_add_pgo(${name}): needs GCC 11 or newer for -dumpdir")
+        endif()
+        set(seen "")
+        foreach(src ${PGO_SOURCES})
+            get_filename_component(base ${src} NAME)
+            if(base IN_LIST seen)
+                message(FATAL_ERROR "test_utils_add_pgo(${name}): two SOURCES named ${base}")
+            endif()
+            list(APPEND seen ${base})
+        endforeach()
+    else()
+        message(FATAL_ERROR "test_utils_add_pgo(${name}): PGO needs GCC or Clang, not ${CMAKE_C_COMPILER_ID}")
+    endif()
+
+    set(dir ${CMAKE_CURRENT_BINARY_DIR}/${name}_pgo_data)
+    set(stamp ${dir}/profile_stamp.h) # written by training, included by <name>_pgo so its objects depend on it
+
+    foreach(variant base pgo_gen pgo)
+        if(variant STREQUAL "base")
+            set(target ${name}_base)
+        else()
+            set(target ${name}_${variant})
+        endif()
+        add_executable(${target} EXCLUDE_FROM_ALL ${PGO_SOURCES})
+        target_include_directories(${target} PRIVATE ${PGO_INCLUDE_DIRECTORIES})
+        target_compile_definitions(${target} PRIVATE ${PGO_COMPILE_DEFINITIONS})
+        target_link_libraries(${target} PRIVATE ${PGO_LIBRARIES})
+        if(TARGET test_utils)
+            target_link_libraries(${target} PRIVATE test_utils)
+        endif()
+    endforeach()
+
+    if(compiler STREQUAL "clang")
+        target_compile_options(${name}_pgo_gen PRIVATE -fprofile-generate=${dir}/raw)
+        target_link_options(${name}_pgo_gen PRIVATE -fprofile-generate=${dir}/raw)
+        target_compile_options(${name}_pgo PRIVATE -fprofile-use=${dir}/merged.profdata)
+    else()
+        target_compile_options(${name}_pgo_gen PRIVATE -fprofile-generate=${dir}/raw -fprofile-update=prefer-atomic
+            -dumpdir ${dir}/aux/)
+        target_link_options(${name}_pgo_gen PRIVATE -fprofile-generate=${dir}/raw)
+        target_compile_options(${name}_pgo PRIVATE -fprofile-use=${dir}/merged -fprofile-correction
+            -dumpdir ${dir}/aux/)
+    endif()
+    target_compile_options(${name}_pgo PRIVATE -include ${stamp})
+
+    add_custom_command(OUTPUT ${stamp}
+        COMMAND ${CMAKE_COMMAND} -DCOMPILER=${compiler} -DEXE=$<TARGET_FILE:${name}_pgo_gen> -DDIR=${dir}
+                "-DARGS=${PGO_ARGS}" -DPROFDATA=${TEST_UTILS_LLVM_PROFDATA} -P ${TEST_UTILS_PGO_TRAIN_SCRIPT}
+        DEPENDS ${name}_pgo_gen ${TEST_UTILS_PGO_TRAIN_SCRIPT}
+        COMMENT "Training ${name} for PGO"
+        USES_TERMINAL
+        VERBATIM
+    )
+    add_custom_target(${name}_pgo_profile DEPENDS ${stamp})
+    add_dependencies(${name}_pgo ${name}_pgo_profile)
+
+    if(NOT TARGET test_history AND TARGET test_utils AND EXISTS ${TEST_UTILS_PGO_HISTORY_SOURCE})
+        add_executable(test_history EXCLUDE_FROM_ALL ${TEST_UTILS_PGO_HISTORY_SOURCE}) # tools not built
+        target_link_libraries(test_history PRIVATE test_utils)
+    endif()
+    if(TARGET test_history)
+        set(history_tool $<TARGET_FILE:test_history>)
+    else()
+        find_program(TEST_UTILS_HISTORY_TOOL test_history)
+        set(history_tool ${TEST_UTILS_HISTORY_TOOL})
+    endif()
+    if(history_tool)
+        set(hist ${dir}/report.hist)
+        add_custom_target(${name}_pgo_report
+            COMMAND ${CMAKE_COMMAND} -E remove -f ${hist}
+            COMMAND ${CMAKE_COMMAND} -E env TEST_BENCH_HISTORY=${hist} TEST_BENCH_COMMIT=base
+                    $<TARGET_FILE:${name}_base> ${PGO_ARGS}
+            COMMAND ${CMAKE_COMMAND} -E env TEST_BENCH_HISTORY=${hist} TEST_BENCH_COMMIT=pgo
+                    $<TARGET_FILE:${name}_pgo> ${PGO_ARGS}
+            COMMAND ${history_tool} -f ${hist} -c base:pgo
+            DEPENDS ${name}_base ${name}_pgo
+            COMMENT "Benchmarking ${name} before and after PGO"
+            USES_TERMINAL
+            VERBATIM
+        )
+        if(TARGET test_history)
+            add_dependencies(${name}_pgo_report test_history)
+        endif()
+    else()
+        message(WARNING "test_utils_add_pgo(${name}): test_history not found, no ${name}_pgo_report target")
+    endif()
+endfunction()
@@ -0,0 +1,43 @@
+# Training step of test_utils_add_pgo(), run with cmake -P:
+#
+#   -DCOMPILER=gcc|clang -DEXE=<instrumented binary> -DDIR=<profile directory>
+#   -DARGS=<arguments> -DPROFDATA=<llvm-profdata>
+#
+# Runs EXE with TEST_BENCH_TRAIN=1 into DIR/raw, merges the raw profile into
+# DIR/merged (GCC) or DIR/merged.profdata (Clang), then rewrites
+# DIR/profile_stamp.h so the optimized build recompiles.
+
+file(REMOVE_RECURSE ${DIR}/raw)
+file(MAKE_DIRECTORY ${DIR}/raw)
+
+set(ENV{TEST_BENCH_TRAIN} 1)
+set(ENV{LLVM_PROFILE_FILE} ${DIR}/raw/%p.profraw)
+execute_process(COMMAND ${EXE} ${ARGS} RESULT_VARIABLE status)
+if(NOT status EQUAL 0)
+    message(WARNING "PGO training run exited with ${status}, using the profile anyway")
+endif()
+
+if(COMPILER STREQUAL "clang")
+    file(GLOB raw ${DIR}/raw/*.profraw)
+    if(NOT raw)
+        message(FATAL_ERROR "PGO training run wrote no profile to ${DIR}/raw")
+    endif()
+    execute_process(COMMAND ${PROFDATA} merge -o ${DIR}/merged.profdata ${raw} RESULT_VARIABLE status)
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "llvm-profdata merge failed")
+    endif()
+else()
+    # both builds share -dumpdir, so the .gcda files (under DIR/raw/<dumpdir>)
+    # already carry the names the optimized build looks for
+    file(GLOB_RECURSE raw ${DIR}/raw/*.gcda)
+    if(NOT raw)
+        message(FATAL_ERROR "PGO training run wrote no profile to ${DIR}/raw")
+    endif()
+    file(REMOVE_RECURSE ${DIR}/merged)
+    execute_process(COMMAND ${CMAKE_COMMAND} -E copy_directory ${DIR}/raw ${DIR}/merged)
+endif()
+
+string(TIMESTAMP now "%Y-%m-%dT%H:%M:%S")
+list(LENGTH raw files)
+file(WRITE ${DIR}/profile_stamp.h "/* PGO profile from ${files} files, ${now} */\n")
+message(STATUS "PGO profile merged from ${files} files")
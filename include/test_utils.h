@@ -28,10 +28,30 @@
  * - ASSERT_NOT_EQUAL_STR: Assert that two strings are not equal.
  * 
  * Lastly, the cummulative test status can be retrieved with the functio @ref testGetStatus "testGetStatus()".
+ *
+ * Optional companion headers (test_utils_*.h) extend the framework. They attach
+ * to test cases through @ref testAddCaseHooks "testAddCaseHooks()", which runs
+ * a begin hook at the end of TEST_CASE and an end hook at the start of
+ * CASE_COMPLETE (and the other case terminators).
+ *
+ * Defining TEST_LIGHT_ASSERTS before including this header makes every
+ * assertion expand to a single call to @ref testCheck "testCheck()" with a
+ * static descriptor of the call site, instead of an inline block with its own
+ * printing code. Output is the same; files with many thousands of assertions
+ * compile considerably faster, at the cost of a call per passing assertion.
+ *
+ * Defining TEST_ASYNC_LOG before including this header routes MSG and LOG_*
+ * through a lock-free queue drained by a writer thread (see test_utils_log.h),
+ * so test threads neither write nor contend on the stdio lock.
  * 
  * @author Nicholas Schneider
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // companion headers rely on GNU/Linux extensions
+#endif
+
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -51,6 +71,11 @@
 
 
 /* -- Printing -----------------------------------------------------------*/
+/**
+ * @brief The stream framework output is written to (stdout unless redirected, see testOut()).
+ */
+#define TEST_OUT testOut()
+
 /**
  * @brief Print a message to the console in the specified color.
  * 
@@ -58,7 +83,15 @@
  * @param msg The message to print.
  * @param (optional) ... The arguments to format the message.
  */
-#define MSG(col, msg, ...)   printf(col msg RESET, ##__VA_ARGS__)
+#ifdef TEST_ASYNC_LOG
+int testLog(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void testLogIndent(uint16_t depth);
+#define TEST_PRINT(...) testLog(__VA_ARGS__)
+#else
+#define TEST_PRINT(...) fprintf(TEST_OUT, __VA_ARGS__)
+#endif
+
+#define MSG(col, msg, ...)   ((void)(test_quiet || TEST_PRINT(col msg RESET, ##__VA_ARGS__)))
 
 #ifdef DEBUG
 #define LOG_DEBUG(msg, ...) MSG(CYAN,   "DEBUG: "   msg, ##__VA_ARGS__)
@@ -71,30 +104,38 @@
 
 /**
  * @brief Evaluate a statement and print its name.
+ *
+ * The body is skipped when it is not on `test_eval_only` (see testEvalEnter()).
  * 
  * @param arg The test function to evaluate.
  */
-#define TEST_EVAL(arg)              \
-    MSG(MAGENTA, "%s():\n", #arg);  \
-    depth++;                        \
-    arg();                          \
-    depth--;
+#define TEST_EVAL(arg)                  \
+    if (testEvalEnter(#arg)) {          \
+        MSG(MAGENTA, "%s():\n", #arg);  \
+        depth++;                        \
+        arg();                          \
+        depth--;                        \
+        testEvalLeave();                \
+    }
     
 /**
  * @brief Define a new test case.
  * 
  * @param name The name of the test case.
  */
-#define TEST_CASE(name, ...)                            \
-    clearCase();                                        \
-    printIndent();                                      \
-    MSG(BLUE, "case: " RESET  name"\n", ##__VA_ARGS__); \
-    incDepth();                                         \
+#define TEST_CASE(name, ...)                                        \
+    clearCase();                                                    \
+    snprintf(case_name, sizeof(case_name), name, ##__VA_ARGS__);    \
+    printIndent();                                                  \
+    MSG(BLUE, "case: " RESET  name"\n", ##__VA_ARGS__);             \
+    incDepth();                                                     \
+    runCaseHooks(true);                                             \
 
 /**
  * @brief Indicate that the current test case has completed.
  */
 #define CASE_COMPLETE               \
+    runCaseHooks(false);            \
     if(caseHasFailed()) failTest(); \
     else {                          \
         printIndent();              \
@@ -106,11 +147,13 @@
  * 
  */
 #define CASE_NOT_IMPLEMENTED        \
+    runCaseHooks(false);            \
     printIndent();                  \
     LOG_WARN("NOT IMPLEMENTED\n");  \
     decDepth();                     \
 
 #define CASE_KNOWN_ISSUE            \
+    runCaseHooks(false);            \
     printIndent();                  \
     LOG_DEBUG("KNOWN ISSUE\n");     \
     decDepth();                     \
@@ -127,12 +170,21 @@
  * @param (optional) ... The arguments to format the message
  * 
  */
+#ifdef TEST_LIGHT_ASSERTS
+#define ASSERT_BOOL__(cond, cond_str, expression, msg, ...)                             \
+    do {                                                                                \
+        static const TestSite _site = { "ASSERT_" cond_str, NULL, #expression, NULL,    \
+                                        ":: " msg "\n" };                               \
+        testCheck(&_site, cond(expression), ##__VA_ARGS__);                             \
+    } while (0)
+#else
 #define ASSERT_BOOL__(cond, cond_str, expression, msg, ...)                             \
     if (cond(expression)) {                                                             \
         failCase();                                                                     \
         printIndent();                                                                  \
         LOG_ERROR("ASSERT_" cond_str ": [%s] :: " msg "\n", #expression, ##__VA_ARGS__);\
     }
+#endif
 
 #define ASSERT_NULL(expression, msg)  ASSERT_BOOL__( , "NULL", expression, msg)
 #define ASSERT_NOT_NULL(expression, msg)  ASSERT_BOOL__( , "NOT_NULL", !(expression), msg)
@@ -168,6 +220,16 @@
  * @param msg The message to print
  * @param (optional) ... The arguments to format the message
  */
+#ifdef TEST_LIGHT_ASSERTS
+#define ASSERT_EQUAL__(cond, cond_str, type, a, b, msg, ...)                    \
+    do {                                                                        \
+        static const TestSite _site = { "ASSERT_" cond_str "EQUAL", #cond,      \
+            #a, #b, "[%" type " " #cond " %" type "] :: " msg "\n" };           \
+        __auto_type _a = (a); /* each operand is evaluated exactly once */      \
+        __auto_type _b = (b);                                                   \
+        testCheck(&_site, _a cond _b, _a, _b, ##__VA_ARGS__);                   \
+    } while (0)
+#else
 #define ASSERT_EQUAL__(cond, cond_str, type, a, b, msg, ...)                    \
     if (a cond b) {                                                             \
         failCase();                                                             \
@@ -175,6 +237,7 @@
         LOG_ERROR("ASSERT_" cond_str "EQUAL: %s "#cond" %s [%" type " "         \
         #cond " %" type "] :: " msg "\n" RESET, #a, #b, a, b, ##__VA_ARGS__);   \
     }
+#endif
 
 /**
  * @brief Assert that two pointers are equal: `a == b`
@@ -306,14 +369,65 @@ typedef struct {
     uint64_t data;
     uint32_t* ptr;
 } TestStruct;
+/**
+ * @brief Hook invoked at the begin or end of every test case.
+ */
+typedef void (*TestCaseHook)(void);
+
+/**
+ * @brief A begin/end hook pair registered by a companion header.
+ */
+typedef struct {
+    TestCaseHook begin;
+    TestCaseHook end;
+} TestCaseHooks;
+
+/**
+ * @brief Static descriptor of an assertion call site (TEST_LIGHT_ASSERTS).
+ */
+typedef struct {
+    const char* name;   // e.g. "ASSERT_EQUAL".
+    const char* op;     // comparison operator, NULL for boolean assertions.
+    const char* a;      // source text of the (first) operand.
+    const char* b;      // source text of the second operand, or NULL.
+    const char* fmt;    // format of the values and the message.
+} TestSite;
+
+#ifndef TEST_MAX_CASE_HOOKS
+#define TEST_MAX_CASE_HOOKS 16
+#endif
+
 /* -- Global Variables ----------------------------------------------------- */
 
 bool test_failed = false; // status of the entire test suite.
 bool case_failed = false; // status of the current test
 uint16_t depth = 0; //The indentation depth of the current test.
+bool test_quiet = false; // suppress framework output, e.g. for repeated runs.
+bool test_fail_fast = false; // exit at the first failed case (also set by TEST_FAIL_FAST=1).
+FILE* test_out = NULL; // framework output stream, NULL for stdout.
+char case_name[128] = ""; // formatted name of the current test case.
+char test_eval_path[256] = ""; // names of the enclosing TEST_EVALs, separated by '/'.
+const char* test_eval_only = NULL; // only enter the TEST_EVALs on this path, NULL for all.
+TestCaseHooks case_hooks[TEST_MAX_CASE_HOOKS]; // registered case hooks.
+uint8_t case_hook_count = 0; // number of registered case hooks.
 
 /* -- Function Declarations ----------------------------------------------- */
 
+/**
+ * @brief The framework output stream.
+ *
+ * When test_out is a separate stream (e.g. a duplicate of the stdout
+ * descriptor), pending stdout output is flushed first, so output of the code
+ * under test and framework messages appear in the order they were written.
+ *
+ * @return test_out, or stdout if it is NULL.
+ */
+static inline FILE* testOut(void) {
+    if (!test_out) return stdout;
+    fflush(stdout);
+    return test_out;
+}
+
 /**
  * @brief Retrieve the test status.
  * 
@@ -325,10 +439,12 @@ bool testGetStatus() { return test_failed; }
  * @brief Print the current test indent.
  */
 static void printIndent() {
-    for (int i = 0; i < depth; i++) {
-        putchar(' ');
-        putchar(' ');
-    }
+    if (test_quiet) return;
+#ifdef TEST_ASYNC_LOG
+    testLogIndent(depth); // prepended to the next message, so both are queued together
+    return;
+#endif
+    fprintf(TEST_OUT, "%*s", 2 * depth, ""); // one write, test_out may be unbuffered
 }
 
 /**
@@ -343,10 +459,50 @@ void clearCase() { case_failed = false; }
 
 /**
  * @brief Mark the entire test suite as failed.
+ *
+ * With `test_fail_fast` or the TEST_FAIL_FAST environment variable set, the
+ * process exits with status 1 instead of running the remaining tests.
  */
-void failTest() { test_failed = true; }
+void failTest() {
+    test_failed = true;
+    const char* env = getenv("TEST_FAIL_FAST");
+    if (test_fail_fast || (env && *env && strcmp(env, "0") != 0)) {
+        fflush(NULL);
+        exit(1);
+    }
+}
 
 
+/**
+ * @brief Enter a TEST_EVAL, appending its name to `test_eval_path`.
+ *
+ * With `test_eval_only` set, only the TEST_EVALs leading to that path are
+ * entered. A re-executed child (e.g. a benchmark process) sets it to the path
+ * of the code it was started for, so it does not run unrelated tests first.
+ *
+ * @param name The name of the test function.
+ * @return false if the body is to be skipped, testEvalLeave() must not be called then.
+ */
+bool testEvalEnter(const char* name) {
+    size_t len = strlen(test_eval_path);
+    snprintf(test_eval_path + len, sizeof(test_eval_path) - len, "%s%s", len ? "/" : "", name);
+    if (!test_eval_only) return true;
+    size_t n = strlen(test_eval_path);
+    if (strncmp(test_eval_only, test_eval_path, n) == 0 && (!test_eval_only[n] || test_eval_only[n] == '/'))
+        return true;
+    test_eval_path[len] = '\0';
+    return false;
+}
+
+/**
+ * @brief Leave a TEST_EVAL entered with testEvalEnter().
+ */
+void testEvalLeave() {
+    char* slash = strrchr(test_eval_path, '/');
+    if (slash) *slash = '\0';
+    else test_eval_path[0] = '\0';
+}
+
 /**
  * @brief Increment the test case indentation depth.
  */
@@ -363,3 +519,73 @@ void decDepth() { depth--; }
  * @return true if the current test case has failed, false otherwise.
  */
 bool caseHasFailed() { return case_failed; }
+
+/**
+ * @brief Register a pair of hooks to run around every test case.
+ *
+ * Begin hooks run in registration order once TEST_CASE has printed the case
+ * name, end hooks run in reverse order before CASE_COMPLETE evaluates the case
+ * status, so an end hook may still call failCase().
+ *
+ * @param begin Hook run when a case starts (may be NULL).
+ * @param end Hook run when a case ends (may be NULL).
+ * @return true if the hooks were registered, false if the table is full.
+ */
+bool testAddCaseHooks(TestCaseHook begin, TestCaseHook end) {
+    if (case_hook_count >= TEST_MAX_CASE_HOOKS) return false;
+    case_hooks[case_hook_count].begin = begin;
+    case_hooks[case_hook_count].end = end;
+    case_hook_count++;
+    return true;
+}
+
+/**
+ * @brief Run the registered begin or end case hooks.
+ *
+ * @param begin true to run the begin hooks, false to run the end hooks.
+ */
+void runCaseHooks(bool begin) {
+    if (begin) {
+        for (int i = 0; i < case_hook_count; i++)
+            if (case_hooks[i].begin) case_hooks[i].begin();
+    } else {
+        for (int i = case_hook_count - 1; i >= 0; i--)
+            if (case_hooks[i].end) case_hooks[i].end();
+    }
+}
+
+/**
+ * @brief Out-of-line assertion check used by TEST_LIGHT_ASSERTS.
+ *
+ * @param site The call site descriptor.
+ * @param failed true if the assertion failed.
+ * @param (optional) ... The operand values (for comparisons), then the message arguments.
+ */
+void testCheck(const TestSite* site, bool failed, ...) {
+    if (!failed) return;
+    va_list ap;
+    failCase();
+    printIndent();
+    if (test_quiet) return;
+#ifdef TEST_ASYNC_LOG
+    char buf[1024];
+    int n = site->op ? snprintf(buf, sizeof(buf), "%s: %s %s %s ", site->name, site->a, site->op, site->b)
+                     : snprintf(buf, sizeof(buf), "%s: [%s] ", site->name, site->a);
+    if (n < 0 || (size_t)n >= sizeof(buf)) n = 0;
+    va_start(ap, failed);
+    vsnprintf(buf + n, sizeof(buf) - (size_t)n, site->fmt, ap);
+    va_end(ap);
+    testLog(RED "ERROR: %s" RESET, buf);
+    return;
+#endif
+    if (site->op) fprintf(TEST_OUT, RED "ERROR: %s: %s %s %s ", site->name, site->a, site->op, site->b);
+    else fprintf(TEST_OUT, RED "ERROR: %s: [%s] ", site->name, site->a);
+    va_start(ap, failed);
+    vfprintf(TEST_OUT, site->fmt, ap);
+    va_end(ap);
+    fputs(RESET, TEST_OUT);
+}
+
+#ifdef TEST_ASYNC_LOG
+#include "test_utils_log.h"
+#endif
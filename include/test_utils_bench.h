@@ -0,0 +1,864 @@
+#pragma once
+/**
+ * @file test_utils_bench.h
+ *
+ * @brief Benchmark harness with process-level repetition and layout randomization.
+ *
+ * @details
+ * BENCH_EVAL(fn, arg) times `void fn(void* arg)`. The number of calls per
+ * sample is calibrated so that each sample lasts at least
+ * `bench_config.min_sample_ns`, then `bench_config.samples` samples of ns/op
+ * are taken after `bench_config.warmup` discarded ones.
+ *
+ * A single process only ever sees one code, stack and heap placement, so a
+ * result can be an artifact of alignment. With `bench_config.processes` (or
+ * the `TEST_BENCH_PROCESSES` environment variable) set to K > 1 the harness
+ * re-executes the test binary K times and runs only the benchmark in each
+ * child, under a different layout:
+ *
+ * - A random amount of environment padding, which shifts the initial stack.
+ * - A random stack offset below the benchmark frame.
+ * - A random heap offset (a discarded allocation before the benchmark).
+ * - A random buffer alignment offset applied by @ref benchBuffer "benchBuffer()".
+ *
+ * The results are aggregated across processes and the within-process noise
+ * is reported separately from the between-layout variance. `TEST_BENCH_SEED`
+ * makes the layouts reproducible. A child only enters the TEST_EVALs that
+ * enclose its benchmark and skips every other test body, but code outside of
+ * them (e.g. in main) still runs silently in every child. A child that exits
+ * before reporting (e.g. through such code failing under TEST_FAIL_FAST)
+ * contributes no samples and is reported with its exit status.
+ *
+ * BENCH_COMPARE(a_fn, b_fn, arg) compares two implementations in one run.
+ * Samples of A and B are taken in interleaved blocks whose order within each
+ * pair is random, so thermal and frequency drift affects both alike. The
+ * ratio of the B and A medians is reported with a bootstrap 95% confidence
+ * interval over the pairs. ASSERT_BENCH_FASTER(a_fn, b_fn, arg, margin, msg)
+ * fails the case unless B is faster than A by at least `margin` (e.g. 0.1
+ * for 10%) over the whole interval.
+ *
+ * @ref benchAlloc "benchAlloc()" sets up buffers so the kernel stays out of
+ * the timed region. It controls the alignment and the page size: 4K only,
+ * transparent huge pages through madvise, or explicit MAP_HUGETLB pages,
+ * falling back to THP when none are reserved. It can prefault with
+ * MAP_POPULATE (or MADV_POPULATE_WRITE when faulting must wait for madvise
+ * or mbind) or by touching every page, and can bind the memory to a NUMA
+ * node.
+ *
+ * With `TEST_BENCH_TRAIN=1` in the environment the binary is a training run
+ * for profile-guided optimization (see cmake/TestUtilsPGO.cmake): every
+ * benchmark only calls its function for `bench_config.train_ns`, in-process,
+ * without sampling or reporting, and comparisons always pass. Benchmarks
+ * that sweep many inputs can check @ref benchTraining "benchTraining()" and
+ * restrict themselves to the inputs representative of production, so the
+ * profile is not skewed by corner cases.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_clock.h"
+
+#include <alloca.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_BENCH_MAX_SAMPLES
+#define TEST_BENCH_MAX_SAMPLES 1000 // samples per process
+#endif
+
+#ifndef TEST_BENCH_MAX_PROCESSES
+#define TEST_BENCH_MAX_PROCESSES 64 // re-executed processes per benchmark
+#endif
+
+#ifndef TEST_BENCH_BOOTSTRAP
+#define TEST_BENCH_BOOTSTRAP 2000 // bootstrap resamples of a comparison
+#endif
+
+#define TEST_BENCH_HUGE_PAGE (2u << 20) // size of a transparent or hugetlb huge page
+#define TEST_BENCH_MPOL_BIND 2          // MPOL_BIND from <linux/mempolicy.h>
+
+/**
+ * @brief Keep the compiler from optimizing away a value.
+ *
+ * @param x The value the benchmark produced.
+ */
+#define BENCH_KEEP(x) __asm__ __volatile__("" : : "g"(x) : "memory")
+
+/**
+ * @brief Force the compiler to assume all memory was read and written.
+ */
+#define BENCH_CLOBBER() __asm__ __volatile__("" : : : "memory")
+
+/**
+ * @brief Benchmark a function and print its timing.
+ *
+ * @param fn The function to time, `void fn(void* arg)`.
+ * @param arg The argument passed to every call.
+ */
+#define BENCH_EVAL(fn, arg)                         \
+    MSG(MAGENTA, "%s() [bench]:\n", #fn);           \
+    depth++;                                        \
+    benchRun(#fn, fn, arg, &bench_last);            \
+    depth--;
+
+/**
+ * @brief Benchmark two functions against each other and print the ratio.
+ *
+ * @param a_fn The baseline, `void a_fn(void* arg)`.
+ * @param b_fn The candidate, `void b_fn(void* arg)`.
+ * @param arg The argument passed to every call.
+ */
+#define BENCH_COMPARE(a_fn, b_fn, arg)                                          \
+    MSG(MAGENTA, "%s() vs %s() [bench]:\n", #a_fn, #b_fn);                      \
+    depth++;                                                                    \
+    benchCompare(#a_fn, a_fn, #b_fn, b_fn, arg, NAN, &bench_compare_last);      \
+    depth--;
+
+/**
+ * @brief Assert that a function is faster than a baseline by a margin
+ *
+ * @param a_fn The baseline, `void a_fn(void* arg)`.
+ * @param b_fn The candidate, `void b_fn(void* arg)`.
+ * @param arg The argument passed to every call.
+ * @param margin The required speedup as a fraction of A's time, e.g. 0.1 for 10%.
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_BENCH_FASTER(a_fn, b_fn, arg, margin, msg, ...)                              \
+    do {                                                                                    \
+        MSG(MAGENTA, "%s() vs %s() [bench]:\n", #a_fn, #b_fn);                              \
+        depth++;                                                                            \
+        if (!benchCompare(#a_fn, a_fn, #b_fn, b_fn, arg, (margin), &bench_compare_last)) {  \
+            failCase();                                                                     \
+            printIndent();                                                                  \
+            LOG_ERROR("ASSERT_BENCH_FASTER: %s not %.1f%% faster than %s :: " msg "\n",     \
+                      #b_fn, 100.0 * (margin), #a_fn, ##__VA_ARGS__);                       \
+        }                                                                                   \
+        depth--;                                                                            \
+    } while (0)
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief A function timed by the benchmark harness.
+ */
+typedef void (*BenchFn)(void* arg);
+
+/**
+ * @brief Benchmark harness configuration.
+ */
+typedef struct {
+    uint32_t warmup;        // samples discarded before measuring.
+    uint32_t samples;       // measured samples per process.
+    double min_sample_ns;   // minimum duration of a sample, sets the calls per sample.
+    uint16_t processes;     // re-executed processes, 0 or 1 to measure in-process.
+    double train_ns;        // time each benchmark runs for in a training run.
+} BenchConfig;
+
+/**
+ * @brief The memory layout a benchmark process runs under.
+ */
+typedef struct {
+    uint64_t seed;          // seed the layout was derived from.
+    size_t env_pad;         // bytes of environment padding.
+    size_t stack_offset;    // bytes reserved on the stack below the benchmark.
+    size_t heap_offset;     // bytes allocated (and kept) before the benchmark.
+    size_t buffer_offset;   // offset applied to buffers from benchBuffer().
+} BenchLayout;
+
+/**
+ * @brief Page size of a benchmark buffer.
+ */
+typedef enum {
+    BENCH_PAGES_DEFAULT,    // whatever the system's THP policy gives.
+    BENCH_PAGES_4K,         // base pages only (MADV_NOHUGEPAGE).
+    BENCH_PAGES_THP,        // transparent huge pages (MADV_HUGEPAGE).
+    BENCH_PAGES_HUGETLB,    // reserved huge pages (MAP_HUGETLB), THP if none are available.
+} BenchPages;
+
+/**
+ * @brief How a benchmark buffer is faulted in before use.
+ */
+typedef enum {
+    BENCH_PREFAULT_NONE,
+    BENCH_PREFAULT_POPULATE,    // let the kernel populate the page tables.
+    BENCH_PREFAULT_TOUCH,       // write to every page.
+} BenchPrefault;
+
+/**
+ * @brief Options of benchAlloc().
+ */
+typedef struct {
+    size_t align;           // alignment of the buffer, a power of two (0 for 64).
+    BenchPages pages;
+    BenchPrefault prefault;
+    int node;               // NUMA node to bind the buffer to, -1 for none.
+} BenchAlloc;
+
+/**
+ * @brief A buffer returned by benchAlloc().
+ */
+typedef struct {
+    void* data;             // the buffer.
+    size_t size;            // size of the buffer in bytes.
+    BenchPages pages;       // the page size actually used.
+    void* map;              // the mapping.
+    size_t map_len;
+} BenchBuf;
+
+/**
+ * @brief The aggregated result of a benchmark.
+ */
+typedef struct {
+    const char* name;
+    uint32_t samples;       // total samples over all processes.
+    uint16_t processes;     // processes that reported samples (1 for in-process).
+    uint64_t calls;         // calls per sample.
+    double median;          // median ns/op over all samples.
+    double mean;            // mean ns/op.
+    double min;             // fastest sample in ns/op.
+    double within_stddev;   // pooled within-process standard deviation in ns/op.
+    double between_stddev;  // between-layout standard deviation of the process means in ns/op.
+    double ci95;            // half-width of the 95% confidence interval of the mean in ns/op.
+} BenchResult;
+
+/**
+ * @brief The result of an interleaved A/B comparison.
+ */
+typedef struct {
+    const char* a;
+    const char* b;
+    uint32_t pairs;         // interleaved A/B sample pairs.
+    uint64_t a_calls;       // calls per sample of A.
+    uint64_t b_calls;       // calls per sample of B.
+    double a_median;        // median ns/op of A.
+    double b_median;        // median ns/op of B.
+    double ratio;           // b_median / a_median, below 1 when B is faster.
+    double lo;              // lower bound of the 95% bootstrap interval of ratio.
+    double hi;              // upper bound of the 95% bootstrap interval of ratio.
+} BenchCompare;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+BenchConfig bench_config = {
+    .warmup = 3,
+    .samples = 30,
+    .min_sample_ns = 1e6,
+    .processes = 1,
+    .train_ns = 2e8,
+};
+
+BenchAlloc bench_alloc = {
+    .align = 64,
+    .pages = BENCH_PAGES_DEFAULT,
+    .prefault = BENCH_PREFAULT_TOUCH,
+    .node = -1,
+};
+
+BenchLayout bench_layout = { 0 }; // layout of the current process.
+BenchResult bench_last = { 0 };  // result of the last BENCH_EVAL.
+BenchCompare bench_compare_last = { 0 }; // result of the last BENCH_COMPARE.
+void (*bench_record)(const BenchResult* result) = NULL; // called with every BENCH_EVAL result.
+const char* bench_child = NULL;  // benchmark a re-executed child should run, NULL in the parent.
+int bench_child_fd = -1;         // pipe a child reports its samples on.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief splitmix64 step, used to derive layouts from a seed.
+ */
+static uint64_t benchMix(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Derive a layout from a seed.
+ */
+static BenchLayout benchLayoutFrom(uint64_t seed) {
+    BenchLayout l;
+    uint64_t s = seed;
+    l.seed = seed;
+    l.env_pad = benchMix(&s) % 4096;
+    l.stack_offset = (benchMix(&s) % 256) * 16;
+    l.heap_offset = benchMix(&s) % 4096 + 1;
+    l.buffer_offset = (benchMix(&s) % 64) * 8;
+    return l;
+}
+
+/**
+ * @brief Pick up the child role when re-executed by benchRun().
+ */
+__attribute__((constructor)) static void benchChildInit(void) {
+    const char* name = getenv("TEST_BENCH_CHILD");
+    const char* fd = getenv("TEST_BENCH_FD");
+    const char* seed = getenv("TEST_BENCH_LAYOUT");
+    if (!name || !fd || !seed) return;
+    bench_child = name;
+    bench_child_fd = atoi(fd);
+    bench_layout = benchLayoutFrom(strtoull(seed, NULL, 10));
+    const char* path = getenv("TEST_BENCH_PATH");
+    test_eval_only = path ? path : "";
+    test_quiet = true;
+}
+
+/**
+ * @brief Allocate a benchmark buffer at the layout's alignment offset.
+ *
+ * The buffer starts `bench_layout.buffer_offset` bytes past a page boundary,
+ * so re-executed processes see differently aligned data.
+ *
+ * @param size The size of the buffer in bytes.
+ * @return The buffer, to be released with benchBufferFree(), or NULL.
+ */
+void* benchBuffer(size_t size) {
+    void* base = NULL;
+    if (posix_memalign(&base, 4096, size + bench_layout.buffer_offset)) return NULL;
+    return (char*)base + bench_layout.buffer_offset;
+}
+
+/**
+ * @brief Release a buffer returned by benchBuffer().
+ */
+void benchBufferFree(void* buf) {
+    if (buf) free((char*)buf - bench_layout.buffer_offset);
+}
+
+/**
+ * @brief Allocate a benchmark buffer with controlled alignment, page size and placement.
+ *
+ * The layout's buffer offset is applied in multiples of the alignment, so
+ * re-executed processes still see different placements where the
+ * alignment allows it. Faulting is deferred past madvise and mbind when
+ * either is needed, so the advice and the binding apply to every page.
+ *
+ * @param buf Receives the buffer, to be released with benchRelease().
+ * @param size The size of the buffer in bytes.
+ * @param opts The options, NULL for `bench_alloc`.
+ * @return false if the buffer could not be mapped.
+ */
+bool benchAlloc(BenchBuf* buf, size_t size, const BenchAlloc* opts) {
+    if (!opts) opts = &bench_alloc;
+    memset(buf, 0, sizeof(BenchBuf));
+    size_t align = opts->align ? opts->align : 64;
+    if (align & (align - 1)) {
+        printIndent();
+        LOG_ERROR("BENCH: alignment %zu is not a power of two\n", align);
+        return false;
+    }
+    BenchPages pages = opts->pages;
+    size_t page = pages == BENCH_PAGES_THP || pages == BENCH_PAGES_HUGETLB ? TEST_BENCH_HUGE_PAGE : 4096;
+    size_t offset = bench_layout.buffer_offset & ~(align - 1);
+    size_t len = (offset + size + page - 1) & ~(page - 1);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    char* map = (char*)MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (pages == BENCH_PAGES_HUGETLB) {
+        int huge = MAP_HUGETLB | (21 << MAP_HUGE_SHIFT); // 2 MiB pages
+        if (opts->prefault == BENCH_PREFAULT_POPULATE && opts->node < 0) huge |= MAP_POPULATE;
+        map = (char*)mmap(NULL, len, PROT_READ | PROT_WRITE, flags | huge, -1, 0);
+    }
+#endif
+    if (map == MAP_FAILED && pages == BENCH_PAGES_HUGETLB) {
+        printIndent();
+        LOG_WARN("BENCH: no hugetlb pages for %zu bytes, using transparent huge pages\n", len);
+        pages = BENCH_PAGES_THP;
+    }
+    bool late = opts->node >= 0 || pages == BENCH_PAGES_THP || pages == BENCH_PAGES_4K;
+    if (map == MAP_FAILED) {
+        // over-allocate and trim to get a start aligned to the page size and the alignment
+        size_t want = align > page ? align : page;
+        size_t extra = want - 4096;
+        if (extra) late = true;
+        int populate = opts->prefault == BENCH_PREFAULT_POPULATE && !late ? MAP_POPULATE : 0;
+        char* raw = (char*)mmap(NULL, len + extra, PROT_READ | PROT_WRITE, flags | populate, -1, 0);
+        if (raw == MAP_FAILED) return false;
+        map = (char*)(((uintptr_t)raw + want - 1) & ~(uintptr_t)(want - 1));
+        if (map > raw) munmap(raw, (size_t)(map - raw));
+        if (raw + len + extra > map + len) munmap(map + len, (size_t)(raw + len + extra - (map + len)));
+        if (pages == BENCH_PAGES_THP) madvise(map, len, MADV_HUGEPAGE);
+        else if (pages == BENCH_PAGES_4K) madvise(map, len, MADV_NOHUGEPAGE);
+    }
+
+    if (opts->node >= 0) {
+        unsigned long mask[16] = { 0 }; // nodes 0..1023
+        if (opts->node < 1024) mask[opts->node / 64] = 1ul << (opts->node % 64);
+        if (opts->node >= 1024 ||
+            syscall(SYS_mbind, map, len, TEST_BENCH_MPOL_BIND, mask, 1024 + 1, 0) != 0) {
+            printIndent();
+            LOG_WARN("BENCH: cannot bind %zu bytes to NUMA node %d\n", len, opts->node);
+        }
+    }
+    if (opts->prefault == BENCH_PREFAULT_TOUCH || (opts->prefault == BENCH_PREFAULT_POPULATE && late)) {
+        bool done = false;
+#ifdef MADV_POPULATE_WRITE
+        if (opts->prefault == BENCH_PREFAULT_POPULATE) done = madvise(map, len, MADV_POPULATE_WRITE) == 0;
+#endif
+        for (size_t o = 0; !done && o < len; o += 4096) ((volatile char*)map)[o] = 0;
+    }
+    buf->data = map + offset;
+    buf->size = size;
+    buf->pages = pages;
+    buf->map = map;
+    buf->map_len = len;
+    return true;
+}
+
+/**
+ * @brief Bytes of a buffer currently backed by huge pages.
+ *
+ * Reads AnonHugePages from /proc/self/smaps, so it tells whether THP
+ * promotion actually happened; hugetlb buffers are entirely huge.
+ */
+size_t benchBufHuge(const BenchBuf* buf) {
+    if (buf->pages == BENCH_PAGES_HUGETLB) return buf->map_len;
+    FILE* f = fopen("/proc/self/smaps", "r");
+    if (!f) return 0;
+    char line[512];
+    size_t huge = 0;
+    bool inside = false;
+    uintptr_t lo = (uintptr_t)buf->map, hi = lo + buf->map_len;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long start, end, kb;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2 && strchr(line, '-') < strchr(line, ' ')) {
+            inside = start < hi && end > lo;
+        } else if (inside && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            huge += kb * 1024;
+        }
+    }
+    fclose(f);
+    return huge;
+}
+
+/**
+ * @brief Unmap a buffer returned by benchAlloc().
+ */
+void benchRelease(BenchBuf* buf) {
+    if (buf->map) munmap(buf->map, buf->map_len);
+    memset(buf, 0, sizeof(BenchBuf));
+}
+
+/**
+ * @brief Compare two doubles for qsort.
+ */
+static int benchCmp(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Two-sided 95% Student t quantile for df degrees of freedom.
+ */
+double benchT95(uint32_t df) {
+    static const double t[] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+                                2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+                                2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+    if (df == 0) return INFINITY;
+    return df <= 30 ? t[df] : 1.960 + 2.4 / (double)df;
+}
+
+/**
+ * @brief Median of a sample set (sorts the samples).
+ */
+double benchMedian(double* v, uint32_t n) {
+    if (!n) return 0;
+    qsort(v, n, sizeof(double), benchCmp);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+/**
+ * @brief Find the calls per sample that make a sample last min_sample_ns.
+ */
+static uint64_t benchCalibrate(BenchFn fn, void* arg) {
+    uint64_t calls = 1;
+    for (;;) {
+        uint64_t t0 = testClockNs();
+        for (uint64_t i = 0; i < calls; i++) fn(arg);
+        uint64_t dt = testClockNs() - t0;
+        if ((double)dt >= bench_config.min_sample_ns || calls >= (1ull << 40)) return calls;
+        calls = dt ? (uint64_t)((double)calls * bench_config.min_sample_ns * 1.2 / (double)dt) + 1 : calls * 16;
+        if (calls > (1ull << 40)) calls = 1ull << 40;
+    }
+}
+
+/**
+ * @brief Time one sample of calls and return its ns/op.
+ */
+static double benchBlock(BenchFn fn, void* arg, uint64_t calls) {
+    uint64_t t0 = testClockTicksBegin();
+    for (uint64_t i = 0; i < calls; i++) fn(arg);
+    uint64_t t1 = testClockTicksEnd();
+    return (double)testClockTicksToNs(t1 - t0) / (double)calls;
+}
+
+/**
+ * @brief Take samples of ns/op.
+ *
+ * @param fn The function to time.
+ * @param arg The argument passed to every call.
+ * @param calls Calls per sample (0 to calibrate).
+ * @param out Receives the samples.
+ * @param n The number of samples to take.
+ * @return The calls per sample used.
+ */
+uint64_t benchSample(BenchFn fn, void* arg, uint64_t calls, double* out, uint32_t n) {
+    if (!calls) calls = benchCalibrate(fn, arg);
+    for (uint32_t s = 0; s < bench_config.warmup + n; s++) {
+        double ns = benchBlock(fn, arg, calls);
+        if (s >= bench_config.warmup) out[s - bench_config.warmup] = ns;
+    }
+    return calls;
+}
+
+/**
+ * @brief Take the samples of a child under its layout and report them to the parent.
+ */
+__attribute__((noinline)) static void benchChildRun(BenchFn fn, void* arg) {
+    static double samples[TEST_BENCH_MAX_SAMPLES];
+    uint32_t n = bench_config.samples < TEST_BENCH_MAX_SAMPLES ? bench_config.samples : TEST_BENCH_MAX_SAMPLES;
+    volatile char* pad = (volatile char*)alloca(bench_layout.stack_offset + 1);
+    pad[0] = 0;
+    void* heap = malloc(bench_layout.heap_offset);
+    BENCH_KEEP(heap);
+    uint64_t calls = benchSample(fn, arg, 0, samples, n);
+    if (write(bench_child_fd, &calls, sizeof(calls)) != sizeof(calls) ||
+        write(bench_child_fd, &n, sizeof(n)) != sizeof(n) ||
+        write(bench_child_fd, samples, n * sizeof(double)) != (ssize_t)(n * sizeof(double)))
+        _exit(2);
+    free(heap);
+    BENCH_KEEP(pad[0]);
+}
+
+/**
+ * @brief Read exactly len bytes from a pipe.
+ */
+static bool benchReadAll(int fd, void* buf, size_t len) {
+    for (size_t got = 0; got < len; ) {
+        ssize_t r = read(fd, (char*)buf + got, len - got);
+        if (r <= 0) return false;
+        got += (size_t)r;
+    }
+    return true;
+}
+
+/**
+ * @brief Re-execute the test binary to run one benchmark under a layout.
+ *
+ * @param name The benchmark to run in the child.
+ * @param layout The layout of the child.
+ * @param samples Receives the samples.
+ * @param calls Receives the calls per sample.
+ * @return The number of samples received (0 on failure).
+ */
+static uint32_t benchSpawn(const char* name, const BenchLayout* layout, double* samples, uint64_t* calls) {
+    static char cmdline[32768];
+    char* argv[256];
+    int argc = 0, fds[2];
+    FILE* f = fopen("/proc/self/cmdline", "rb");
+    size_t len = f ? fread(cmdline, 1, sizeof(cmdline) - 1, f) : 0;
+    if (f) fclose(f);
+    cmdline[len] = '\0';
+    for (size_t i = 0; i < len && argc < 255; i += strlen(cmdline + i) + 1) argv[argc++] = cmdline + i;
+    argv[argc] = NULL;
+    if (!argc || pipe(fds)) return 0;
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char num[32], *padding = malloc(layout->env_pad + 1);
+        close(fds[0]);
+        memset(padding, 'x', layout->env_pad);
+        padding[layout->env_pad] = '\0';
+        setenv("TEST_BENCH_CHILD", name, 1);
+        snprintf(num, sizeof(num), "%d", fds[1]);
+        setenv("TEST_BENCH_FD", num, 1);
+        snprintf(num, sizeof(num), "%llu", (unsigned long long)layout->seed);
+        setenv("TEST_BENCH_LAYOUT", num, 1);
+        setenv("TEST_BENCH_PAD", padding, 1);
+        setenv("TEST_BENCH_PATH", test_eval_path, 1);
+        unsetenv("TEST_BENCH_PROCESSES");
+        FILE* null = freopen("/dev/null", "w", stdout);
+        (void)null;
+        execv("/proc/self/exe", argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    uint32_t n = 0;
+    if (pid < 0 || !benchReadAll(fds[0], calls, sizeof(*calls)) || !benchReadAll(fds[0], &n, sizeof(n)) ||
+        n > TEST_BENCH_MAX_SAMPLES || !benchReadAll(fds[0], samples, n * sizeof(double)))
+        n = 0;
+    close(fds[0]);
+    int status = 0;
+    if (pid < 0) {
+        printIndent();
+        LOG_WARN("BENCH: %s: could not start a child process\n", name);
+    } else if (waitpid(pid, &status, 0) == pid && !n) {
+        printIndent();
+        if (WIFSIGNALED(status))
+            LOG_WARN("BENCH: %s: child killed by signal %d before reporting\n", name, WTERMSIG(status));
+        else
+            LOG_WARN("BENCH: %s: child exited with status %d before reporting\n", name, WEXITSTATUS(status));
+    }
+    return n;
+}
+
+/**
+ * @brief Aggregate per-process samples into a result.
+ *
+ * @param samples Samples of all processes, process by process.
+ * @param counts Samples contributed by each process.
+ * @param processes The number of processes.
+ * @param result Receives the aggregate.
+ */
+void benchAggregate(double* samples, const uint32_t* counts, uint16_t processes, BenchResult* result) {
+    static double means[TEST_BENCH_MAX_PROCESSES];
+    uint32_t total = 0, used = 0;
+    double grand = 0, within = 0, min = INFINITY, n_avg = 0;
+    for (uint16_t p = 0; p < processes; p++) {
+        double sum = 0, ss = 0;
+        const double* s = samples + total;
+        if (!counts[p]) continue;
+        for (uint32_t i = 0; i < counts[p]; i++) {
+            sum += s[i];
+            if (s[i] < min) min = s[i];
+        }
+        means[used] = sum / counts[p];
+        for (uint32_t i = 0; i < counts[p]; i++) ss += (s[i] - means[used]) * (s[i] - means[used]);
+        within += ss;
+        grand += sum;
+        total += counts[p];
+        n_avg += counts[p];
+        used++;
+    }
+    result->samples = total;
+    result->processes = (uint16_t)used;
+    if (!total) return;
+    result->mean = grand / total;
+    result->min = min;
+    result->within_stddev = total > used ? sqrt(within / (double)(total - used)) : 0;
+    n_avg /= used;
+    if (used > 1) {
+        double between = 0;
+        for (uint32_t p = 0; p < used; p++) between += (means[p] - result->mean) * (means[p] - result->mean);
+        between /= (double)(used - 1);
+        // variance of process means includes within-process noise / n; remove it
+        double excess = between - result->within_stddev * result->within_stddev / n_avg;
+        result->between_stddev = excess > 0 ? sqrt(excess) : 0;
+        result->ci95 = benchT95(used - 1) * sqrt(between / used);
+    } else {
+        result->between_stddev = 0;
+        result->ci95 = total > 1 ? benchT95(total - 1) * result->within_stddev / sqrt((double)total) : 0;
+    }
+    result->median = benchMedian(samples, total);
+}
+
+/**
+ * @brief Print a benchmark result.
+ */
+void benchReport(const BenchResult* r) {
+    char med[16], mean[16], min[16];
+    printIndent();
+    if (!r->samples) {
+        LOG_WARN("BENCH: %s produced no samples\n", r->name);
+        return;
+    }
+    MSG(CYAN, "%s/op median, %s mean, %s min (%u samples x %llu calls)\n",
+        testFormatNs(med, sizeof(med), r->median), testFormatNs(mean, sizeof(mean), r->mean),
+        testFormatNs(min, sizeof(min), r->min), r->samples, (unsigned long long)r->calls);
+    printIndent();
+    if (r->processes > 1)
+        MSG(CYAN, "noise: \xc2\xb1%.2f%% within process, \xc2\xb1%.2f%% between %u layouts, 95%% CI \xc2\xb1%.2f%%\n",
+            100.0 * r->within_stddev / r->mean, 100.0 * r->between_stddev / r->mean, r->processes,
+            100.0 * r->ci95 / r->mean);
+    else
+        MSG(CYAN, "noise: \xc2\xb1%.2f%% within process, 95%% CI \xc2\xb1%.2f%%\n",
+            100.0 * r->within_stddev / r->mean, 100.0 * r->ci95 / r->mean);
+}
+
+/**
+ * @brief Check whether this is a profile training run (`TEST_BENCH_TRAIN`).
+ *
+ * @return true if benchmarks should only exercise a representative workload.
+ */
+bool benchTraining(void) {
+    const char* env = getenv("TEST_BENCH_TRAIN");
+    return env && *env && strcmp(env, "0") != 0;
+}
+
+/**
+ * @brief Call a function for `bench_config.train_ns`, for a training run.
+ */
+static void benchTrain(const char* name, BenchFn fn, void* arg) {
+    uint64_t calls = 0, start = testClockNs(), now;
+    do {
+        fn(arg);
+        calls++;
+        now = testClockNs();
+    } while ((double)(now - start) < bench_config.train_ns);
+    char took[16];
+    printIndent();
+    MSG(CYAN, "%s: trained %llu calls in %s\n", name, (unsigned long long)calls,
+        testFormatNs(took, sizeof(took), (double)(now - start)));
+}
+
+/**
+ * @brief Run a benchmark in-process or across re-executed processes and report it.
+ *
+ * In a re-executed child this runs only the benchmark the child was started
+ * for, reports its samples to the parent and exits.
+ *
+ * @param name The name of the benchmark (unique within the binary).
+ * @param fn The function to time.
+ * @param arg The argument passed to every call.
+ * @param result Receives the result.
+ */
+void benchRun(const char* name, BenchFn fn, void* arg, BenchResult* result) {
+    static double samples[TEST_BENCH_MAX_PROCESSES * TEST_BENCH_MAX_SAMPLES];
+    uint32_t counts[TEST_BENCH_MAX_PROCESSES];
+    if (bench_child) {
+        if (strcmp(bench_child, name) != 0) return;
+        benchChildRun(fn, arg);
+        _exit(0);
+    }
+    memset(result, 0, sizeof(BenchResult));
+    result->name = name;
+    if (benchTraining()) {
+        benchTrain(name, fn, arg);
+        return;
+    }
+
+    uint16_t processes = bench_config.processes;
+    const char* env = getenv("TEST_BENCH_PROCESSES");
+    if (env && *env) processes = (uint16_t)atoi(env);
+    if (processes > TEST_BENCH_MAX_PROCESSES) processes = TEST_BENCH_MAX_PROCESSES;
+    uint32_t n = bench_config.samples < TEST_BENCH_MAX_SAMPLES ? bench_config.samples : TEST_BENCH_MAX_SAMPLES;
+
+    if (processes <= 1) {
+        result->calls = benchSample(fn, arg, 0, samples, n);
+        counts[0] = n;
+        benchAggregate(samples, counts, 1, result);
+    } else {
+        const char* seed_env = getenv("TEST_BENCH_SEED");
+        uint64_t seed = seed_env ? strtoull(seed_env, NULL, 10) : testClockNs() ^ ((uint64_t)getpid() << 32);
+        uint32_t offset = 0;
+        for (uint16_t p = 0; p < processes; p++) {
+            BenchLayout layout = benchLayoutFrom(benchMix(&seed));
+            uint64_t calls = 0;
+            counts[p] = benchSpawn(name, &layout, samples + offset, &calls);
+            if (calls > result->calls) result->calls = calls;
+            offset += counts[p];
+        }
+        benchAggregate(samples, counts, processes, result);
+    }
+    benchReport(result);
+    if (bench_record && result->samples) bench_record(result);
+}
+
+/**
+ * @brief Median ratio of B to A over a resample of the pairs.
+ */
+static double benchPairRatio(const double* a, const double* b, const uint32_t* idx, uint32_t n,
+                             double* sa, double* sb) {
+    for (uint32_t i = 0; i < n; i++) {
+        sa[i] = a[idx[i]];
+        sb[i] = b[idx[i]];
+    }
+    double ma = benchMedian(sa, n);
+    return ma > 0 ? benchMedian(sb, n) / ma : INFINITY;
+}
+
+/**
+ * @brief Compare two functions in randomized interleaved blocks and report the ratio.
+ *
+ * Both functions are calibrated and warmed up, then `bench_config.samples`
+ * pairs of samples are taken, with A or B going first in each pair at random.
+ * The confidence interval comes from a paired bootstrap: pairs are resampled
+ * together, so drift shared by A and B within a pair cancels out.
+ *
+ * @param a_name The name of the baseline.
+ * @param a The baseline.
+ * @param b_name The name of the candidate.
+ * @param b The candidate.
+ * @param arg The argument passed to every call.
+ * @param margin The speedup B must show over the whole interval, NAN for none.
+ * @param result Receives the comparison.
+ * @return false if B is not faster by the margin.
+ */
+bool benchCompare(const char* a_name, BenchFn a, const char* b_name, BenchFn b, void* arg, double margin,
+                  BenchCompare* result) {
+    static double as[TEST_BENCH_MAX_SAMPLES], bs[TEST_BENCH_MAX_SAMPLES];
+    static double sa[TEST_BENCH_MAX_SAMPLES], sb[TEST_BENCH_MAX_SAMPLES];
+    static double ratios[TEST_BENCH_BOOTSTRAP];
+    static uint32_t idx[TEST_BENCH_MAX_SAMPLES];
+    if (bench_child) return true; // children only run BENCH_EVAL benchmarks
+    if (benchTraining()) {
+        memset(result, 0, sizeof(BenchCompare));
+        result->a = a_name;
+        result->b = b_name;
+        benchTrain(a_name, a, arg);
+        benchTrain(b_name, b, arg);
+        return true;
+    }
+
+    uint32_t n = bench_config.samples < TEST_BENCH_MAX_SAMPLES ? bench_config.samples : TEST_BENCH_MAX_SAMPLES;
+    const char* seed_env = getenv("TEST_BENCH_SEED");
+    uint64_t rng = seed_env ? strtoull(seed_env, NULL, 10) : testClockNs() ^ ((uint64_t)getpid() << 32);
+    memset(result, 0, sizeof(BenchCompare));
+    result->a = a_name;
+    result->b = b_name;
+    if (!n) return true;
+
+    result->a_calls = benchCalibrate(a, arg);
+    result->b_calls = benchCalibrate(b, arg);
+    for (uint32_t s = 0; s < bench_config.warmup; s++) {
+        benchBlock(a, arg, result->a_calls);
+        benchBlock(b, arg, result->b_calls);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (benchMix(&rng) & 1) {
+            as[i] = benchBlock(a, arg, result->a_calls);
+            bs[i] = benchBlock(b, arg, result->b_calls);
+        } else {
+            bs[i] = benchBlock(b, arg, result->b_calls);
+            as[i] = benchBlock(a, arg, result->a_calls);
+        }
+    }
+    result->pairs = n;
+
+    for (uint32_t i = 0; i < n; i++) idx[i] = i;
+    result->ratio = benchPairRatio(as, bs, idx, n, sa, sb);
+    result->a_median = benchMedian(sa, n);
+    result->b_median = benchMedian(sb, n);
+    for (uint32_t r = 0; r < TEST_BENCH_BOOTSTRAP; r++) {
+        for (uint32_t i = 0; i < n; i++) idx[i] = (uint32_t)(benchMix(&rng) % n);
+        ratios[r] = benchPairRatio(as, bs, idx, n, sa, sb);
+    }
+    qsort(ratios, TEST_BENCH_BOOTSTRAP, sizeof(double), benchCmp);
+    result->lo = ratios[(uint32_t)(0.025 * TEST_BENCH_BOOTSTRAP)];
+    result->hi = ratios[(uint32_t)(0.975 * TEST_BENCH_BOOTSTRAP) - 1];
+
+    char am[16], bm[16];
+    printIndent();
+    MSG(CYAN, "%s: %s/op, %s: %s/op median (%u interleaved pairs)\n", a_name,
+        testFormatNs(am, sizeof(am), result->a_median), b_name, testFormatNs(bm, sizeof(bm), result->b_median), n);
+    printIndent();
+    if (result->hi < 1.0)
+        MSG(GREEN, "%s/%s = %.3f [%.3f, %.3f] 95%% CI, %s is %.1f%% faster\n", b_name, a_name, result->ratio,
+            result->lo, result->hi, b_name, 100.0 * (1.0 - result->ratio));
+    else if (result->lo > 1.0)
+        MSG(YELLOW, "%s/%s = %.3f [%.3f, %.3f] 95%% CI, %s is %.1f%% slower\n", b_name, a_name, result->ratio,
+            result->lo, result->hi, b_name, 100.0 * (result->ratio - 1.0));
+    else
+        MSG(CYAN, "%s/%s = %.3f [%.3f, %.3f] 95%% CI, no significant difference\n", b_name, a_name,
+            result->ratio, result->lo, result->hi);
+    return isnan(margin) || result->hi <= 1.0 - margin;
+}
@@ -0,0 +1,310 @@
+#pragma once
+/**
+ * @file test_utils_cache.h
+ *
+ * @brief Persistent, content-addressed cache for generated test data.
+ *
+ * @details
+ * cacheGet() returns a read-only mapping of a blob produced by a generator
+ * `void fill(void* buf, size_t size, const void* params, uint64_t seed)`.
+ * The blob is keyed by a 128-bit hash of the generator ID, the parameter
+ * bytes, the seed and the size:
+ *
+ * - On a hit the cached file is mapped read-only, without running the generator.
+ * - On a miss the generator fills a temporary file in the cache directory,
+ *   which is then renamed into place. Rename is atomic, so readers never see a
+ *   partial entry; concurrent writers of the same key produce identical
+ *   contents and the last rename wins.
+ *
+ * The generator ID must change whenever the generator's output changes for
+ * the same inputs (e.g. "keys/v2"), since entries are never invalidated
+ * otherwise. CACHE_GET(blob, fill, id, params, seed, size) therefore takes the
+ * ID explicitly, next to the generator, and hashes the object params points to. Every byte of it is
+ * hashed, padding included, so a parameter struct with padding must be
+ * cleared with memset() before its fields are set; an initializer does not
+ * reliably zero the padding, and garbage in it turns every run into a miss.
+ *
+ * Entries live in `TEST_CACHE_DIR`, or `$XDG_CACHE_HOME/test_utils`, or
+ * `$HOME/.cache/test_utils`. Temporary files older than TEST_CACHE_STALE_S,
+ * left by writers that were killed before publishing, are removed when the
+ * directory is first used. Setting `TEST_CACHE_DISABLE` (or failing to
+ * create the directory) generates into anonymous memory instead.
+ *
+ * @code
+ * CacheBlob keys;
+ * KeyParams p;
+ * memset(&p, 0, sizeof(p)); // padding is hashed too
+ * p.count = 1 << 24;
+ * p.skew = 1.2;
+ * CACHE_GET(&keys, genZipfKeys, "zipf-keys/v1", &p, 42, p.count * sizeof(uint64_t));
+ * const uint64_t* k = (const uint64_t*)keys.data;
+ * ...
+ * cacheRelease(&keys);
+ * @endcode
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#define TEST_CACHE_MAGIC 0x31454843414355ull // "UCACHE1"
+#define TEST_CACHE_HEADER 64 // bytes before the data, keeps the data cache line aligned
+
+#ifndef TEST_CACHE_STALE_S
+#define TEST_CACHE_STALE_S 3600 // age after which an unpublished temporary file is removed
+#endif
+
+/**
+ * @brief Get a cached blob.
+ *
+ * @param blob Receives the blob.
+ * @param fill The generator, `void fill(void* buf, size_t size, const void* params, uint64_t seed)`.
+ * @param id The generator ID (a string), changed whenever the generator's output changes.
+ * @param params Pointer to the generator parameters, hashed by value, padding included (zero it first).
+ * @param seed The generator seed.
+ * @param size The size of the blob in bytes.
+ */
+#define CACHE_GET(blob, fill, id, params, seed, size) \
+    cacheGet(blob, id, fill, params, sizeof(*(params)), seed, size)
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief A generator of cached data.
+ */
+typedef void (*CacheFill)(void* buf, size_t size, const void* params, uint64_t seed);
+
+/**
+ * @brief The header of a cache entry.
+ */
+typedef struct {
+    uint64_t magic;
+    uint64_t key[2];
+    uint64_t size;
+    uint8_t reserved[TEST_CACHE_HEADER - 4 * sizeof(uint64_t)];
+} CacheHeader;
+
+/**
+ * @brief A blob returned by cacheGet().
+ */
+typedef struct {
+    const void* data;   // the blob, read-only.
+    size_t size;        // size of the blob in bytes.
+    bool hit;           // served from the cache without running the generator.
+    void* map;          // the mapping, including the header.
+    size_t map_len;
+} CacheBlob;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+uint32_t cache_hits = 0;    // blobs served from the cache.
+uint32_t cache_misses = 0;  // blobs generated.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Hash bytes into a 128-bit key (two independently seeded 64-bit streams).
+ */
+static void cacheHash(uint64_t key[2], const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        key[0] = (key[0] ^ p[i]) * 0x100000001B3ull;
+        key[1] = (key[1] ^ p[i]) * 0x9E3779B97F4A7C15ull;
+        key[1] ^= key[1] >> 29;
+    }
+}
+
+/**
+ * @brief Compute the key of a blob.
+ */
+static void cacheKey(uint64_t key[2], const char* id, const void* params, size_t params_len, uint64_t seed,
+                     size_t size) {
+    uint64_t fixed[3] = { (uint64_t)params_len, seed, (uint64_t)size };
+    key[0] = 0xCBF29CE484222325ull;
+    key[1] = 0x84222325CBF29CE4ull;
+    cacheHash(key, id, strlen(id) + 1);
+    cacheHash(key, fixed, sizeof(fixed));
+    if (params_len) cacheHash(key, params, params_len);
+}
+
+/**
+ * @brief Remove temporary files of writers killed before they published, once per process.
+ */
+static void cacheSweep(const char* dir) {
+    static bool swept = false;
+    if (__atomic_exchange_n(&swept, true, __ATOMIC_RELAXED)) return;
+    DIR* d = opendir(dir);
+    if (!d) return;
+    time_t now = time(NULL);
+    struct dirent* e;
+    while ((e = readdir(d))) {
+        struct stat st;
+        if (strncmp(e->d_name, ".tmp_", 5) != 0) continue;
+        if (fstatat(dirfd(d), e->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode) &&
+            now - st.st_mtime > TEST_CACHE_STALE_S)
+            unlinkat(dirfd(d), e->d_name, 0);
+    }
+    closedir(d);
+}
+
+/**
+ * @brief Find (and create) the cache directory.
+ *
+ * @return false if caching is disabled or the directory cannot be created.
+ */
+static bool cacheDir(char* buf, size_t len) {
+    const char* env = getenv("TEST_CACHE_DISABLE");
+    if (env && *env && strcmp(env, "0") != 0) return false;
+    const char* dir = getenv("TEST_CACHE_DIR");
+    if (dir && *dir) {
+        snprintf(buf, len, "%s", dir);
+    } else if ((dir = getenv("XDG_CACHE_HOME")) && *dir) {
+        snprintf(buf, len, "%s/test_utils", dir);
+    } else if ((dir = getenv("HOME")) && *dir) {
+        snprintf(buf, len, "%s/.cache/test_utils", dir);
+    } else {
+        snprintf(buf, len, "/tmp/test_utils_cache");
+    }
+    // mkdir -p
+    for (char* p = buf + 1; ; p++) {
+        if (*p != '/' && *p != '\0') continue;
+        char c = *p;
+        *p = '\0';
+        bool ok = mkdir(buf, 0755) == 0 || errno == EEXIST;
+        *p = c;
+        if (!ok) return false;
+        if (!c) break;
+    }
+    cacheSweep(buf);
+    return true;
+}
+
+/**
+ * @brief Map an existing entry, checking its header.
+ */
+static bool cacheOpen(CacheBlob* blob, const char* path, const uint64_t key[2], size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    size_t len = TEST_CACHE_HEADER + size;
+    void* map = fstat(fd, &st) == 0 && (size_t)st.st_size == len ? mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0)
+                                                                  : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    const CacheHeader* h = (const CacheHeader*)map;
+    if (h->magic != TEST_CACHE_MAGIC || h->key[0] != key[0] || h->key[1] != key[1] || h->size != size) {
+        munmap(map, len);
+        return false;
+    }
+    blob->map = map;
+    blob->map_len = len;
+    blob->data = (const char*)map + TEST_CACHE_HEADER;
+    return true;
+}
+
+/**
+ * @brief Generate an entry into a temporary file and publish it under path.
+ */
+static bool cachePublish(CacheBlob* blob, const char* dir, const char* path, const uint64_t key[2], size_t size,
+                         CacheFill fill, const void* params, uint64_t seed) {
+    char tmp[600];
+    size_t len = TEST_CACHE_HEADER + size;
+    snprintf(tmp, sizeof(tmp), "%s/.tmp_%016llx%016llx_XXXXXX", dir, (unsigned long long)key[0],
+             (unsigned long long)key[1]);
+    int fd = mkstemp(tmp); // unique per call, so threads of one process never share it
+    if (fd < 0) return false;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fchmod(fd, 0644);
+    void* map = ftruncate(fd, (off_t)len) == 0 ? mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                               : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        close(fd);
+        unlink(tmp);
+        return false;
+    }
+    fill((char*)map + TEST_CACHE_HEADER, size, params, seed);
+    CacheHeader* h = (CacheHeader*)map;
+    h->key[0] = key[0];
+    h->key[1] = key[1];
+    h->size = size;
+    h->magic = TEST_CACHE_MAGIC; // written last, after the data is complete
+    bool ok = msync(map, len, MS_SYNC) == 0 && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp, path) != 0) {
+        munmap(map, len);
+        unlink(tmp);
+        return false;
+    }
+    mprotect(map, len, PROT_READ);
+    blob->map = map;
+    blob->map_len = len;
+    blob->data = (const char*)map + TEST_CACHE_HEADER;
+    return true;
+}
+
+/**
+ * @brief Get a generated blob from the cache, generating and publishing it on a miss.
+ *
+ * @param blob Receives the blob, to be released with cacheRelease().
+ * @param id The generator ID, changed whenever its output changes.
+ * @param fill The generator.
+ * @param params The generator parameters (hashed by value, padding included), or NULL.
+ * @param params_len The size of the parameters in bytes.
+ * @param seed The generator seed.
+ * @param size The size of the blob in bytes.
+ * @return true on success; false only if the blob could not be generated at all.
+ */
+bool cacheGet(CacheBlob* blob, const char* id, CacheFill fill, const void* params, size_t params_len, uint64_t seed,
+              size_t size) {
+    char dir[512], path[600];
+    uint64_t key[2];
+    memset(blob, 0, sizeof(CacheBlob));
+    blob->size = size;
+    cacheKey(key, id, params, params_len, seed, size);
+
+    if (cacheDir(dir, sizeof(dir))) {
+        snprintf(path, sizeof(path), "%s/%016llx%016llx", dir, (unsigned long long)key[0],
+                 (unsigned long long)key[1]);
+        if (cacheOpen(blob, path, key, size)) {
+            blob->hit = true;
+            cache_hits++;
+            return true;
+        }
+        cache_misses++;
+        if (cachePublish(blob, dir, path, key, size, fill, params, seed)) return true;
+        printIndent();
+        LOG_WARN("CACHE: cannot write %s (%s), generating in memory\n", path, strerror(errno));
+    } else {
+        cache_misses++;
+    }
+
+    // uncached: generate into anonymous memory
+    blob->map_len = TEST_CACHE_HEADER + size;
+    blob->map = mmap(NULL, blob->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (blob->map == MAP_FAILED) {
+        memset(blob, 0, sizeof(CacheBlob));
+        return false;
+    }
+    fill((char*)blob->map + TEST_CACHE_HEADER, size, params, seed);
+    mprotect(blob->map, blob->map_len, PROT_READ);
+    blob->data = (const char*)blob->map + TEST_CACHE_HEADER;
+    return true;
+}
+
+/**
+ * @brief Unmap a blob returned by cacheGet().
+ */
+void cacheRelease(CacheBlob* blob) {
+    if (blob->map) munmap(blob->map, blob->map_len);
+    memset(blob, 0, sizeof(CacheBlob));
+}
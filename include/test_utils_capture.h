@@ -0,0 +1,283 @@
+#pragma once
+/**
+ * @file test_utils_capture.h
+ *
+ * @brief In-memory capture of stdout, stderr and other file descriptors.
+ *
+ * @details
+ * This header provides the following capture functions:
+ *
+ * - captureFd: Redirect a file descriptor (e.g. STDOUT_FILENO) into memory.
+ *   Catches raw write(2) calls as well as flushed stdio output. A memfd is
+ *   used when available, otherwise a pipe drained by a background reader.
+ * - captureStream: Swap a `FILE*` variable (e.g. `stdout`) for an
+ *   open_memstream. Cheaper, but only catches writes through that variable.
+ * - captureEnd: Restore the original descriptor or stream and make the
+ *   captured bytes available as a NUL terminated buffer.
+ *
+ * and the following assertions on the captured bytes:
+ *
+ * - ASSERT_CAPTURED: Assert that the captured output equals a string.
+ * - ASSERT_CAPTURED_CONTAINS: Assert that the captured output contains a string.
+ *
+ * Including this header moves the framework's own output (TEST_OUT) to a
+ * duplicate of the original stdout descriptor, so MSG/LOG_* output is never
+ * captured and still reaches the console while stdout is redirected. The
+ * duplicate is unbuffered and pending stdout output is flushed before every
+ * framework write (see testOut()), so both stay in order even when stdout is
+ * fully buffered.
+ *
+ * @code
+ * Capture cap;
+ * captureFd(&cap, STDOUT_FILENO);
+ * printReport(&report);
+ * captureEnd(&cap);
+ * ASSERT_CAPTURED(&cap, "total: 3\n", "report output");
+ * captureFree(&cap);
+ * @endcode
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* -- Assertions ----------------------------------------------------------*/
+
+/**
+ * @brief Assert that the captured output equals a string
+ *
+ * @param cap The finished Capture
+ * @param expected The expected output
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_CAPTURED(cap, expected, msg, ...)                                    \
+    do {                                                                            \
+        const char* _exp = (expected);                                              \
+        if ((cap)->truncated || (cap)->len != strlen(_exp) ||                       \
+            memcmp((cap)->data, _exp, (cap)->len)) {                                \
+            failCase();                                                             \
+            printIndent();                                                          \
+            LOG_ERROR("ASSERT_CAPTURED: %s != %s [\"%.*s\"%s]%s :: " msg "\n",      \
+                      #cap, #expected, (int)((cap)->len < 80 ? (cap)->len : 80),    \
+                      (cap)->data, (cap)->len > 80 ? "..." : "",                    \
+                      (cap)->truncated ? " (capture truncated)" : "", ##__VA_ARGS__); \
+        }                                                                           \
+    } while (0)
+
+/**
+ * @brief Assert that the captured output contains a string
+ *
+ * @param cap The finished Capture
+ * @param needle The string to find
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_CAPTURED_CONTAINS(cap, needle, msg, ...)                             \
+    do {                                                                            \
+        const char* _needle = (needle);                                             \
+        if (!memmem((cap)->data, (cap)->len, _needle, strlen(_needle))) {           \
+            failCase();                                                             \
+            printIndent();                                                          \
+            LOG_ERROR("ASSERT_CAPTURED_CONTAINS: %s does not contain %s%s :: " msg  \
+                      "\n", #cap, #needle,                                          \
+                      (cap)->truncated ? " (capture truncated)" : "", ##__VA_ARGS__); \
+        }                                                                           \
+    } while (0)
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief State of an in-memory capture.
+ */
+typedef struct {
+    char* data;         // captured bytes (NUL terminated) once captureEnd() returned.
+    size_t len;         // number of captured bytes.
+    size_t cap;         // allocated size of data.
+    bool truncated;     // bytes were discarded for lack of memory, data is incomplete.
+    int fd;             // captured descriptor, -1 for a stream capture.
+    int saved;          // duplicate of the original descriptor.
+    int memfd;          // memfd backing the capture, -1 in pipe mode.
+    int pipe;           // read end of the pipe in pipe mode, -1 otherwise.
+    pthread_t reader;   // thread draining the pipe.
+    FILE** stream;      // captured stream variable for a stream capture.
+    FILE* original;     // original value of *stream.
+    FILE* memstream;    // open_memstream replacing *stream.
+} Capture;
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Move the framework output to its own descriptor.
+ */
+__attribute__((constructor)) static void captureDetachOutput(void) {
+    if (test_out) return;
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0) return;
+    test_out = fdopen(fd, "w");
+    if (test_out) setvbuf(test_out, NULL, _IONBF, 0); // never holds output back behind later stdout writes
+}
+
+/**
+ * @brief Background reader draining a capture pipe.
+ */
+static void* captureReader(void* p) {
+    Capture* c = (Capture*)p;
+    char scratch[4096];
+    for (;;) {
+        if (c->cap - c->len < 4096 && !c->truncated) {
+            size_t cap = c->cap ? c->cap * 2 : 65536;
+            char* data = (char*)realloc(c->data, cap);
+            if (data) {
+                c->data = data;
+                c->cap = cap;
+            } else {
+                c->truncated = true;
+            }
+        }
+        // out of memory: keep draining until EOF, or the writer blocks on a full pipe
+        bool room = !c->truncated || c->cap - c->len > 1;
+        ssize_t r = room ? read(c->pipe, c->data + c->len, c->cap - c->len - 1)
+                         : read(c->pipe, scratch, sizeof(scratch));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        if (room) c->len += (size_t)r;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Flush the stdio stream writing to a descriptor, if any.
+ */
+static void captureFlush(int fd) {
+    fflush(fd == STDERR_FILENO ? stderr : fd == STDOUT_FILENO ? stdout : NULL);
+}
+
+/**
+ * @brief Start capturing everything written to a file descriptor.
+ *
+ * @param c The capture state.
+ * @param fd The descriptor to capture, e.g. STDOUT_FILENO.
+ * @return true if the capture started.
+ */
+bool captureFd(Capture* c, int fd) {
+    int fds[2];
+    memset(c, 0, sizeof(Capture));
+    c->fd = fd;
+    c->memfd = c->pipe = -1;
+    captureDetachOutput();
+    captureFlush(fd);
+    c->saved = dup(fd);
+    if (c->saved < 0) return false;
+
+    c->memfd = memfd_create("test_capture", MFD_CLOEXEC);
+    if (c->memfd >= 0) {
+        if (dup2(c->memfd, fd) >= 0) return true;
+        close(c->memfd);
+        c->memfd = -1;
+    }
+    if (pipe(fds) == 0) {
+        c->pipe = fds[0];
+        if (dup2(fds[1], fd) >= 0 && pthread_create(&c->reader, NULL, captureReader, c) == 0) {
+            close(fds[1]);
+            return true;
+        }
+        dup2(c->saved, fd);
+        close(fds[0]);
+        close(fds[1]);
+        c->pipe = -1;
+    }
+    close(c->saved);
+    c->saved = -1;
+    return false;
+}
+
+/**
+ * @brief Start capturing everything written through a stream variable.
+ *
+ * @param c The capture state.
+ * @param stream The stream variable to swap, e.g. &stdout.
+ * @return true if the capture started.
+ */
+bool captureStream(Capture* c, FILE** stream) {
+    memset(c, 0, sizeof(Capture));
+    c->fd = c->saved = c->memfd = c->pipe = -1;
+    captureDetachOutput();
+    fflush(*stream);
+    c->memstream = open_memstream(&c->data, &c->len);
+    if (!c->memstream) return false;
+    c->stream = stream;
+    c->original = *stream;
+    *stream = c->memstream;
+    return true;
+}
+
+/**
+ * @brief Stop a capture and collect the captured bytes into c->data / c->len.
+ *
+ * @param c The capture state.
+ * @return true if the bytes were collected.
+ */
+bool captureEnd(Capture* c) {
+    bool ok = true;
+    if (c->stream) {
+        *c->stream = c->original;
+        ok = fclose(c->memstream) == 0; // sets data and len
+        c->stream = NULL;
+        c->cap = c->len + 1;
+        return ok;
+    }
+    if (c->saved < 0) return false;
+    captureFlush(c->fd);
+    dup2(c->saved, c->fd); // drops the last writer of a pipe
+    close(c->saved);
+    c->saved = -1;
+
+    if (c->pipe >= 0) {
+        pthread_join(c->reader, NULL);
+        close(c->pipe);
+        c->pipe = -1;
+    } else {
+        struct stat st;
+        ok = fstat(c->memfd, &st) == 0;
+        c->len = ok ? (size_t)st.st_size : 0;
+        c->cap = c->len + 1;
+        c->data = (char*)malloc(c->cap);
+        if (!c->data && c->len) c->truncated = true;
+        for (size_t got = 0; ok && c->data && got < c->len; ) {
+            ssize_t r = pread(c->memfd, c->data + got, c->len - got, (off_t)got);
+            if (r <= 0) {
+                c->len = got;
+                ok = false;
+            } else {
+                got += (size_t)r;
+            }
+        }
+        close(c->memfd);
+        c->memfd = -1;
+    }
+    if (!c->data) {
+        c->data = (char*)malloc(1);
+        c->len = 0;
+        c->cap = 1;
+        ok = ok && c->data;
+    }
+    if (c->data) c->data[c->len] = '\0';
+    return ok;
+}
+
+/**
+ * @brief Release the captured bytes.
+ */
+void captureFree(Capture* c) {
+    free(c->data);
+    c->data = NULL;
+    c->len = c->cap = 0;
+}
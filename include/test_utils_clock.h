@@ -0,0 +1,287 @@
+#pragma once
+/**
+ * @file test_utils_clock.h
+ *
+ * @brief Time source shared by the profiling and benchmarking helpers.
+ *
+ * @details
+ * This header provides the following components:
+ *
+ * - testClockNs: Read a monotonic timestamp in nanoseconds.
+ * - testClockTicks: Read the raw clock, unserialized.
+ * - testClockTicksBegin / testClockTicksEnd: Serialized reads bracketing a timed region.
+ * - testClockTicksToNs: Convert a tick count to nanoseconds.
+ * - testClockReport: Print the time source, its overhead and its resolution.
+ * - testFormatNs: Format a nanosecond duration with a human readable unit.
+ *
+ * On x86 with an invariant TSC (constant rate, not stopped in idle states)
+ * and rdtscp, the clock reads the TSC directly instead of calling
+ * clock_gettime, and converts ticks with a fixed-point multiply. On first use
+ * the rate is calibrated against CLOCK_MONOTONIC_RAW over
+ * TEST_CLOCK_CALIBRATE_MS, and the clock's own read overhead and smallest
+ * observable step are measured into `test_clock`. Without an invariant TSC,
+ * on other architectures, or with `TEST_CLOCK=monotonic` in the environment,
+ * ticks are CLOCK_MONOTONIC nanoseconds.
+ *
+ * testClockTicksBegin() waits for earlier instructions to finish before
+ * reading (lfence; rdtsc; lfence) and testClockTicksEnd() waits for the timed
+ * code (rdtscp; lfence), so the measured region is exactly the code between
+ * them.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+#include <math.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define TEST_CLOCK_TSC
+#endif
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_CLOCK_CALIBRATE_MS
+#define TEST_CLOCK_CALIBRATE_MS 10 // duration of the TSC calibration
+#endif
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief The calibrated time source.
+ */
+typedef struct {
+    bool tsc;               // ticks are TSC cycles, otherwise CLOCK_MONOTONIC ns.
+    uint64_t mult;          // ns per tick in 32.32 fixed point.
+    uint64_t tick0;         // tick at calibration.
+    uint64_t ns0;           // ns at calibration.
+    double ghz;             // ticks per ns.
+    double overhead_ns;     // cost of one testClockNs() call.
+    double resolution_ns;   // smallest step observed between two reads.
+} TestClock;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+TestClock test_clock = { 0 };
+int test_clock_state = 0; // 0: uncalibrated, 1: calibrating, 2: ready.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+void testClockInit(void);
+
+/**
+ * @brief Read a POSIX clock in nanoseconds.
+ */
+static inline uint64_t testClockMonotonic(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Calibrate the clock on first use.
+ */
+static inline void testClockReady(void) {
+    if (__builtin_expect(__atomic_load_n(&test_clock_state, __ATOMIC_ACQUIRE) != 2, 0)) testClockInit();
+}
+
+/**
+ * @brief Read the selected time source, calibrated or not.
+ */
+static inline uint64_t testClockRead(void) {
+#ifdef TEST_CLOCK_TSC
+    if (test_clock.tsc) return __rdtsc();
+#endif
+    return testClockMonotonic(CLOCK_MONOTONIC);
+}
+
+/**
+ * @brief Read the clock without serialization.
+ *
+ * The read may be reordered with neighbouring instructions; use it for
+ * timestamps and long intervals.
+ *
+ * @return The current tick.
+ */
+static inline uint64_t testClockTicks(void) {
+    testClockReady();
+    return testClockRead();
+}
+
+/**
+ * @brief Read the clock at the start of a timed region, after all earlier instructions.
+ *
+ * @return The current tick.
+ */
+static inline uint64_t testClockTicksBegin(void) {
+    testClockReady();
+#ifdef TEST_CLOCK_TSC
+    if (test_clock.tsc) {
+        _mm_lfence();
+        uint64_t t = __rdtsc();
+        _mm_lfence();
+        return t;
+    }
+#endif
+    return testClockMonotonic(CLOCK_MONOTONIC);
+}
+
+/**
+ * @brief Read the clock at the end of a timed region, after the timed code completed.
+ *
+ * @return The current tick.
+ */
+static inline uint64_t testClockTicksEnd(void) {
+    testClockReady();
+#ifdef TEST_CLOCK_TSC
+    if (test_clock.tsc) {
+        unsigned aux;
+        uint64_t t = __rdtscp(&aux);
+        _mm_lfence();
+        return t;
+    }
+#endif
+    return testClockMonotonic(CLOCK_MONOTONIC);
+}
+
+/**
+ * @brief Convert a number of ticks to nanoseconds.
+ */
+static inline uint64_t testClockTicksToNs(uint64_t ticks) {
+    return (uint64_t)(((unsigned __int128)ticks * test_clock.mult) >> 32);
+}
+
+/**
+ * @brief Convert a tick to nanoseconds since the epoch of testClockNs().
+ *
+ * A tick read before the calibration point (e.g. from a core whose TSC lags
+ * slightly) maps to the calibration time rather than wrapping around.
+ */
+static inline uint64_t testClockTickNs(uint64_t t) {
+    int64_t d = (int64_t)(t - test_clock.tick0);
+    return test_clock.ns0 + (d > 0 ? testClockTicksToNs((uint64_t)d) : 0);
+}
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return The current time in nanoseconds from an arbitrary epoch.
+ */
+static inline uint64_t testClockNs(void) {
+    return testClockTickNs(testClockTicks());
+}
+
+#ifdef TEST_CLOCK_TSC
+/**
+ * @brief Check for an invariant TSC and rdtscp.
+ */
+static bool testClockHasTsc(void) {
+    unsigned a, b, c, d;
+    if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007) return false;
+    __get_cpuid(0x80000001, &a, &b, &c, &d);
+    if (!(d & (1u << 27))) return false; // rdtscp
+    __get_cpuid(0x80000007, &a, &b, &c, &d);
+    return (d & (1u << 8)) != 0; // invariant TSC
+}
+
+/**
+ * @brief Read the TSC and CLOCK_MONOTONIC_RAW as close together as possible.
+ */
+static void testClockPair(uint64_t* tick, uint64_t* ns) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 8; i++) {
+        uint64_t t0 = __rdtsc();
+        uint64_t n = testClockMonotonic(CLOCK_MONOTONIC_RAW);
+        uint64_t t1 = __rdtsc();
+        if (t1 - t0 < best) {
+            best = t1 - t0;
+            *tick = t0 + (t1 - t0) / 2;
+            *ns = n;
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Select and calibrate the time source, then measure its overhead and resolution.
+ *
+ * Called on first use; safe to call from several threads.
+ */
+void testClockInit(void) {
+    int expect = 0;
+    if (!__atomic_compare_exchange_n(&test_clock_state, &expect, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&test_clock_state, __ATOMIC_ACQUIRE) != 2) {}
+        return;
+    }
+    test_clock.tsc = false;
+    test_clock.mult = 1ull << 32;
+    test_clock.tick0 = 0;
+    test_clock.ns0 = 0;
+    test_clock.ghz = 1.0;
+#ifdef TEST_CLOCK_TSC
+    const char* env = getenv("TEST_CLOCK");
+    if (!(env && strcmp(env, "monotonic") == 0) && testClockHasTsc()) {
+        uint64_t t0, n0, t1, n1;
+        testClockPair(&t0, &n0);
+        while (testClockMonotonic(CLOCK_MONOTONIC_RAW) - n0 < TEST_CLOCK_CALIBRATE_MS * 1000000ull) {}
+        testClockPair(&t1, &n1);
+        double ns_per_tick = t1 > t0 ? (double)(n1 - n0) / (double)(t1 - t0) : 0;
+        if (ns_per_tick > 0.01 && ns_per_tick < 10) { // 100 MHz .. 100 GHz, otherwise untrustworthy
+            test_clock.tsc = true;
+            test_clock.mult = (uint64_t)(ns_per_tick * 4294967296.0 + 0.5);
+            test_clock.tick0 = t1;
+            test_clock.ns0 = n1;
+            test_clock.ghz = 1.0 / ns_per_tick;
+        }
+    }
+#endif
+
+    // measured through the uncalibrated path: other threads wait for state 2,
+    // which is only published once every field is filled
+    double overhead = INFINITY, resolution = INFINITY;
+    for (int r = 0; r < 5; r++) {
+        uint64_t t0 = testClockTickNs(testClockRead()), prev = t0, now = t0;
+        for (int i = 0; i < 1000; i++) {
+            now = testClockTickNs(testClockRead());
+            if (now > prev && (double)(now - prev) < resolution) resolution = (double)(now - prev);
+            prev = now;
+        }
+        if ((double)(now - t0) / 1000.0 < overhead) overhead = (double)(now - t0) / 1000.0;
+    }
+    test_clock.overhead_ns = overhead;
+    test_clock.resolution_ns = isinf(resolution) ? 0 : resolution;
+    __atomic_store_n(&test_clock_state, 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Format a duration as ns/us/ms/s with three significant digits.
+ *
+ * @param buf The buffer to write to.
+ * @param len The size of the buffer.
+ * @param ns The duration in nanoseconds.
+ * @return buf, for use as a printf argument.
+ */
+char* testFormatNs(char* buf, size_t len, double ns) {
+    if (ns < 1e3)       snprintf(buf, len, "%.0fns", ns);
+    else if (ns < 1e6)  snprintf(buf, len, "%.3gus", ns / 1e3);
+    else if (ns < 1e9)  snprintf(buf, len, "%.3gms", ns / 1e6);
+    else                snprintf(buf, len, "%.3gs",  ns / 1e9);
+    return buf;
+}
+
+/**
+ * @brief Print the time source with its measured overhead and resolution.
+ */
+void testClockReport(void) {
+    testClockReady();
+    printIndent();
+    if (test_clock.tsc)
+        MSG(CYAN, "clock: invariant TSC at %.4f GHz, %.1fns per read, %.1fns resolution\n", test_clock.ghz,
+            test_clock.overhead_ns, test_clock.resolution_ns);
+    else
+        MSG(CYAN, "clock: clock_gettime(CLOCK_MONOTONIC), %.1fns per read, %.1fns resolution\n",
+            test_clock.overhead_ns, test_clock.resolution_ns);
+}
@@ -0,0 +1,404 @@
+#pragma once
+/**
+ * @file test_utils_ddmin.h
+ *
+ * @brief Delta-debugging minimizer for failing input files.
+ *
+ * @details
+ * DDMIN_EVAL(fn, input, output) shrinks an input file on which a test function
+ * `void fn(const char* path)` fails, using Zeller's ddmin algorithm:
+ *
+ * - The input is split into units of `ddmin_config.granularity`: lines,
+ *   bytes, or whitespace separated tokens.
+ * - Each probe writes a candidate (a subset of the current units, or its
+ *   complement) to a temporary file and runs the test function on it in a
+ *   forked worker. A probe fails when the worker reports a failed assertion or
+ *   crashes; probes exceeding `ddmin_config.timeout` count as passing. A
+ *   probe that cannot write its candidate, or cannot be forked at all, stops
+ *   the minimization with an error.
+ * - Up to `ddmin_config.jobs` probes run in parallel. Of the candidates that
+ *   fail, the first in ddmin order is kept, so the result does not depend on
+ *   scheduling.
+ *
+ * Minimization stops at a 1-minimal input: removing any single unit makes the
+ * test pass. The current best input is written to the output file after
+ * every reduction, so an interrupted run still leaves a useful result.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_clock.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_DDMIN_MAX_JOBS
+#define TEST_DDMIN_MAX_JOBS 256 // parallel probe workers
+#endif
+
+#define TEST_DDMIN_ERROR (-2) // ddminRound() could not run a probe
+#define DDMIN_EXIT_NO_INPUT 125 // probe exit status: the candidate could not be written
+
+/**
+ * @brief Minimize a failing input file of a test function.
+ *
+ * @param fn The test function, `void fn(const char* path)`.
+ * @param input The failing input file.
+ * @param output The file the minimized input is written to.
+ */
+#define DDMIN_EVAL(fn, input, output)               \
+    MSG(MAGENTA, "%s() [ddmin]:\n", #fn);           \
+    depth++;                                        \
+    ddminRun(fn, input, output);                    \
+    depth--;
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief A test function run on a candidate input file.
+ */
+typedef void (*DdminTest)(const char* path);
+
+/**
+ * @brief The units an input is reduced in.
+ */
+typedef enum {
+    DDMIN_LINES,    // lines, including their newline.
+    DDMIN_BYTES,    // single bytes.
+    DDMIN_TOKENS,   // runs of non-whitespace with their leading whitespace.
+} DdminGranularity;
+
+/**
+ * @brief Minimizer configuration.
+ */
+typedef struct {
+    DdminGranularity granularity;
+    uint16_t jobs;      // parallel probes, 0 for the number of online CPUs.
+    unsigned timeout;   // seconds before a probe is killed and counted as passing, 0 for none.
+} DdminConfig;
+
+/**
+ * @brief State of a minimization.
+ */
+typedef struct {
+    DdminTest fn;
+    const char* data;   // the original input.
+    size_t* start;      // offset of each unit in data.
+    size_t* len;        // length of each unit.
+    size_t* cur;        // units of the current failing configuration.
+    size_t cur_n;       // number of units in cur.
+    size_t* next;       // scratch for the next configuration.
+    uint64_t probes;    // probes run so far.
+} DdminCtx;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+DdminConfig ddmin_config = {
+    .granularity = DDMIN_LINES,
+    .jobs = 0,
+    .timeout = 60,
+};
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Split the input into units, or only count them when c->start is NULL.
+ *
+ * @return The number of units.
+ */
+static size_t ddminSplit(DdminCtx* c, size_t size) {
+    size_t n = 0;
+    for (size_t i = 0; i < size; ) {
+        size_t end = i + 1;
+        if (ddmin_config.granularity == DDMIN_LINES) {
+            const char* nl = (const char*)memchr(c->data + i, '\n', size - i);
+            end = nl ? (size_t)(nl - c->data) + 1 : size;
+        } else if (ddmin_config.granularity == DDMIN_TOKENS) {
+            end = i;
+            while (end < size && isspace((unsigned char)c->data[end])) end++;
+            while (end < size && !isspace((unsigned char)c->data[end])) end++;
+        }
+        if (c->start) {
+            c->start[n] = i;
+            c->len[n] = end - i;
+        }
+        n++;
+        i = end;
+    }
+    return n;
+}
+
+/**
+ * @brief Write a configuration to a file.
+ *
+ * @param c The minimizer state.
+ * @param path The file to write.
+ * @param units The units to write.
+ * @param n The number of units.
+ * @return true on success.
+ */
+static bool ddminWrite(const DdminCtx* c, const char* path, const size_t* units, size_t n) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return false;
+    for (size_t i = 0; i < n; ) {
+        // coalesce adjacent units into one write
+        size_t j = i + 1;
+        while (j < n && units[j] == units[j - 1] + 1) j++;
+        size_t bytes = c->start[units[j - 1]] + c->len[units[j - 1]] - c->start[units[i]];
+        if (fwrite(c->data + c->start[units[i]], 1, bytes, f) != bytes) break;
+        i = j;
+    }
+    return fclose(f) == 0;
+}
+
+/**
+ * @brief Build candidate i of n: chunk i of the current configuration, or its complement.
+ *
+ * @return The number of units written to out.
+ */
+static size_t ddminCandidate(const DdminCtx* c, size_t i, size_t n, bool complement, size_t* out) {
+    size_t lo = i * c->cur_n / n, hi = (i + 1) * c->cur_n / n, k = 0;
+    for (size_t u = 0; u < c->cur_n; u++)
+        if ((u >= lo && u < hi) != complement) out[k++] = c->cur[u];
+    return k;
+}
+
+/**
+ * @brief Path of the candidate file of a probe worker.
+ */
+static void ddminPath(char* buf, size_t len, pid_t parent, pid_t worker) {
+    const char* dir = getenv("TMPDIR");
+    snprintf(buf, len, "%s/ddmin_%d_%d", dir && *dir ? dir : "/tmp", (int)parent, (int)worker);
+}
+
+/**
+ * @brief Probe worker: write the candidate, run the test and exit with its status.
+ */
+static void ddminProbe(DdminCtx* c, size_t i, size_t n, bool complement) {
+    char path[512];
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+    }
+    size_t k = ddminCandidate(c, i, n, complement, c->next);
+    ddminPath(path, sizeof(path), getppid(), getpid());
+    if (!ddminWrite(c, path, c->next, k)) _exit(DDMIN_EXIT_NO_INPUT);
+    if (ddmin_config.timeout) alarm(ddmin_config.timeout);
+    test_quiet = true;
+    test_failed = false;
+    case_failed = false;
+    c->fn(path);
+    _exit(test_failed || case_failed ? 1 : 0); // case_failed: assertions outside a completed case
+}
+
+/**
+ * @brief Wait for one of the running probe workers, never reaping other children.
+ *
+ * @return The index in pids of the worker that exited, or -1 on error.
+ */
+static long ddminWait(const pid_t* pids, size_t running, int* status) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    // block until some child is waitable without reaping it; reap it if it is a worker
+    while (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) != 0)
+        if (errno != EINTR) return -1;
+    for (size_t r = 0; r < running; r++)
+        if (pids[r] == info.si_pid && waitpid(pids[r], status, 0) == pids[r]) return (long)r;
+    // another child of the process is waitable: poll the workers instead
+    struct timespec poll = { 0, 1000 * 1000 };
+    for (;;) {
+        for (size_t r = 0; r < running; r++) {
+            pid_t done = waitpid(pids[r], status, WNOHANG);
+            if (done == pids[r]) return (long)r;
+            if (done < 0 && errno != EINTR) return -1;
+        }
+        nanosleep(&poll, NULL);
+    }
+}
+
+/**
+ * @brief Kill and reap probe workers that are no longer needed, removing their candidates.
+ */
+static void ddminKill(const pid_t* pids, size_t running) {
+    char path[512];
+    for (size_t k = 0; k < running; k++) {
+        kill(pids[k], SIGKILL);
+        waitpid(pids[k], NULL, 0);
+        ddminPath(path, sizeof(path), getpid(), pids[k]);
+        unlink(path);
+    }
+}
+
+/**
+ * @brief Run the probes of one ddmin round in parallel.
+ *
+ * @param c The minimizer state.
+ * @param n The number of chunks.
+ * @param complement Probe complements instead of chunks.
+ * @return The first failing candidate, -1 if all passed, TEST_DDMIN_ERROR if no probe could run.
+ */
+static long ddminRound(DdminCtx* c, size_t n, bool complement) {
+    pid_t pids[TEST_DDMIN_MAX_JOBS];
+    size_t which[TEST_DDMIN_MAX_JOBS];
+    uint16_t jobs = ddmin_config.jobs;
+    if (!jobs) jobs = (uint16_t)sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1) jobs = 1;
+    if (jobs > TEST_DDMIN_MAX_JOBS) jobs = TEST_DDMIN_MAX_JOBS;
+
+    long best = -1;
+    size_t launched = 0, running = 0;
+    fflush(NULL);
+    while (running || (launched < n && (best < 0 || launched < (size_t)best))) {
+        while (running < jobs && launched < n && (best < 0 || launched < (size_t)best)) {
+            pid_t pid = fork();
+            if (pid == 0) ddminProbe(c, launched, n, complement);
+            if (pid < 0) break;
+            c->probes++;
+            pids[running] = pid;
+            which[running++] = launched++;
+        }
+        if (!running) { // fork failed with nothing to wait for
+            if (best >= 0) return best;
+            printIndent();
+            LOG_ERROR("DDMIN: cannot fork a probe worker\n");
+            return TEST_DDMIN_ERROR;
+        }
+        int status;
+        long r = ddminWait(pids, running, &status);
+        if (r < 0) {
+            printIndent();
+            LOG_ERROR("DDMIN: cannot wait for the probe workers (%s)\n", strerror(errno));
+            ddminKill(pids, running);
+            return TEST_DDMIN_ERROR;
+        }
+        char path[512];
+        ddminPath(path, sizeof(path), getpid(), pids[r]);
+        unlink(path);
+        if (WIFEXITED(status) && WEXITSTATUS(status) == DDMIN_EXIT_NO_INPUT) { // not a verdict on the candidate
+            printIndent();
+            LOG_ERROR("DDMIN: a probe cannot write its candidate to %s\n", path);
+            pids[r] = pids[--running];
+            ddminKill(pids, running);
+            return TEST_DDMIN_ERROR;
+        }
+        bool failed = (WIFEXITED(status) && WEXITSTATUS(status) == 1) ||
+                      (WIFSIGNALED(status) && WTERMSIG(status) != SIGALRM && WTERMSIG(status) != SIGKILL);
+        if (failed && (best < 0 || which[r] < (size_t)best)) {
+            best = (long)which[r];
+            for (size_t k = 0; k < running; k++)
+                if (which[k] > (size_t)best) kill(pids[k], SIGKILL); // no longer needed
+        }
+        pids[r] = pids[--running];
+        which[r] = which[running];
+    }
+    return best;
+}
+
+/**
+ * @brief Minimize a failing input file of a test function.
+ *
+ * @param fn The test function, `void fn(const char* path)`.
+ * @param input The failing input file.
+ * @param output The file the minimized input is written to.
+ * @return true if the input failed and a 1-minimal input was written.
+ */
+bool ddminRun(DdminTest fn, const char* input, const char* output) {
+    DdminCtx c = { 0 };
+    c.fn = fn;
+    bool ok = false;
+    char* data = NULL;
+    uint64_t t0 = testClockNs();
+
+    FILE* f = fopen(input, "rb");
+    long size = -1;
+    if (f && fseek(f, 0, SEEK_END) == 0) size = ftell(f);
+    if (size >= 0 && fseek(f, 0, SEEK_SET) == 0) data = (char*)malloc((size_t)size + 1);
+    if (data && fread(data, 1, (size_t)size, f) != (size_t)size) size = -1;
+    if (f) fclose(f);
+    if (!data || size < 0) {
+        printIndent();
+        LOG_ERROR("DDMIN: cannot read %s\n", input);
+        failTest();
+        free(data);
+        return false;
+    }
+    c.data = data;
+    size_t units = ddminSplit(&c, (size_t)size) + 1; // count first, arrays are per unit
+    c.start = (size_t*)malloc(units * sizeof(size_t));
+    c.len = (size_t*)malloc(units * sizeof(size_t));
+    c.cur = (size_t*)malloc(units * sizeof(size_t));
+    c.next = (size_t*)malloc(units * sizeof(size_t));
+    if (!c.start || !c.len || !c.cur || !c.next) {
+        printIndent();
+        LOG_ERROR("DDMIN: out of memory\n");
+        failTest();
+        goto done;
+    }
+    c.cur_n = ddminSplit(&c, (size_t)size);
+    for (size_t i = 0; i < c.cur_n; i++) c.cur[i] = i;
+    size_t original = c.cur_n;
+
+    long first = ddminRound(&c, 1, false);
+    if (first == TEST_DDMIN_ERROR) {
+        failTest();
+        goto done;
+    }
+    if (first != 0) {
+        printIndent();
+        LOG_WARN("DDMIN: %s does not fail, nothing to minimize\n", input);
+        goto done;
+    }
+    size_t n = 2;
+    while (c.cur_n >= 2) {
+        bool complement = false;
+        long hit = ddminRound(&c, n, false);
+        if (hit == -1 && n > 2) {
+            complement = true;
+            hit = ddminRound(&c, n, true);
+        }
+        if (hit == TEST_DDMIN_ERROR) {
+            printIndent();
+            LOG_ERROR("DDMIN: stopping at %zu units\n", c.cur_n);
+            failTest();
+            break;
+        }
+        if (hit >= 0) {
+            c.cur_n = ddminCandidate(&c, (size_t)hit, n, complement, c.next);
+            memcpy(c.cur, c.next, c.cur_n * sizeof(size_t));
+            n = complement && n > 3 ? n - 1 : 2;
+            ddminWrite(&c, output, c.cur, c.cur_n);
+            printIndent();
+            MSG(CYAN, "%zu units after %llu probes\n", c.cur_n, (unsigned long long)c.probes);
+            continue;
+        }
+        if (n >= c.cur_n) break;
+        n = n * 2 < c.cur_n ? n * 2 : c.cur_n;
+    }
+    ok = ddminWrite(&c, output, c.cur, c.cur_n);
+    if (!ok) {
+        printIndent();
+        LOG_ERROR("DDMIN: cannot write %s\n", output);
+        failTest();
+    }
+    char took[16];
+    printIndent();
+    MSG(GREEN, "minimized %zu -> %zu units in %llu probes (%s), written to %s\n", original, c.cur_n,
+        (unsigned long long)c.probes, testFormatNs(took, sizeof(took), (double)(testClockNs() - t0)), output);
+
+done:
+    free(data);
+    free(c.start);
+    free(c.len);
+    free(c.cur);
+    free(c.next);
+    return ok;
+}
@@ -0,0 +1,349 @@
+#pragma once
+/**
+ * @file test_utils_diff.h
+ *
+ * @brief Text equality assertions that print a line diff on failure.
+ *
+ * @details
+ * This header provides the following assertions:
+ *
+ * - ASSERT_EQUAL_TEXT: Assert that two NUL terminated texts are equal.
+ * - ASSERT_EQUAL_TEXT_N: Assert that two texts of given length are equal.
+ *
+ * Equal texts cost a single memcmp. On a mismatch the texts are split into
+ * lines and hashed, the common prefix and suffix are trimmed by hash, and the
+ * remainder is diffed with Myers' O(ND) algorithm using the linear-space
+ * (middle snake) refinement. A unified diff with TEST_DIFF_CONTEXT lines of
+ * context is printed below the LOG_ERROR line, bounded to TEST_DIFF_MAX_LINES
+ * lines. Regions whose edit distance exceeds TEST_DIFF_MAX_COST are split
+ * heuristically, so very different inputs still finish quickly (the diff is
+ * then valid but not necessarily minimal).
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+#include <limits.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_DIFF_CONTEXT
+#define TEST_DIFF_CONTEXT 3 // unchanged lines around each change
+#endif
+
+#ifndef TEST_DIFF_MAX_LINES
+#define TEST_DIFF_MAX_LINES 200 // printed diff lines per assertion
+#endif
+
+#ifndef TEST_DIFF_MAX_WIDTH
+#define TEST_DIFF_MAX_WIDTH 160 // printed characters per diff line
+#endif
+
+#ifndef TEST_DIFF_MAX_COST
+#define TEST_DIFF_MAX_COST 4096 // edit distance searched before splitting heuristically
+#endif
+
+/* -- Assertions ----------------------------------------------------------*/
+
+/**
+ * @brief Assert that two texts of given length are equal, printing a diff otherwise
+ *
+ * @param a The expected text
+ * @param a_len The length of a in bytes
+ * @param b The actual text
+ * @param b_len The length of b in bytes
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_EQUAL_TEXT_N(a, a_len, b, b_len, msg, ...)                       \
+    do {                                                                        \
+        const char* _ta = (a);                                                  \
+        const char* _tb = (b);                                                  \
+        size_t _tal = (a_len), _tbl = (b_len);                                  \
+        if (_tal != _tbl || memcmp(_ta, _tb, _tal) != 0) {                      \
+            failCase();                                                         \
+            printIndent();                                                      \
+            LOG_ERROR("ASSERT_EQUAL_TEXT: %s != %s :: " msg "\n",               \
+                      #a, #b, ##__VA_ARGS__);                                   \
+            diffPrint(_ta, _tal, _tb, _tbl);                                    \
+        }                                                                       \
+    } while (0)
+
+/**
+ * @brief Assert that two NUL terminated texts are equal, printing a diff otherwise
+ *
+ * @param a The expected text
+ * @param b The actual text
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_EQUAL_TEXT(a, b, msg, ...)                                       \
+    ASSERT_EQUAL_TEXT_N(a, strlen(a), b, strlen(b), msg, ##__VA_ARGS__)
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief A line of text, including its newline if it has one.
+ */
+typedef struct {
+    const char* ptr;
+    size_t len;
+    uint64_t hash;
+} DiffLine;
+
+/**
+ * @brief State of a diff computation.
+ */
+typedef struct {
+    DiffLine* a;
+    DiffLine* b;
+    long* fd;       // furthest forward x per diagonal
+    long* bd;       // furthest backward x per diagonal
+    long offset;    // added to a diagonal to index fd/bd
+    uint8_t* del;   // lines of a that are deleted
+    uint8_t* ins;   // lines of b that are inserted
+} DiffCtx;
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Split a text into hashed lines.
+ *
+ * @param text The text.
+ * @param len The length of the text.
+ * @param count Receives the number of lines.
+ * @return The lines (malloc'd), or NULL on allocation failure.
+ */
+static DiffLine* diffLines(const char* text, size_t len, long* count) {
+    long n = 0;
+    for (size_t i = 0; i < len; i++) n += text[i] == '\n';
+    if (len && text[len - 1] != '\n') n++;
+    DiffLine* lines = (DiffLine*)malloc((size_t)(n ? n : 1) * sizeof(DiffLine));
+    if (!lines) return NULL;
+    n = 0;
+    for (size_t start = 0; start < len; n++) {
+        const char* nl = (const char*)memchr(text + start, '\n', len - start);
+        size_t end = nl ? (size_t)(nl - text) + 1 : len;
+        uint64_t h = 0xcbf29ce484222325ull; // FNV-1a
+        for (size_t i = start; i < end; i++) h = (h ^ (uint8_t)text[i]) * 0x100000001b3ull;
+        lines[n].ptr = text + start;
+        lines[n].len = end - start;
+        lines[n].hash = h;
+        start = end;
+    }
+    *count = n;
+    return lines;
+}
+
+/**
+ * @brief Compare line x of a with line y of b.
+ */
+static inline bool diffEq(const DiffCtx* c, long x, long y) {
+    const DiffLine* a = &c->a[x];
+    const DiffLine* b = &c->b[y];
+    return a->hash == b->hash && a->len == b->len && memcmp(a->ptr, b->ptr, a->len) == 0;
+}
+
+/**
+ * @brief Find a split point on a shortest edit path (the middle snake).
+ *
+ * @param c The diff state.
+ * @param a0,a1 The half-open range of lines of a.
+ * @param b0,b1 The half-open range of lines of b.
+ * @param x,y Receive the split point.
+ */
+static void diffSplit(DiffCtx* c, long a0, long a1, long b0, long b1, long* x, long* y) {
+    long* fd = c->fd + c->offset;
+    long* bd = c->bd + c->offset;
+    const long dmin = a0 - b1, dmax = a1 - b0;
+    const long fmid = a0 - b0, bmid = a1 - b1;
+    long fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    const bool odd = (fmid - bmid) & 1;
+    fd[fmid] = a0;
+    bd[bmid] = a1;
+
+    for (long cost = 1;; cost++) {
+        // extend the forward search by one edit
+        if (fmin > dmin) fd[--fmin - 1] = -1;
+        else ++fmin;
+        if (fmax < dmax) fd[++fmax + 1] = -1;
+        else --fmax;
+        for (long d = fmax; d >= fmin; d -= 2) {
+            long lo = fd[d - 1], hi = fd[d + 1];
+            long px = lo >= hi ? lo + 1 : hi, py = px - d;
+            while (px < a1 && py < b1 && diffEq(c, px, py)) px++, py++;
+            fd[d] = px;
+            if (odd && bmin <= d && d <= bmax && bd[d] <= px) {
+                *x = px;
+                *y = py;
+                return;
+            }
+        }
+        // extend the backward search by one edit
+        if (bmin > dmin) bd[--bmin - 1] = LONG_MAX;
+        else ++bmin;
+        if (bmax < dmax) bd[++bmax + 1] = LONG_MAX;
+        else --bmax;
+        for (long d = bmax; d >= bmin; d -= 2) {
+            long lo = bd[d - 1], hi = bd[d + 1];
+            long px = lo < hi ? lo : hi - 1, py = px - d;
+            while (px > a0 && py > b0 && diffEq(c, px - 1, py - 1)) px--, py--;
+            bd[d] = px;
+            if (!odd && fmin <= d && d <= fmax && px <= fd[d]) {
+                *x = px;
+                *y = py;
+                return;
+            }
+        }
+        if (cost >= TEST_DIFF_MAX_COST) {
+            // too expensive: split at the furthest forward point reached
+            long best = -1;
+            *x = a1;
+            *y = b0;
+            for (long d = fmax; d >= fmin; d -= 2) {
+                long px = fd[d] < a1 ? fd[d] : a1, py = px - d;
+                if (py > b1) {
+                    px = b1 + d;
+                    py = b1;
+                }
+                if (px + py > best) {
+                    best = px + py;
+                    *x = px;
+                    *y = py;
+                }
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Diff a range of lines, marking deletions and insertions.
+ */
+static void diffRange(DiffCtx* c, long a0, long a1, long b0, long b1) {
+    while (a0 < a1 && b0 < b1 && diffEq(c, a0, b0)) a0++, b0++;
+    while (a0 < a1 && b0 < b1 && diffEq(c, a1 - 1, b1 - 1)) a1--, b1--;
+    if (a0 == a1) {
+        memset(c->ins + b0, 1, (size_t)(b1 - b0));
+    } else if (b0 == b1) {
+        memset(c->del + a0, 1, (size_t)(a1 - a0));
+    } else {
+        long x = a1, y = b0;
+        diffSplit(c, a0, a1, b0, b1, &x, &y);
+        diffRange(c, a0, x, b0, y);
+        diffRange(c, x, a1, y, b1);
+    }
+}
+
+/**
+ * @brief Print a single diff line.
+ *
+ * @return The number of output lines used.
+ */
+static int diffPrintLine(char tag, const DiffLine* l) {
+    int len = (int)(l->len && l->ptr[l->len - 1] == '\n' ? l->len - 1 : l->len);
+    const char* more = len > TEST_DIFF_MAX_WIDTH ? "..." : "";
+    if (len > TEST_DIFF_MAX_WIDTH) len = TEST_DIFF_MAX_WIDTH;
+    printIndent();
+    if (tag == '-') MSG(RED, "-%.*s%s\n", len, l->ptr, more);
+    else if (tag == '+') MSG(GREEN, "+%.*s%s\n", len, l->ptr, more);
+    else MSG(RESET, " %.*s%s\n", len, l->ptr, more);
+    if (l->len && l->ptr[l->len - 1] == '\n') return 1;
+    printIndent();
+    MSG(RESET, "\\ No newline at end of text\n");
+    return 2;
+}
+
+/**
+ * @brief Print a bounded unified diff of two texts.
+ *
+ * @param a The expected text.
+ * @param a_len The length of a in bytes.
+ * @param b The actual text.
+ * @param b_len The length of b in bytes.
+ */
+void diffPrint(const char* a, size_t a_len, const char* b, size_t b_len) {
+    DiffCtx c = { 0 };
+    long na = 0, nb = 0;
+    c.a = diffLines(a, a_len, &na);
+    c.b = diffLines(b, b_len, &nb);
+    c.offset = nb + 1;
+    c.fd = (long*)malloc((size_t)(na + nb + 3) * sizeof(long));
+    c.bd = (long*)malloc((size_t)(na + nb + 3) * sizeof(long));
+    c.del = (uint8_t*)calloc((size_t)na + 1, 1);
+    c.ins = (uint8_t*)calloc((size_t)nb + 1, 1);
+    if (!c.a || !c.b || !c.fd || !c.bd || !c.del || !c.ins) {
+        printIndent();
+        LOG_WARN("DIFF: out of memory\n");
+        goto done;
+    }
+    diffRange(&c, 0, na, 0, nb);
+
+    int printed = 0;
+    long changed = 0, hidden = 0;
+    for (long i = 0; i < na; i++) changed += c.del[i];
+    for (long j = 0; j < nb; j++) changed += c.ins[j];
+    for (long i = 0, j = 0; i < na || j < nb; ) {
+        if (i < na && j < nb && !c.del[i] && !c.ins[j]) {
+            i++, j++;
+            continue;
+        }
+        // a hunk: extend while the gap between changes is at most 2 * context
+        long hi = i, hj = j, ei = i, ej = j;
+        for (;;) {
+            while ((ei < na && c.del[ei]) || (ej < nb && c.ins[ej])) {
+                if (ei < na && c.del[ei]) ei++;
+                else ej++;
+            }
+            long gap = 0;
+            while (gap <= 2 * TEST_DIFF_CONTEXT && ei + gap < na && ej + gap < nb &&
+                   !c.del[ei + gap] && !c.ins[ej + gap]) gap++;
+            bool more = (ei + gap < na && c.del[ei + gap]) || (ej + gap < nb && c.ins[ej + gap]);
+            if (gap > 2 * TEST_DIFF_CONTEXT || !more) break;
+            ei += gap;
+            ej += gap;
+        }
+        long pre = hi < TEST_DIFF_CONTEXT ? hi : TEST_DIFF_CONTEXT;
+        long post = 0;
+        while (post < TEST_DIFF_CONTEXT && ei + post < na && ej + post < nb) post++;
+        if (printed >= TEST_DIFF_MAX_LINES) {
+            for (long k = hi; k < ei; k++) hidden += c.del[k];
+            for (long k = hj; k < ej; k++) hidden += c.ins[k];
+        } else {
+            // an empty side starts at the line before the hunk, as patch and git apply expect
+            long len_a = ei - hi + pre + post, len_b = ej - hj + pre + post;
+            printIndent();
+            MSG(CYAN, "@@ -%ld,%ld +%ld,%ld @@\n", hi - pre + (len_a > 0), len_a, hj - pre + (len_b > 0), len_b);
+            printed++;
+            for (long k = hi - pre; k < hi; k++) printed += diffPrintLine(' ', &c.a[k]);
+            for (long ki = hi, kj = hj; (ki < ei || kj < ej); ) {
+                if (printed >= TEST_DIFF_MAX_LINES) {
+                    for (; ki < ei; ki++) hidden += c.del[ki];
+                    for (; kj < ej; kj++) hidden += c.ins[kj];
+                    break;
+                }
+                if (ki < ei && c.del[ki]) printed += diffPrintLine('-', &c.a[ki++]);
+                else if (kj < ej && c.ins[kj]) printed += diffPrintLine('+', &c.b[kj++]);
+                else {
+                    printed += diffPrintLine(' ', &c.a[ki]);
+                    ki++, kj++;
+                }
+            }
+            for (long k = 0; k < post && printed < TEST_DIFF_MAX_LINES; k++) printed += diffPrintLine(' ', &c.a[ei + k]);
+        }
+        i = ei;
+        j = ej;
+    }
+    printIndent();
+    if (hidden) MSG(YELLOW, "... %ld of %ld changed lines not shown (%ld vs %ld lines)\n", hidden, changed, na, nb);
+    else MSG(CYAN, "%ld changed lines (%ld vs %ld lines)\n", changed, na, nb);
+
+done:
+    free(c.a);
+    free(c.b);
+    free(c.fd);
+    free(c.bd);
+    free(c.del);
+    free(c.ins);
+}
@@ -0,0 +1,308 @@
+#pragma once
+/**
+ * @file test_utils_history.h
+ *
+ * @brief Benchmark history store and change-point detection.
+ *
+ * @details
+ * Comparing a run with the previous one misses slow drifts, so every
+ * BENCH_EVAL result can be appended to a history file and analyzed as a
+ * series. Including this header and setting `TEST_BENCH_HISTORY` to a path
+ * records each result together with:
+ *
+ * - the commit ID from `TEST_BENCH_COMMIT` ("unknown" when unset),
+ * - a fingerprint of the machine (CPU model, CPU count, memory and host name),
+ * - the wall clock time of the run.
+ *
+ * The file is a 16-byte header followed by fixed-size binary records, so
+ * appending is a single write and concurrent test binaries can share one
+ * file. A series is the records of one benchmark on one machine, in append
+ * order.
+ *
+ * historyChangePoints() runs PELT over a series with a Gaussian mean-shift
+ * cost. The noise level is estimated from the median absolute successive
+ * difference, which a few shifts barely affect, so the penalty is in units of
+ * the series' own noise. The `test_history` tool applies it to the log of the
+ * medians and reports which run introduced each shift:
+ *
+ * @code
+ * TEST_BENCH_HISTORY=bench.hist TEST_BENCH_COMMIT=$(git rev-parse --short HEAD) ./benchmarks
+ * test_history -f bench.hist
+ * @endcode
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_bench.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#define TEST_HISTORY_MAGIC 0x3154534948484342ull // "BCHHIST1"
+#define TEST_HISTORY_NAME 64   // bytes of the benchmark name kept in a record
+#define TEST_HISTORY_COMMIT 40 // bytes of the commit ID kept in a record
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief The header of a history file.
+ */
+typedef struct {
+    uint64_t magic;
+    uint32_t record_size;   // sizeof(HistoryRecord) of the writer.
+    uint32_t reserved;
+} HistoryHeader;
+
+/**
+ * @brief One benchmark result in the history.
+ */
+typedef struct {
+    uint64_t time_ns;       // wall clock time of the run, ns since the epoch.
+    uint64_t machine;       // fingerprint of the machine that ran it.
+    double median;          // median ns/op.
+    double mean;            // mean ns/op.
+    double min;             // fastest sample in ns/op.
+    double ci95;            // half-width of the 95% confidence interval of the mean in ns/op.
+    uint32_t samples;
+    uint16_t processes;
+    uint16_t reserved;
+    char name[TEST_HISTORY_NAME];
+    char commit[TEST_HISTORY_COMMIT];
+} HistoryRecord;
+
+_Static_assert(sizeof(HistoryRecord) == 160, "history records are 160 bytes");
+
+/* -- Global Variables ----------------------------------------------------- */
+
+const char* history_path = NULL; // history file, overrides TEST_BENCH_HISTORY.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Hash bytes into a running 64-bit FNV-1a hash.
+ */
+static uint64_t historyHash(uint64_t h, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 0x100000001B3ull;
+    return h;
+}
+
+/**
+ * @brief Fingerprint the machine: CPU model, CPU count, memory and host name.
+ *
+ * @return A 64-bit fingerprint, stable across runs on the same machine.
+ */
+uint64_t historyMachine(void) {
+    static uint64_t machine = 0;
+    if (machine) return machine;
+    char line[256];
+    uint64_t h = 0xCBF29CE484222325ull;
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "model name", 10) == 0) {
+            h = historyHash(h, line, strlen(line));
+            break;
+        }
+    }
+    if (f) fclose(f);
+    f = fopen("/proc/meminfo", "r");
+    if (f && fgets(line, sizeof(line), f)) h = historyHash(h, line, strlen(line)); // MemTotal
+    if (f) fclose(f);
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    h = historyHash(h, &cpus, sizeof(cpus));
+    if (gethostname(line, sizeof(line)) == 0) h = historyHash(h, line, strnlen(line, sizeof(line)));
+    machine = h ? h : 1;
+    return machine;
+}
+
+/**
+ * @brief Append a benchmark result to a history file.
+ *
+ * @param path The history file, created if missing.
+ * @param r The result to append.
+ * @return true if the record was written.
+ */
+bool historyAppend(const char* path, const BenchResult* r) {
+    HistoryRecord rec;
+    struct timespec ts;
+    memset(&rec, 0, sizeof(rec));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec.time_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    rec.machine = historyMachine();
+    rec.median = r->median;
+    rec.mean = r->mean;
+    rec.min = r->min;
+    rec.ci95 = r->ci95;
+    rec.samples = r->samples;
+    rec.processes = r->processes;
+    const char* commit = getenv("TEST_BENCH_COMMIT");
+    snprintf(rec.name, sizeof(rec.name), "%s", r->name ? r->name : "");
+    snprintf(rec.commit, sizeof(rec.commit), "%s", commit && *commit ? commit : "unknown");
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    struct stat st;
+    bool ok = flock(fd, LOCK_EX) == 0 && fstat(fd, &st) == 0;
+    if (ok && st.st_size == 0) {
+        HistoryHeader hdr = { TEST_HISTORY_MAGIC, sizeof(HistoryRecord), 0 };
+        ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+    }
+    ok = ok && write(fd, &rec, sizeof(rec)) == sizeof(rec);
+    close(fd); // releases the lock
+    return ok;
+}
+
+/**
+ * @brief Record a BENCH_EVAL result in the history, installed as bench_record.
+ */
+void historyRecord(const BenchResult* r) {
+    const char* path = history_path ? history_path : getenv("TEST_BENCH_HISTORY");
+    if (!path || !*path) return;
+    if (!historyAppend(path, r)) {
+        printIndent();
+        LOG_WARN("HISTORY: cannot append to %s\n", path);
+    }
+}
+
+/**
+ * @brief Install historyRecord() as the benchmark result hook.
+ */
+__attribute__((constructor)) static void historyInit(void) {
+    if (!bench_record) bench_record = historyRecord;
+}
+
+/**
+ * @brief Load all records of a history file.
+ *
+ * @param path The history file.
+ * @param count Receives the number of records.
+ * @return The records, to be released with free(), or NULL if the file is missing or invalid.
+ */
+HistoryRecord* historyLoad(const char* path, uint32_t* count) {
+    HistoryHeader hdr;
+    *count = 0;
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TEST_HISTORY_MAGIC ||
+        hdr.record_size != sizeof(HistoryRecord)) {
+        fclose(f);
+        return NULL;
+    }
+    uint32_t cap = 256;
+    HistoryRecord* recs = (HistoryRecord*)malloc(cap * sizeof(HistoryRecord));
+    while (recs && fread(&recs[*count], sizeof(HistoryRecord), 1, f) == 1) {
+        recs[*count].name[TEST_HISTORY_NAME - 1] = '\0';
+        recs[*count].commit[TEST_HISTORY_COMMIT - 1] = '\0';
+        if (++*count == cap) {
+            HistoryRecord* grown = (HistoryRecord*)realloc(recs, 2 * cap * sizeof(HistoryRecord));
+            if (!grown) break;
+            recs = grown;
+            cap *= 2;
+        }
+    }
+    fclose(f);
+    return recs;
+}
+
+/**
+ * @brief Robust noise estimate: scaled median absolute successive difference.
+ */
+static double historyNoise(const double* y, uint32_t n) {
+    double* d = (double*)malloc((n ? n : 1) * sizeof(double));
+    if (!d || n < 2) {
+        free(d);
+        return 0;
+    }
+    for (uint32_t i = 0; i + 1 < n; i++) d[i] = fabs(y[i + 1] - y[i]);
+    // MAD of a difference of two N(0, s^2) is 0.6745 * sqrt(2) * s
+    double s = benchMedian(d, n - 1) / (0.6745 * M_SQRT2);
+    if (s <= 0) { // many identical neighbours: fall back to the RMS difference
+        double ss = 0;
+        for (uint32_t i = 0; i + 1 < n; i++) ss += (y[i + 1] - y[i]) * (y[i + 1] - y[i]);
+        s = sqrt(ss / (2.0 * (n - 1)));
+    }
+    free(d);
+    return s;
+}
+
+/**
+ * @brief Detect shifts of the mean of a series with PELT.
+ *
+ * Minimizes the sum of squared deviations from segment means, in units of the
+ * estimated noise, plus `penalty * ln(n)` per change point. Candidates that
+ * can no longer start the last segment of an optimal split are pruned, which
+ * makes the search close to linear in n.
+ *
+ * @param y The series.
+ * @param n The length of the series.
+ * @param penalty The cost of a change point as a multiple of ln(n), 2 is BIC-like.
+ * @param min_seg The minimum number of points in a segment.
+ * @param cps Receives the change points in increasing order: the index of
+ *            the first point after each shift. Must hold n / min_seg entries.
+ * @return The number of change points.
+ */
+uint32_t historyChangePoints(const double* y, uint32_t n, double penalty, uint32_t min_seg, uint32_t* cps) {
+    if (!min_seg) min_seg = 1;
+    if (n < 2 * min_seg) return 0;
+    double sigma = historyNoise(y, n);
+    if (sigma <= 0) return 0;
+    double beta = penalty * log((double)n);
+    double* s1 = (double*)malloc((n + 1) * sizeof(double));
+    double* s2 = (double*)malloc((n + 1) * sizeof(double));
+    double* f = (double*)malloc((n + 1) * sizeof(double));
+    uint32_t* last = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    uint32_t* cand = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    uint32_t found = 0;
+    if (!s1 || !s2 || !f || !last || !cand) goto done;
+
+    s1[0] = s2[0] = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        double v = y[i] / sigma;
+        s1[i + 1] = s1[i] + v;
+        s2[i + 1] = s2[i] + v * v;
+    }
+#define HISTORY_COST(s, t) (s2[t] - s2[s] - (s1[t] - s1[s]) * (s1[t] - s1[s]) / (double)((t) - (s)))
+    uint32_t ncand = 1;
+    cand[0] = 0;
+    f[0] = -beta;
+    last[0] = 0;
+    for (uint32_t t = min_seg; t <= n; t++) {
+        f[t] = INFINITY;
+        for (uint32_t c = 0; c < ncand; c++) {
+            uint32_t s = cand[c];
+            if (t - s < min_seg) continue;
+            double v = f[s] + HISTORY_COST(s, t) + beta;
+            if (v < f[t]) {
+                f[t] = v;
+                last[t] = s;
+            }
+        }
+        uint32_t kept = 0;
+        for (uint32_t c = 0; c < ncand; c++) {
+            uint32_t s = cand[c];
+            if (t - s < min_seg || f[s] + HISTORY_COST(s, t) <= f[t]) cand[kept++] = s;
+        }
+        ncand = kept;
+        if (t + min_seg <= n) cand[ncand++] = t;
+    }
+#undef HISTORY_COST
+    for (uint32_t t = n; last[t] > 0; t = last[t]) cps[found++] = last[t];
+    for (uint32_t i = 0; i < found / 2; i++) {
+        uint32_t tmp = cps[i];
+        cps[i] = cps[found - 1 - i];
+        cps[found - 1 - i] = tmp;
+    }
+done:
+    free(s1);
+    free(s2);
+    free(f);
+    free(last);
+    free(cand);
+    return found;
+}
@@ -0,0 +1,568 @@
+#pragma once
+/**
+ * @file test_utils_io.h
+ *
+ * @brief I/O benchmark helpers with page cache control and O_DIRECT paths.
+ *
+ * @details
+ * This header provides the following helpers:
+ *
+ * - ioCreateFile: Create a test file of a given size filled with zeros, random
+ *   bytes or a verifiable block pattern, synced to disk.
+ * - ioDropCache: Evict a file from the page cache with posix_fadvise(DONTNEED),
+ *   so the next read is cold.
+ * - ioAlloc: Allocate a buffer aligned for O_DIRECT.
+ * - ioRun: Measure throughput, IOPS and mean latency of one job: read or
+ *   write, sequential or random blocks, at a queue depth, buffered or
+ *   O_DIRECT, through pread/pwrite threads or io_uring.
+ *
+ * IO_SWEEP(path, op, pattern) runs a job at each of `io_config.depths` with
+ * every available engine and prints a table. With `io_config.cold` set the
+ * file is evicted before every run. Results stay available in `io_results`.
+ *
+ * The pread/pwrite engine reaches a queue depth of N with N threads each
+ * issuing one request at a time. The io_uring engine keeps N requests in
+ * flight from a single thread, using the raw system calls so liburing is not
+ * required. It is skipped when the kernel headers lack io_uring or the kernel
+ * refuses it (e.g. under seccomp).
+ *
+ * Sequential jobs make a single pass over the file. Random jobs run for
+ * `io_config.seconds`; without O_DIRECT they re-read blocks already pulled
+ * into the cache once the file is covered, so use O_DIRECT or a file larger
+ * than a run can touch for cold random reads. Write jobs include the final
+ * fdatasync in their time.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_bench.h"
+#include "test_utils_clock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define TEST_IO_URING 1
+#endif
+#endif
+#endif
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_IO_MAX_DEPTH
+#define TEST_IO_MAX_DEPTH 256 // queue depth limit
+#endif
+
+#ifndef TEST_IO_MAX_RESULTS
+#define TEST_IO_MAX_RESULTS 64 // results kept per sweep
+#endif
+
+#define TEST_IO_ALIGN 4096 // buffer and offset alignment for O_DIRECT
+
+/**
+ * @brief Measure a file at every configured queue depth and engine.
+ *
+ * @param path The test file, e.g. created by ioCreateFile().
+ * @param op IO_READ or IO_WRITE.
+ * @param pattern IO_SEQ or IO_RAND.
+ */
+#define IO_SWEEP(path, op, pattern)                                                 \
+    MSG(MAGENTA, "%s [io %s %s]:\n", path, ioOpName(op), ioPatternName(pattern));   \
+    depth++;                                                                        \
+    ioSweep(path, op, pattern);                                                     \
+    depth--;
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief The direction of an I/O job.
+ */
+typedef enum {
+    IO_READ,
+    IO_WRITE,
+} IoOp;
+
+/**
+ * @brief The order blocks are accessed in.
+ */
+typedef enum {
+    IO_SEQ,     // consecutive blocks, one pass over the file.
+    IO_RAND,    // uniformly random blocks for the configured duration.
+} IoPattern;
+
+/**
+ * @brief How a test file is filled.
+ */
+typedef enum {
+    IO_FILL_ZERO,       // all zero bytes.
+    IO_FILL_RANDOM,     // pseudo-random bytes from a seed (incompressible).
+    IO_FILL_PATTERN,    // each 8-byte word holds its own file offset.
+} IoFill;
+
+/**
+ * @brief The interface requests are issued through.
+ */
+typedef enum {
+    IO_ENGINE_PSYNC,    // pread/pwrite, one thread per queue slot.
+    IO_ENGINE_URING,    // io_uring from a single thread.
+} IoEngine;
+
+/**
+ * @brief I/O sweep configuration.
+ */
+typedef struct {
+    size_t block;           // request size in bytes, a multiple of TEST_IO_ALIGN for O_DIRECT.
+    double seconds;         // time limit of each run.
+    bool direct;            // open with O_DIRECT, falling back to buffered I/O if unsupported.
+    bool cold;              // evict the file from the page cache before each run.
+    uint16_t depths[8];     // queue depths to sweep, 0 terminated.
+    uint64_t seed;          // seed of random offsets.
+} IoConfig;
+
+/**
+ * @brief One I/O measurement.
+ */
+typedef struct {
+    IoOp op;
+    IoPattern pattern;
+    IoEngine engine;
+    uint16_t queue_depth;
+    size_t block;
+    bool direct;            // O_DIRECT was in effect.
+    uint64_t ops;           // completed requests.
+    double ns;              // wall time of the run.
+    double mb_s;            // throughput in MB/s (10^6 bytes).
+    double iops;            // requests per second.
+    double mean_lat_ns;     // mean request latency.
+} IoResult;
+
+/**
+ * @brief State of one pread/pwrite thread.
+ */
+typedef struct {
+    int fd;
+    IoOp op;
+    IoPattern pattern;
+    size_t block;
+    uint64_t blocks;        // blocks in the file.
+    uint64_t* next;         // shared cursor of a sequential job.
+    uint64_t deadline;
+    uint64_t seed;
+    char* buf;
+    uint64_t ops;
+    double lat_ns;
+    bool error;
+} IoWorker;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+IoConfig io_config = {
+    .block = 4096,
+    .seconds = 1.0,
+    .direct = false,
+    .cold = true,
+    .depths = { 1, 4, 16, 64 },
+    .seed = 1,
+};
+
+IoResult io_results[TEST_IO_MAX_RESULTS]; // results of the last sweep.
+uint16_t io_result_count = 0; // number of valid entries in io_results.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+static inline const char* ioOpName(IoOp op) { return op == IO_WRITE ? "write" : "read"; }
+static inline const char* ioPatternName(IoPattern p) { return p == IO_RAND ? "rand" : "seq"; }
+static inline const char* ioEngineName(IoEngine e) { return e == IO_ENGINE_URING ? "io_uring" : "psync"; }
+
+/**
+ * @brief Allocate a buffer aligned for O_DIRECT.
+ *
+ * @param size The size of the buffer in bytes.
+ * @return The buffer, to be released with free(), or NULL.
+ */
+void* ioAlloc(size_t size) {
+    void* buf = NULL;
+    if (posix_memalign(&buf, TEST_IO_ALIGN, size ? size : TEST_IO_ALIGN)) return NULL;
+    return buf;
+}
+
+/**
+ * @brief Evict a file from the page cache.
+ *
+ * Dirty pages are written back first, since DONTNEED skips them.
+ *
+ * @param path The file to evict.
+ * @return true if the advice was accepted.
+ */
+bool ioDropCache(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    fdatasync(fd);
+    bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return ok;
+}
+
+/**
+ * @brief Create a test file and sync it to disk.
+ *
+ * @param path The file to create (truncated if it exists).
+ * @param size The size of the file in bytes.
+ * @param fill How the file is filled.
+ * @param seed The seed of IO_FILL_RANDOM.
+ * @return true on success.
+ */
+bool ioCreateFile(const char* path, uint64_t size, IoFill fill, uint64_t seed) {
+    const size_t chunk = 1 << 20;
+    uint64_t* buf = (uint64_t*)ioAlloc(chunk);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = buf && fd >= 0;
+    if (buf) memset(buf, 0, chunk);
+    for (uint64_t off = 0; ok && off < size; off += chunk) {
+        size_t len = size - off < chunk ? (size_t)(size - off) : chunk;
+        if (fill == IO_FILL_RANDOM)
+            for (size_t i = 0; i < chunk / 8; i++) buf[i] = benchMix(&seed);
+        else if (fill == IO_FILL_PATTERN)
+            for (size_t i = 0; i < chunk / 8; i++) buf[i] = off + i * 8;
+        for (size_t done = 0; ok && done < len; ) {
+            ssize_t w = pwrite(fd, (char*)buf + done, len - done, (off_t)(off + done));
+            ok = w > 0;
+            done += ok ? (size_t)w : 0;
+        }
+    }
+    if (fd >= 0) {
+        ok = ok && fsync(fd) == 0;
+        close(fd);
+    }
+    free(buf);
+    return ok;
+}
+
+/**
+ * @brief Pick the block of the next request, or return false when a sequential pass is done.
+ */
+static inline bool ioNextBlock(IoPattern pattern, uint64_t* next, uint64_t blocks, uint64_t* seed, uint64_t* block) {
+    if (pattern == IO_RAND) {
+        *block = benchMix(seed) % blocks;
+        return true;
+    }
+    *block = __atomic_fetch_add(next, 1, __ATOMIC_RELAXED);
+    return *block < blocks;
+}
+
+/**
+ * @brief Issue requests one at a time until the job is done.
+ */
+static void* ioWorkerMain(void* p) {
+    IoWorker* w = (IoWorker*)p;
+    uint64_t block;
+    while (ioNextBlock(w->pattern, w->next, w->blocks, &w->seed, &block)) {
+        uint64_t t0 = testClockNs();
+        off_t off = (off_t)(block * w->block);
+        ssize_t r = w->op == IO_WRITE ? pwrite(w->fd, w->buf, w->block, off) : pread(w->fd, w->buf, w->block, off);
+        uint64_t t1 = testClockNs();
+        if (r != (ssize_t)w->block) {
+            w->error = true;
+            break;
+        }
+        w->ops++;
+        w->lat_ns += (double)(t1 - t0);
+        if (t1 >= w->deadline) break;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Run a job through pread/pwrite threads.
+ */
+static bool ioRunPsync(int fd, uint64_t blocks, IoResult* r) {
+    static IoWorker workers[TEST_IO_MAX_DEPTH];
+    pthread_t threads[TEST_IO_MAX_DEPTH];
+    uint64_t next = 0, deadline = testClockNs() + (uint64_t)(io_config.seconds * 1e9);
+    uint16_t started = 0;
+    bool ok = true;
+    for (uint16_t t = 0; t < r->queue_depth; t++) {
+        IoWorker* w = &workers[t];
+        memset(w, 0, sizeof(IoWorker));
+        w->fd = fd;
+        w->op = r->op;
+        w->pattern = r->pattern;
+        w->block = r->block;
+        w->blocks = blocks;
+        w->next = &next;
+        w->deadline = deadline;
+        w->seed = io_config.seed + t * 0x9E3779B97F4A7C15ull;
+        w->buf = (char*)ioAlloc(r->block);
+        if (!w->buf) break;
+        memset(w->buf, 0xA5, r->block);
+        if (pthread_create(&threads[t], NULL, ioWorkerMain, w) != 0) {
+            free(w->buf);
+            break;
+        }
+        started++;
+    }
+    ok = started == r->queue_depth;
+    for (uint16_t t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+        ok = ok && !workers[t].error;
+        r->ops += workers[t].ops;
+        r->mean_lat_ns += workers[t].lat_ns;
+        free(workers[t].buf);
+    }
+    return ok;
+}
+
+#ifdef TEST_IO_URING
+/**
+ * @brief A minimal io_uring instance mapped without liburing.
+ */
+typedef struct {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_len, cq_len, sqes_len;
+} IoRing;
+
+/**
+ * @brief Set up an io_uring instance with room for entries requests.
+ */
+static bool ioRingInit(IoRing* ring, unsigned entries) {
+    struct io_uring_params p;
+    memset(ring, 0, sizeof(IoRing));
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) return false;
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->sq_len = ring->cq_len = ring->sq_len > ring->cq_len ? ring->sq_len : ring->cq_len;
+    ring->sq_ring = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    ring->cq_ring = (p.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq_ring
+                  : mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                            ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_len);
+        if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_len);
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_len);
+        close(ring->fd);
+        return false;
+    }
+    char* sq = (char*)ring->sq_ring;
+    char* cq = (char*)ring->cq_ring;
+    ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+/**
+ * @brief Tear down an io_uring instance.
+ */
+static void ioRingFree(IoRing* ring) {
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_len);
+    munmap(ring->sq_ring, ring->sq_len);
+    close(ring->fd);
+}
+
+/**
+ * @brief Queue one read or write; the slot travels in user_data.
+ */
+static void ioRingPrep(IoRing* ring, IoOp op, int fd, void* buf, size_t len, uint64_t off, unsigned slot) {
+    unsigned tail = *ring->sq_tail;
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op == IO_WRITE ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->off = off;
+    sqe->user_data = slot;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Run a job through io_uring, keeping queue_depth requests in flight.
+ */
+static bool ioRunUring(int fd, uint64_t blocks, IoResult* r) {
+    static char* bufs[TEST_IO_MAX_DEPTH];
+    static uint64_t issued[TEST_IO_MAX_DEPTH];
+    IoRing ring;
+    if (!ioRingInit(&ring, r->queue_depth)) return false;
+    uint64_t next = 0, seed = io_config.seed, block;
+    uint64_t deadline = testClockNs() + (uint64_t)(io_config.seconds * 1e9);
+    unsigned inflight = 0, pending = 0, slots = 0;
+    bool ok = true, more = true;
+    for (; slots < r->queue_depth; slots++) {
+        bufs[slots] = (char*)ioAlloc(r->block);
+        if (!bufs[slots]) break;
+        memset(bufs[slots], 0xA5, r->block);
+    }
+    ok = slots == r->queue_depth;
+    for (unsigned s = 0; ok && s < slots && (more = ioNextBlock(r->pattern, &next, blocks, &seed, &block)); s++) {
+        ioRingPrep(&ring, r->op, fd, bufs[s], r->block, block * r->block, s);
+        issued[s] = testClockNs();
+        pending++;
+    }
+    // after a failure nothing more is submitted, but the requests in flight are
+    // still reaped: the kernel writes into bufs and the ring until they complete
+    while (inflight || (ok && pending)) {
+        int got = (int)syscall(__NR_io_uring_enter, ring.fd, ok ? pending : 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (got < 0 && errno != EINTR) {
+            ok = false;
+            break;
+        }
+        if (got > 0) {
+            inflight += (unsigned)got;
+            pending -= (unsigned)got;
+        }
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+            unsigned s = (unsigned)cqe->user_data;
+            uint64_t now = testClockNs();
+            head++;
+            inflight--;
+            if (cqe->res != (int32_t)r->block) {
+                ok = false;
+                continue;
+            }
+            r->ops++;
+            r->mean_lat_ns += (double)(now - issued[s]);
+            if (ok && more && now < deadline && (more = ioNextBlock(r->pattern, &next, blocks, &seed, &block))) {
+                ioRingPrep(&ring, r->op, fd, bufs[s], r->block, block * r->block, s);
+                issued[s] = now;
+                pending++;
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    if (!inflight) // otherwise the ring cannot be waited on; leak the buffers rather than free them under the kernel
+        for (unsigned s = 0; s < slots; s++) free(bufs[s]);
+    ioRingFree(&ring);
+    return ok;
+}
+#endif
+
+/**
+ * @brief Measure one job on a file.
+ *
+ * @param path The test file.
+ * @param op IO_READ or IO_WRITE.
+ * @param pattern IO_SEQ or IO_RAND.
+ * @param engine The interface to issue requests through.
+ * @param queue_depth Requests in flight.
+ * @param result Receives the measurement.
+ * @return true if every request completed in full.
+ */
+bool ioRun(const char* path, IoOp op, IoPattern pattern, IoEngine engine, uint16_t queue_depth, IoResult* result) {
+    memset(result, 0, sizeof(IoResult));
+    result->op = op;
+    result->pattern = pattern;
+    result->engine = engine;
+    result->block = io_config.block;
+    result->queue_depth = queue_depth < 1 ? 1 : queue_depth > TEST_IO_MAX_DEPTH ? TEST_IO_MAX_DEPTH : queue_depth;
+#ifndef TEST_IO_URING
+    if (engine == IO_ENGINE_URING) return false;
+#endif
+    if (io_config.cold) ioDropCache(path);
+
+    int flags = op == IO_WRITE ? O_WRONLY : O_RDONLY;
+    int fd = io_config.direct ? open(path, flags | O_DIRECT) : -1;
+    result->direct = fd >= 0;
+    if (fd < 0) fd = open(path, flags);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (uint64_t)st.st_size < result->block) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    uint64_t blocks = (uint64_t)st.st_size / result->block;
+
+    uint64_t t0 = testClockNs();
+    bool ok;
+#ifdef TEST_IO_URING
+    if (engine == IO_ENGINE_URING)
+        ok = ioRunUring(fd, blocks, result);
+    else
+#endif
+        ok = ioRunPsync(fd, blocks, result);
+    if (op == IO_WRITE) ok = fdatasync(fd) == 0 && ok;
+    result->ns = (double)(testClockNs() - t0);
+    close(fd);
+
+    if (result->ops) result->mean_lat_ns /= (double)result->ops;
+    if (result->ns > 0) {
+        result->iops = (double)result->ops * 1e9 / result->ns;
+        result->mb_s = result->iops * (double)result->block / 1e6;
+    }
+    return ok;
+}
+
+/**
+ * @brief Measure a file at every configured queue depth with every available engine and print a table.
+ *
+ * @param path The test file.
+ * @param op IO_READ or IO_WRITE.
+ * @param pattern IO_SEQ or IO_RAND.
+ */
+void ioSweep(const char* path, IoOp op, IoPattern pattern) {
+    bool uring = true;
+    io_result_count = 0;
+    if (io_config.direct) {
+        int fd = open(path, O_RDONLY | O_DIRECT);
+        if (fd < 0) {
+            printIndent();
+            LOG_WARN("IO: O_DIRECT not supported for %s, using buffered I/O\n", path);
+        } else {
+            close(fd);
+        }
+    }
+    for (uint16_t d = 0; d < 8 && io_config.depths[d]; d++) {
+        for (int e = IO_ENGINE_PSYNC; e <= IO_ENGINE_URING && io_result_count < TEST_IO_MAX_RESULTS; e++) {
+            if (e == IO_ENGINE_URING && !uring) continue;
+            IoResult* r = &io_results[io_result_count];
+            bool ok = ioRun(path, op, pattern, (IoEngine)e, io_config.depths[d], r);
+            if (!ok && e == IO_ENGINE_URING && !r->ops) {
+                uring = false;
+                printIndent();
+                MSG(YELLOW, "io_uring unavailable, skipping\n");
+                continue;
+            }
+            io_result_count++;
+            char lat[16];
+            printIndent();
+            if (!ok) {
+                LOG_ERROR("IO: %s %s failed at queue depth %u (%s)\n", ioOpName(op), ioEngineName(r->engine),
+                          r->queue_depth, strerror(errno));
+                failCase();
+                continue;
+            }
+            MSG(CYAN, "qd %3u %-8s %9.1f MB/s %10.0f IOPS %9s mean latency%s\n", r->queue_depth,
+                ioEngineName(r->engine), r->mb_s, r->iops, testFormatNs(lat, sizeof(lat), r->mean_lat_ns),
+                r->direct ? " (O_DIRECT)" : "");
+        }
+    }
+}
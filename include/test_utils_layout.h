@@ -0,0 +1,247 @@
+#pragma once
+/**
+ * @file test_utils_layout.h
+ *
+ * @brief Compile-time layout assertions and a pahole-style layout report.
+ *
+ * @details
+ * The following compile-time assertions are provided. They expand to
+ * `_Static_assert` and may be used at file or block scope:
+ *
+ * - ASSERT_SIZEOF: Assert the size of a type.
+ * - ASSERT_OFFSETOF: Assert the offset of a field within a type.
+ * - ASSERT_ALIGNED_TO: Assert that the alignment of a type is a multiple of n.
+ * - ASSERT_FITS_CACHE_LINES: Assert that a type fits in n cache lines.
+ *
+ * Additionally, layout descriptors can be registered with LAYOUT_REGISTER and
+ * printed with @ref layoutReport "layoutReport()" or
+ * @ref layoutReportAll "layoutReportAll()":
+ *
+ * @code
+ * LAYOUT_REGISTER(TestStruct,
+ *     LAYOUT_FIELD(TestStruct, flag),
+ *     LAYOUT_FIELD(TestStruct, data),
+ *     LAYOUT_FIELD(TestStruct, ptr));
+ * @endcode
+ *
+ * which reports the offset and size of each field, the padding holes between
+ * them, trailing padding and the cache lines the type spans. Bit-fields cannot
+ * be described.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+#include <stddef.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_CACHE_LINE
+#define TEST_CACHE_LINE 64 // cache line size in bytes
+#endif
+
+#ifndef TEST_MAX_LAYOUTS
+#define TEST_MAX_LAYOUTS 64 // registered layout descriptors
+#endif
+
+/* -- Assertions ----------------------------------------------------------*/
+
+/**
+ * @brief Assert at compile time that `sizeof(type) == size`
+ *
+ * @param type The type to check
+ * @param size The expected size in bytes
+ */
+#define ASSERT_SIZEOF(type, size)                                           \
+    _Static_assert(sizeof(type) == (size),                                  \
+        "ASSERT_SIZEOF: sizeof(" #type ") != " #size)
+
+/**
+ * @brief Assert at compile time that `offsetof(type, field) == offset`
+ *
+ * @param type The type to check
+ * @param field The field within the type
+ * @param offset The expected offset in bytes
+ */
+#define ASSERT_OFFSETOF(type, field, offset)                                \
+    _Static_assert(offsetof(type, field) == (offset),                       \
+        "ASSERT_OFFSETOF: offsetof(" #type ", " #field ") != " #offset)
+
+/**
+ * @brief Assert at compile time that the alignment of a type is a multiple of n
+ *
+ * @param type The type to check
+ * @param n The required alignment in bytes
+ */
+#define ASSERT_ALIGNED_TO(type, n)                                          \
+    _Static_assert(_Alignof(type) % (n) == 0,                               \
+        "ASSERT_ALIGNED_TO: _Alignof(" #type ") is not a multiple of " #n)
+
+/**
+ * @brief Assert at compile time that a type fits in n cache lines
+ *
+ * @param type The type to check
+ * @param n The number of TEST_CACHE_LINE sized lines
+ */
+#define ASSERT_FITS_CACHE_LINES(type, n)                                    \
+    _Static_assert(sizeof(type) <= (n) * TEST_CACHE_LINE,                   \
+        "ASSERT_FITS_CACHE_LINES: sizeof(" #type ") exceeds " #n " cache lines")
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief A single field of a layout descriptor.
+ */
+typedef struct {
+    const char* name;
+    size_t offset;
+    size_t size;
+} LayoutField;
+
+/**
+ * @brief Describes the memory layout of a struct.
+ */
+typedef struct {
+    const char* name;
+    size_t size;
+    size_t align;
+    const LayoutField* fields;
+    size_t count;
+} LayoutDesc;
+
+/**
+ * @brief Describe a field for LAYOUT_DESCRIBE / LAYOUT_REGISTER.
+ *
+ * @param type The enclosing type
+ * @param field The field name
+ */
+#define LAYOUT_FIELD(type, field)   \
+    { #field, offsetof(type, field), sizeof(((type*)0)->field) }
+
+/**
+ * @brief Define a layout descriptor `layout_<type>` without registering it.
+ *
+ * @param type The type to describe (a single identifier, e.g. a typedef name)
+ * @param ... The LAYOUT_FIELD entries of the type
+ */
+#define LAYOUT_DESCRIBE(type, ...)                                          \
+    static const LayoutField layout_fields_##type[] = { __VA_ARGS__ };      \
+    const LayoutDesc layout_##type = {                                      \
+        #type, sizeof(type), _Alignof(type), layout_fields_##type,          \
+        sizeof(layout_fields_##type) / sizeof(LayoutField)                  \
+    }
+
+/**
+ * @brief Define a layout descriptor `layout_<type>` and register it for layoutReportAll().
+ *
+ * @param type The type to describe (a single identifier, e.g. a typedef name)
+ * @param ... The LAYOUT_FIELD entries of the type
+ */
+#define LAYOUT_REGISTER(type, ...)                                          \
+    LAYOUT_DESCRIBE(type, __VA_ARGS__);                                     \
+    __attribute__((constructor)) static void layoutRegister_##type(void) {  \
+        layoutRegister(&layout_##type);                                     \
+    }                                                                       \
+    _Static_assert(1, "")
+
+/* -- Global Variables ----------------------------------------------------- */
+
+const LayoutDesc* layouts[TEST_MAX_LAYOUTS]; // registered layout descriptors.
+uint16_t layout_count = 0; // number of registered layout descriptors.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Register a layout descriptor for layoutReportAll().
+ *
+ * @param desc The descriptor, which must outlive the test run.
+ * @return true if registered, false if the table is full.
+ */
+bool layoutRegister(const LayoutDesc* desc) {
+    if (layout_count >= TEST_MAX_LAYOUTS) return false;
+    layouts[layout_count++] = desc;
+    return true;
+}
+
+/**
+ * @brief Copy the fields of a descriptor sorted by offset.
+ *
+ * @return The number of fields copied (at most max).
+ */
+static size_t layoutSorted(const LayoutDesc* desc, LayoutField* out, size_t max) {
+    size_t n = desc->count < max ? desc->count : max;
+    for (size_t i = 0; i < n; i++) {
+        size_t j = i;
+        for (; j > 0 && out[j - 1].offset > desc->fields[i].offset; j--) out[j] = out[j - 1];
+        out[j] = desc->fields[i];
+    }
+    return n;
+}
+
+/**
+ * @brief Count the padding bytes of a layout (holes plus trailing padding).
+ *
+ * Fields that are not described are counted as padding.
+ *
+ * @param desc The layout descriptor.
+ * @return The number of bytes not covered by any field.
+ */
+size_t layoutPadding(const LayoutDesc* desc) {
+    LayoutField fields[256];
+    size_t n = layoutSorted(desc, fields, 256);
+    size_t end = 0, pad = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (fields[i].offset > end) pad += fields[i].offset - end;
+        if (fields[i].offset + fields[i].size > end) end = fields[i].offset + fields[i].size;
+    }
+    return pad + (desc->size > end ? desc->size - end : 0);
+}
+
+/**
+ * @brief Print the layout of a type: field offsets and sizes, holes and cache lines.
+ *
+ * @param desc The layout descriptor.
+ */
+void layoutReport(const LayoutDesc* desc) {
+    LayoutField fields[256];
+    size_t n = layoutSorted(desc, fields, 256);
+    size_t end = 0, holes = 0, hole_bytes = 0;
+
+    printIndent();
+    MSG(MAGENTA, "struct %s {\n", desc->name);
+    for (size_t i = 0; i < n; i++) {
+        const LayoutField* f = &fields[i];
+        if (f->offset > end) {
+            holes++;
+            hole_bytes += f->offset - end;
+            printIndent();
+            MSG(YELLOW, "    /* XXX %zu byte%s hole */\n", f->offset - end, f->offset - end == 1 ? "" : "s");
+        }
+        size_t first_line = f->offset / TEST_CACHE_LINE;
+        size_t last_line = (f->offset + (f->size ? f->size : 1) - 1) / TEST_CACHE_LINE;
+        if (f->offset && f->offset % TEST_CACHE_LINE == 0) {
+            printIndent();
+            MSG(CYAN, "    /* --- cacheline %zu boundary (%zu bytes) --- */\n", first_line, f->offset);
+        }
+        printIndent();
+        MSG(RESET, "    %-24s /* %6zu %6zu */", f->name, f->offset, f->size);
+        if (first_line != last_line) MSG(RED, " /* straddles cacheline %zu */", last_line);
+        MSG(RESET, "\n");
+        if (f->offset + f->size > end) end = f->offset + f->size;
+    }
+    size_t tail = desc->size > end ? desc->size - end : 0;
+    size_t lines = (desc->size + TEST_CACHE_LINE - 1) / TEST_CACHE_LINE;
+    printIndent();
+    MSG(CYAN, "    /* size: %zu, align: %zu, cachelines: %zu, holes: %zu, sum holes: %zu, padding: %zu */\n",
+        desc->size, desc->align, lines, holes, hole_bytes, tail);
+    printIndent();
+    MSG(MAGENTA, "};\n");
+}
+
+/**
+ * @brief Print the layout of every registered descriptor.
+ */
+void layoutReportAll(void) {
+    for (uint16_t i = 0; i < layout_count; i++) layoutReport(layouts[i]);
+}
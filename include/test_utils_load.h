@@ -0,0 +1,328 @@
+#pragma once
+/**
+ * @file test_utils_load.h
+ *
+ * @brief Open-loop load generator with coordinated-omission correction.
+ *
+ * @details
+ * Timing a function in a closed loop hides queueing: a slow call delays every
+ * call behind it, and those delays are never measured. The load generator
+ * instead invokes the target on a fixed schedule:
+ *
+ * - Each of `load_config.threads` threads owns an equal share of the offered
+ *   rate and busy-waits until the intended start time of its next request.
+ * - Latency is measured from the intended start time, not the actual start,
+ *   so time spent behind schedule is charged to the requests that waited.
+ * - Service time (actual start to completion) is recorded separately.
+ * - Requests still waiting when the step ends are counted as missed and
+ *   recorded with the latency from their intended start to the end of the
+ *   step, a lower bound, so a backlog shows in the percentiles.
+ *
+ * LOAD_SWEEP(fn, arg) runs steps of increasing offered load, starting at
+ * `load_config.start_rate` and multiplying by `load_config.rate_factor`, and
+ * prints latency percentiles versus offered load. The sweep stops at the first
+ * step that cannot keep up with its schedule (the saturation point). Results
+ * stay available in `load_steps` for assertions.
+ *
+ * Latencies are kept in log-linear histograms (about 6% resolution), so memory
+ * is bounded regardless of rate and duration.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_clock.h"
+
+#include <pthread.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_LOAD_MAX_STEPS
+#define TEST_LOAD_MAX_STEPS 32 // steps kept per sweep
+#endif
+
+#ifndef TEST_LOAD_MAX_THREADS
+#define TEST_LOAD_MAX_THREADS 64 // load generator threads
+#endif
+
+#define LOAD_SUB_BITS 4
+#define LOAD_SUB (1u << LOAD_SUB_BITS)
+#define LOAD_BUCKETS ((64 - LOAD_SUB_BITS + 1) * LOAD_SUB)
+
+/**
+ * @brief Sweep the offered load of a target function up to its saturation point.
+ *
+ * @param fn The target, `void fn(void* arg)`.
+ * @param arg The argument passed to every invocation.
+ */
+#define LOAD_SWEEP(fn, arg)                     \
+    MSG(MAGENTA, "%s() [load]:\n", #fn);        \
+    depth++;                                    \
+    loadSweep(fn, arg);                         \
+    depth--;
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief A function driven by the load generator.
+ */
+typedef void (*LoadTarget)(void* arg);
+
+/**
+ * @brief Load sweep configuration.
+ */
+typedef struct {
+    uint16_t threads;   // generator threads, each paces an equal share of the rate.
+    double seconds;     // duration of each step.
+    double start_rate;  // offered load of the first step in requests per second.
+    double rate_factor; // offered load multiplier between steps.
+    uint16_t max_steps; // upper bound on the number of steps.
+    double saturation;  // achieved/offered ratio below which a step is saturated.
+} LoadConfig;
+
+/**
+ * @brief A log-linear latency histogram in nanoseconds.
+ */
+typedef struct {
+    uint64_t counts[LOAD_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} LoadHist;
+
+/**
+ * @brief The result of one step of a load sweep.
+ */
+typedef struct {
+    double offered;     // offered load in requests per second.
+    double achieved;    // completed requests per second.
+    uint64_t completed; // completed requests.
+    uint64_t missed;    // scheduled requests never started before the step ended.
+    double p50, p90, p99, p999, max; // latency from intended start, in ns, missed requests included.
+    double service_p50, service_p99; // latency from actual start, in ns.
+    bool saturated;     // the step could not keep up with its schedule.
+} LoadStep;
+
+/**
+ * @brief State of one generator thread.
+ */
+typedef struct {
+    LoadTarget fn;
+    void* arg;
+    uint64_t start;     // intended start of the first request.
+    uint64_t end;       // end of the step.
+    double interval;    // ns between intended starts.
+    uint64_t completed;
+    uint64_t missed;
+    LoadHist latency;
+    LoadHist service;
+} LoadThread;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+LoadConfig load_config = {
+    .threads = 1,
+    .seconds = 1.0,
+    .start_rate = 1000.0,
+    .rate_factor = 2.0,
+    .max_steps = 16,
+    .saturation = 0.95,
+};
+
+LoadStep load_steps[TEST_LOAD_MAX_STEPS]; // steps of the last sweep.
+uint16_t load_step_count = 0; // number of valid entries in load_steps.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Map a value to its histogram bucket.
+ */
+static inline uint32_t loadBucket(uint64_t v) {
+    if (v < LOAD_SUB) return (uint32_t)v;
+    int msb = 63 - __builtin_clzll(v);
+    return (uint32_t)(msb - LOAD_SUB_BITS + 1) * LOAD_SUB
+         + (uint32_t)((v >> (msb - LOAD_SUB_BITS)) & (LOAD_SUB - 1));
+}
+
+/**
+ * @brief The midpoint of the values mapped to a histogram bucket.
+ */
+static double loadBucketValue(uint32_t b) {
+    if (b < LOAD_SUB) return (double)b;
+    int shift = (int)(b / LOAD_SUB) - 1;
+    double low = (double)((uint64_t)(LOAD_SUB + b % LOAD_SUB) << shift);
+    return low + (double)((uint64_t)1 << shift) / 2.0;
+}
+
+/**
+ * @brief Record a latency sample.
+ */
+static inline void loadHistAdd(LoadHist* h, uint64_t v) {
+    h->counts[loadBucket(v)]++;
+    h->total++;
+    if (v > h->max) h->max = v;
+}
+
+/**
+ * @brief Add the samples of one histogram to another.
+ */
+void loadHistMerge(LoadHist* dst, const LoadHist* src) {
+    for (uint32_t b = 0; b < LOAD_BUCKETS; b++) dst->counts[b] += src->counts[b];
+    dst->total += src->total;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+/**
+ * @brief Compute a percentile of a histogram.
+ *
+ * @param h The histogram.
+ * @param q The quantile in [0, 1].
+ * @return The latency in ns (0 for an empty histogram).
+ */
+double loadPercentile(const LoadHist* h, double q) {
+    if (!h->total) return 0;
+    uint64_t rank = (uint64_t)(q * (double)(h->total - 1)) + 1, seen = 0;
+    for (uint32_t b = 0; b < LOAD_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank) {
+            double v = loadBucketValue(b);
+            return v < (double)h->max ? v : (double)h->max;
+        }
+    }
+    return (double)h->max;
+}
+
+/**
+ * @brief Spin-wait hint for the pacing loop.
+ */
+static inline void loadRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * @brief Body of a generator thread: pace, invoke, record.
+ */
+static void* loadWorker(void* p) {
+    LoadThread* t = (LoadThread*)p;
+    for (uint64_t i = 0;; i++) {
+        uint64_t intended = t->start + (uint64_t)((double)i * t->interval);
+        if (intended >= t->end) break;
+        uint64_t now = testClockNs();
+        while (now < intended) {
+            loadRelax();
+            now = testClockNs();
+        }
+        if (now >= t->end) {
+            // behind schedule at the end of the step: the rest never started, but
+            // they waited at least until the end, so they count in the percentiles
+            for (; intended < t->end; intended = t->start + (uint64_t)((double)++i * t->interval)) {
+                loadHistAdd(&t->latency, t->end - intended);
+                t->missed++;
+            }
+            break;
+        }
+        t->fn(t->arg);
+        uint64_t done = testClockNs();
+        loadHistAdd(&t->latency, done - intended);
+        loadHistAdd(&t->service, done - now);
+        t->completed++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Run a target at a fixed offered load.
+ *
+ * @param fn The target function.
+ * @param arg The argument passed to every invocation.
+ * @param rate The offered load in requests per second.
+ * @param step Receives the result.
+ */
+void loadRun(LoadTarget fn, void* arg, double rate, LoadStep* step) {
+    static LoadThread threads[TEST_LOAD_MAX_THREADS];
+    static LoadHist latency, service;
+    pthread_t ids[TEST_LOAD_MAX_THREADS];
+    uint16_t n = load_config.threads ? load_config.threads : 1;
+    if (n > TEST_LOAD_MAX_THREADS) n = TEST_LOAD_MAX_THREADS;
+
+    double interval = 1e9 * n / rate;
+    uint64_t start = testClockNs() + 1000000; // give every thread time to start
+    uint64_t end = start + (uint64_t)(load_config.seconds * 1e9);
+    memset(&latency, 0, sizeof(latency));
+    memset(&service, 0, sizeof(service));
+    for (uint16_t i = 0; i < n; i++) {
+        memset(&threads[i], 0, sizeof(LoadThread));
+        threads[i].fn = fn;
+        threads[i].arg = arg;
+        threads[i].start = start + (uint64_t)(interval * i / n); // interleave the schedules
+        threads[i].end = end;
+        threads[i].interval = interval;
+        if (i && pthread_create(&ids[i], NULL, loadWorker, &threads[i])) threads[i].end = 0;
+    }
+    loadWorker(&threads[0]);
+
+    memset(step, 0, sizeof(LoadStep));
+    for (uint16_t i = 0; i < n; i++) {
+        if (i && threads[i].end) pthread_join(ids[i], NULL);
+        loadHistMerge(&latency, &threads[i].latency);
+        loadHistMerge(&service, &threads[i].service);
+        step->completed += threads[i].completed;
+        step->missed += threads[i].missed;
+    }
+    step->offered = rate;
+    step->achieved = (double)step->completed / load_config.seconds;
+    step->p50 = loadPercentile(&latency, 0.50);
+    step->p90 = loadPercentile(&latency, 0.90);
+    step->p99 = loadPercentile(&latency, 0.99);
+    step->p999 = loadPercentile(&latency, 0.999);
+    step->max = (double)latency.max;
+    step->service_p50 = loadPercentile(&service, 0.50);
+    step->service_p99 = loadPercentile(&service, 0.99);
+    step->saturated = step->achieved < load_config.saturation * rate;
+}
+
+/**
+ * @brief Sweep the offered load until the target saturates and print the results.
+ *
+ * @param fn The target function.
+ * @param arg The argument passed to every invocation.
+ * @return The highest offered load that did not saturate (0 if the first step did).
+ */
+double loadSweep(LoadTarget fn, void* arg) {
+    double rate = load_config.start_rate, sustained = 0;
+    uint16_t max = load_config.max_steps < TEST_LOAD_MAX_STEPS ? load_config.max_steps : TEST_LOAD_MAX_STEPS;
+    char p50[16], p90[16], p99[16], p999[16], mx[16], s50[16], s99[16];
+
+    printIndent();
+    MSG(BLUE, "%9s %9s %9s %9s %9s %9s %9s | %9s %9s\n",
+        "offered/s", "achieved", "p50", "p90", "p99", "p99.9", "max", "svc p50", "svc p99");
+    for (load_step_count = 0; load_step_count < max; load_step_count++, rate *= load_config.rate_factor) {
+        LoadStep* s = &load_steps[load_step_count];
+        loadRun(fn, arg, rate, s);
+        testFormatNs(p50, sizeof(p50), s->p50);
+        testFormatNs(p90, sizeof(p90), s->p90);
+        testFormatNs(p99, sizeof(p99), s->p99);
+        testFormatNs(p999, sizeof(p999), s->p999);
+        testFormatNs(mx, sizeof(mx), s->max);
+        testFormatNs(s50, sizeof(s50), s->service_p50);
+        testFormatNs(s99, sizeof(s99), s->service_p99);
+        printIndent();
+        if (s->saturated)
+            MSG(YELLOW, "%9.0f %9.0f %9s %9s %9s %9s %9s | %9s %9s  saturated\n",
+                s->offered, s->achieved, p50, p90, p99, p999, mx, s50, s99);
+        else
+            MSG(CYAN, "%9.0f %9.0f %9s %9s %9s %9s %9s | %9s %9s\n",
+                s->offered, s->achieved, p50, p90, p99, p999, mx, s50, s99);
+        if (s->saturated) {
+            load_step_count++;
+            break;
+        }
+        sustained = rate;
+    }
+    printIndent();
+    MSG(GREEN, "sustained: %.0f requests/s\n", sustained);
+    return sustained;
+}
@@ -0,0 +1,617 @@
+#pragma once
+/**
+ * @file test_utils_lock.h
+ *
+ * @brief Opt-in lock contention and lock-order profiler.
+ *
+ * @details
+ * Including this header interposes the pthread mutex, rwlock and condition
+ * variable entry points of the test executable. Between TEST_CASE and
+ * CASE_COMPLETE every lock operation is recorded:
+ *
+ * - Acquisitions, contended acquisitions and total/max wait time per lock.
+ * - Total/max hold time per lock (a condition wait ends the hold).
+ * - The lock-order graph: an edge A -> B for every acquisition of B while A is held.
+ *
+ * When the case completes the TEST_LOCK_TOP most contended locks are reported
+ * together with the call site that initialized them (or first locked them, for
+ * statically initialized locks). Any cycle in the lock-order graph is reported
+ * as a potential deadlock and fails the case.
+ *
+ * Destroying a lock frees its slot and its edges, so a lock later created at
+ * the same address starts afresh; a lock destroyed during a case is still
+ * reported with that case and freed when the next one begins. At most
+ * TEST_LOCK_MAX locks are tracked at once, with a warning when the table is full.
+ *
+ * Calls made from shared libraries are only routed through the profiler when
+ * the test executable is linked with `-rdynamic`. Call sites are resolved with
+ * dladdr(), so symbol names also require `-rdynamic`; otherwise the module and
+ * offset are printed.
+ *
+ * Include test_utils.h (or this header) before any system header so that
+ * _GNU_SOURCE is in effect.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_clock.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_LOCK_MAX
+#define TEST_LOCK_MAX 1024 // tracked locks, power of two, at most 65535
+#endif
+
+#ifndef TEST_LOCK_MAX_EDGES
+#define TEST_LOCK_MAX_EDGES 4096 // lock-order edges, power of two
+#endif
+
+#ifndef TEST_LOCK_MAX_HELD
+#define TEST_LOCK_MAX_HELD 32 // locks held at once by a single thread
+#endif
+
+#ifndef TEST_LOCK_TOP
+#define TEST_LOCK_TOP 5 // contended locks reported per case
+#endif
+
+#define LOCK_PROF_FREED ((const void*)1) // address of a freed slot, skipped by lookups
+#define LOCK_EDGE_FREED UINT32_MAX // a removed lock-order edge
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Per-lock statistics collected during a test case.
+ */
+typedef struct {
+    const void* addr;       // address of the lock, NULL or LOCK_PROF_FREED for a free slot.
+    const void* site;       // call site that initialized or first locked it.
+    bool rw;                // true for rwlocks, false for mutexes.
+    bool retired;           // destroyed during the case, freed when the next one begins.
+    uint64_t acquisitions;  // successful acquisitions.
+    uint64_t contended;     // acquisitions that had to wait.
+    uint64_t wait_ns;       // total time spent waiting to acquire.
+    uint64_t max_wait_ns;   // longest single wait.
+    uint64_t hold_ns;       // total time held.
+    uint64_t max_hold_ns;   // longest single hold.
+    uint64_t cond_waits;    // condition waits that released this mutex.
+} LockStats;
+
+/**
+ * @brief A lock held by the current thread.
+ */
+typedef struct {
+    int32_t lock;   // index into lock_stats.
+    uint32_t gen;   // case generation the lock was acquired in.
+    uint64_t since; // acquisition timestamp.
+} LockHeld;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+bool lock_prof_enabled = true;      // set to false to stop profiling cases.
+bool lock_prof_fail_on_cycle = true; // fail the case on a lock-order cycle.
+bool lock_prof_active = false;      // true between TEST_CASE and CASE_COMPLETE.
+uint32_t lock_prof_gen = 0;         // incremented at the start of every case.
+
+LockStats lock_stats[TEST_LOCK_MAX];
+uint32_t lock_edges[TEST_LOCK_MAX_EDGES]; // (from + 1) << 16 | (to + 1), 0 if free.
+bool lock_prof_full = false;        // the table overflowed, warned once.
+
+static _Thread_local LockHeld lock_held[TEST_LOCK_MAX_HELD];
+static _Thread_local uint8_t lock_held_count = 0;
+static _Thread_local bool lock_prof_busy = false;
+
+/**
+ * @brief The interposed pthread functions, resolved with RTLD_NEXT.
+ */
+static struct {
+    int (*mutex_init)(pthread_mutex_t*, const pthread_mutexattr_t*);
+    int (*mutex_lock)(pthread_mutex_t*);
+    int (*mutex_trylock)(pthread_mutex_t*);
+    int (*mutex_unlock)(pthread_mutex_t*);
+    int (*mutex_destroy)(pthread_mutex_t*);
+    int (*rwlock_init)(pthread_rwlock_t*, const pthread_rwlockattr_t*);
+    int (*rwlock_rdlock)(pthread_rwlock_t*);
+    int (*rwlock_tryrdlock)(pthread_rwlock_t*);
+    int (*rwlock_wrlock)(pthread_rwlock_t*);
+    int (*rwlock_trywrlock)(pthread_rwlock_t*);
+    int (*rwlock_unlock)(pthread_rwlock_t*);
+    int (*rwlock_destroy)(pthread_rwlock_t*);
+    int (*cond_wait)(pthread_cond_t*, pthread_mutex_t*);
+    int (*cond_timedwait)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*);
+} lock_real;
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Resolve the real pthread functions behind the interposers.
+ */
+static void lockProfResolve(void) {
+    if (lock_real.mutex_lock) return;
+    lock_prof_busy = true;
+    *(void**)&lock_real.mutex_init       = dlsym(RTLD_NEXT, "pthread_mutex_init");
+    *(void**)&lock_real.mutex_trylock    = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+    *(void**)&lock_real.mutex_unlock     = dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+    *(void**)&lock_real.mutex_destroy    = dlsym(RTLD_NEXT, "pthread_mutex_destroy");
+    *(void**)&lock_real.rwlock_init      = dlsym(RTLD_NEXT, "pthread_rwlock_init");
+    *(void**)&lock_real.rwlock_rdlock    = dlsym(RTLD_NEXT, "pthread_rwlock_rdlock");
+    *(void**)&lock_real.rwlock_tryrdlock = dlsym(RTLD_NEXT, "pthread_rwlock_tryrdlock");
+    *(void**)&lock_real.rwlock_wrlock    = dlsym(RTLD_NEXT, "pthread_rwlock_wrlock");
+    *(void**)&lock_real.rwlock_trywrlock = dlsym(RTLD_NEXT, "pthread_rwlock_trywrlock");
+    *(void**)&lock_real.rwlock_unlock    = dlsym(RTLD_NEXT, "pthread_rwlock_unlock");
+    *(void**)&lock_real.rwlock_destroy   = dlsym(RTLD_NEXT, "pthread_rwlock_destroy");
+    // the unversioned lookup returns the pre-2.3.2 condvar ABI on some targets
+    *(void**)&lock_real.cond_wait      = dlvsym(RTLD_NEXT, "pthread_cond_wait", "GLIBC_2.3.2");
+    *(void**)&lock_real.cond_timedwait = dlvsym(RTLD_NEXT, "pthread_cond_timedwait", "GLIBC_2.3.2");
+    if (!lock_real.cond_wait)
+        *(void**)&lock_real.cond_wait = dlsym(RTLD_NEXT, "pthread_cond_wait");
+    if (!lock_real.cond_timedwait)
+        *(void**)&lock_real.cond_timedwait = dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+    void* lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+    __atomic_store_n((void**)&lock_real.mutex_lock, lock, __ATOMIC_RELEASE);
+    lock_prof_busy = false;
+}
+
+/**
+ * @brief Check whether the calling thread should record lock operations.
+ */
+static inline bool lockProfTracking(void) {
+    if (!lock_real.mutex_lock) lockProfResolve();
+    return __atomic_load_n(&lock_prof_active, __ATOMIC_RELAXED) && !lock_prof_busy;
+}
+
+/**
+ * @brief Find the statistics slot of a lock.
+ *
+ * @param addr The address of the lock.
+ * @param rw true for rwlocks, false for mutexes.
+ * @param site The call site recorded when a slot is claimed, NULL to only look up.
+ * @param init true if called from an init function, which always records the site.
+ * @return The slot index, or -1 if not found / the table is full.
+ */
+static int lockProfSlot(const void* addr, bool rw, const void* site, bool init) {
+    uint64_t h = (uint64_t)(uintptr_t)addr * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 29;
+    for (;;) {
+        int free_slot = -1; // first free slot on the probe sequence, taken by a claim
+        const void* free_addr = NULL;
+        for (uint32_t n = 0; n < TEST_LOCK_MAX; n++) {
+            uint32_t i = (uint32_t)(h + n) & (TEST_LOCK_MAX - 1);
+            const void* cur = __atomic_load_n(&lock_stats[i].addr, __ATOMIC_ACQUIRE);
+            if ((cur == NULL || cur == LOCK_PROF_FREED) && free_slot < 0) {
+                free_slot = (int)i;
+                free_addr = cur;
+            }
+            if (cur == NULL) break; // end of the probe sequence
+            if (cur == LOCK_PROF_FREED) continue;
+            if (cur == addr && !__atomic_load_n(&lock_stats[i].retired, __ATOMIC_RELAXED)) {
+                if (init) {
+                    lock_stats[i].rw = rw;
+                    lock_stats[i].site = site;
+                }
+                return (int)i;
+            }
+        }
+        if (!site) return -1;
+        if (free_slot < 0) {
+            if (!__atomic_exchange_n(&lock_prof_full, true, __ATOMIC_RELAXED)) {
+                bool busy = lock_prof_busy;
+                lock_prof_busy = true;
+                printIndent();
+                LOG_WARN("LOCK: more than %d live locks, the rest are not profiled (raise TEST_LOCK_MAX)\n",
+                         TEST_LOCK_MAX);
+                lock_prof_busy = busy;
+            }
+            return -1;
+        }
+        const void* cur = free_addr;
+        if (__atomic_compare_exchange_n(&lock_stats[free_slot].addr, &cur, addr, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            lock_stats[free_slot].rw = rw;
+            lock_stats[free_slot].site = site;
+            return free_slot;
+        }
+        if (cur == addr) return free_slot; // claimed by another thread meanwhile
+        // the slot was taken by another lock: probe again
+    }
+}
+
+/**
+ * @brief Free the slot of a lock and remove its lock-order edges.
+ */
+static void lockProfFree(int idx) {
+    for (int e = 0; e < TEST_LOCK_MAX_EDGES; e++) {
+        uint32_t edge = __atomic_load_n(&lock_edges[e], __ATOMIC_RELAXED);
+        if (edge && edge != LOCK_EDGE_FREED && ((edge >> 16) == (uint32_t)idx + 1 || (edge & 0xffff) == (uint32_t)idx + 1))
+            __atomic_store_n(&lock_edges[e], LOCK_EDGE_FREED, __ATOMIC_RELAXED); // keeps the probe sequences intact
+    }
+    LockStats* s = &lock_stats[idx];
+    s->site = NULL;
+    s->rw = false;
+    s->acquisitions = s->contended = s->cond_waits = 0;
+    s->wait_ns = s->max_wait_ns = s->hold_ns = s->max_hold_ns = 0;
+    __atomic_store_n(&s->retired, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->addr, LOCK_PROF_FREED, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Forget a destroyed lock, so that a lock created at the same address starts afresh.
+ */
+static void lockProfForget(const void* addr) {
+    int idx = lockProfSlot(addr, false, NULL, false);
+    if (idx < 0) return;
+    if (__atomic_load_n(&lock_prof_active, __ATOMIC_ACQUIRE))
+        __atomic_store_n(&lock_stats[idx].retired, true, __ATOMIC_RELAXED); // still reported with this case
+    else
+        lockProfFree(idx);
+}
+
+/**
+ * @brief Add the edge from -> to to the lock-order graph.
+ */
+static void lockProfEdge(int32_t from, int32_t to) {
+    uint32_t key = ((uint32_t)(from + 1) << 16) | (uint32_t)(to + 1);
+    uint32_t h = key * 0x9E3779B1u;
+    for (uint32_t n = 0; n < TEST_LOCK_MAX_EDGES; n++) {
+        uint32_t i = (h + n) & (TEST_LOCK_MAX_EDGES - 1);
+        uint32_t cur = __atomic_load_n(&lock_edges[i], __ATOMIC_RELAXED);
+        if (cur == key) return;
+        if (cur == 0) {
+            if (__atomic_compare_exchange_n(&lock_edges[i], &cur, key, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return;
+            if (cur == key) return;
+        }
+    }
+}
+
+/**
+ * @brief Record that the calling thread now holds a lock.
+ */
+static void lockProfHold(int idx) {
+    uint32_t gen = __atomic_load_n(&lock_prof_gen, __ATOMIC_RELAXED);
+    uint8_t keep = 0;
+    for (uint8_t i = 0; i < lock_held_count; i++) {
+        if (lock_held[i].gen != gen) continue; // left over from an earlier case
+        if (lock_held[i].lock != idx) lockProfEdge(lock_held[i].lock, idx);
+        lock_held[keep++] = lock_held[i];
+    }
+    lock_held_count = keep;
+    if (lock_held_count < TEST_LOCK_MAX_HELD) {
+        lock_held[lock_held_count].lock = idx;
+        lock_held[lock_held_count].gen = gen;
+        lock_held[lock_held_count].since = testClockNs();
+        lock_held_count++;
+    }
+}
+
+/**
+ * @brief Atomically raise *dst to val.
+ */
+static inline void lockProfMax(uint64_t* dst, uint64_t val) {
+    uint64_t cur = __atomic_load_n(dst, __ATOMIC_RELAXED);
+    while (val > cur && !__atomic_compare_exchange_n(dst, &cur, val, true,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief Record a successful acquisition.
+ *
+ * @param idx The slot of the lock.
+ * @param start Timestamp taken before the acquisition was attempted.
+ * @param contended true if the lock was not immediately available.
+ */
+static void lockProfAcquired(int idx, uint64_t start, bool contended) {
+    if (idx < 0) return;
+    LockStats* s = &lock_stats[idx];
+    __atomic_add_fetch(&s->acquisitions, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        uint64_t wait = testClockNs() - start;
+        __atomic_add_fetch(&s->contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->wait_ns, wait, __ATOMIC_RELAXED);
+        lockProfMax(&s->max_wait_ns, wait);
+    }
+    lockProfHold(idx);
+}
+
+/**
+ * @brief Record that the calling thread released a lock.
+ */
+static void lockProfReleased(const void* addr) {
+    int idx = lockProfSlot(addr, false, NULL, false);
+    if (idx < 0) return;
+    uint32_t gen = __atomic_load_n(&lock_prof_gen, __ATOMIC_RELAXED);
+    for (int i = lock_held_count - 1; i >= 0; i--) {
+        if (lock_held[i].lock != idx) continue;
+        if (lock_held[i].gen == gen) {
+            uint64_t hold = testClockNs() - lock_held[i].since;
+            __atomic_add_fetch(&lock_stats[idx].hold_ns, hold, __ATOMIC_RELAXED);
+            lockProfMax(&lock_stats[idx].max_hold_ns, hold);
+        }
+        memmove(&lock_held[i], &lock_held[i + 1], (size_t)(lock_held_count - i - 1) * sizeof(LockHeld));
+        lock_held_count--;
+        return;
+    }
+}
+
+/**
+ * @brief Format the call site of a lock as symbol+offset or module+offset.
+ */
+static char* lockProfSite(char* buf, size_t len, const void* site) {
+    Dl_info info;
+    if (site && dladdr(site, &info)) {
+        if (info.dli_sname)
+            snprintf(buf, len, "%s+0x%tx", info.dli_sname, (const char*)site - (const char*)info.dli_saddr);
+        else {
+            const char* mod = info.dli_fname ? strrchr(info.dli_fname, '/') : NULL;
+            snprintf(buf, len, "%s+0x%tx", mod ? mod + 1 : info.dli_fname,
+                     (const char*)site - (const char*)info.dli_fbase);
+        }
+    } else {
+        snprintf(buf, len, "%p", site);
+    }
+    return buf;
+}
+
+/**
+ * @brief Start profiling a new test case.
+ */
+static void lockProfBegin(void) {
+    if (!lock_prof_enabled) return;
+    for (int i = 0; i < TEST_LOCK_MAX; i++) {
+        LockStats* s = &lock_stats[i];
+        if (s->retired) {
+            s->retired = false;
+            s->site = NULL;
+            __atomic_store_n(&s->addr, LOCK_PROF_FREED, __ATOMIC_RELEASE);
+        }
+        s->acquisitions = s->contended = s->cond_waits = 0;
+        s->wait_ns = s->max_wait_ns = s->hold_ns = s->max_hold_ns = 0;
+    }
+    memset(lock_edges, 0, sizeof(lock_edges));
+    __atomic_add_fetch(&lock_prof_gen, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock_prof_active, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Report lock-order cycles of the current case.
+ *
+ * @return The number of cycles reported.
+ */
+static int lockProfCycles(void) {
+    // compressed adjacency of the edge table
+    static uint32_t first[TEST_LOCK_MAX + 1];
+    static uint16_t next[TEST_LOCK_MAX_EDGES];
+    static uint8_t color[TEST_LOCK_MAX]; // 0 = new, 1 = on stack, 2 = done
+    static uint16_t stack[TEST_LOCK_MAX];
+    static uint32_t cursor[TEST_LOCK_MAX];
+    memset(first, 0, sizeof(first));
+    memset(color, 0, sizeof(color));
+    for (int e = 0; e < TEST_LOCK_MAX_EDGES; e++)
+        if (lock_edges[e] && lock_edges[e] != LOCK_EDGE_FREED) first[lock_edges[e] >> 16]++;
+    for (int i = 1; i <= TEST_LOCK_MAX; i++) first[i] += first[i - 1];
+    for (int i = 0; i < TEST_LOCK_MAX; i++) cursor[i] = first[i];
+    for (int e = 0; e < TEST_LOCK_MAX_EDGES; e++)
+        if (lock_edges[e] && lock_edges[e] != LOCK_EDGE_FREED) next[cursor[(lock_edges[e] >> 16) - 1]++] = (uint16_t)((lock_edges[e] & 0xffff) - 1);
+    // first[v] .. first[v + 1] now holds the successors of v
+
+    int cycles = 0;
+    char site[96];
+    for (int root = 0; root < TEST_LOCK_MAX && cycles < 4; root++) {
+        if (color[root] || first[root] == first[root + 1]) continue;
+        int top = 0;
+        stack[0] = (uint16_t)root;
+        cursor[0] = first[root];
+        color[root] = 1;
+        while (top >= 0 && cycles < 4) {
+            uint16_t v = stack[top];
+            if (cursor[top] == first[v + 1]) {
+                color[v] = 2;
+                top--;
+                continue;
+            }
+            uint16_t w = next[cursor[top]++];
+            if (color[w] == 0) {
+                color[w] = 1;
+                stack[++top] = w;
+                cursor[top] = first[w];
+            } else if (color[w] == 1) {
+                int from = top;
+                while (stack[from] != w) from--;
+                printIndent();
+                LOG_ERROR("LOCK_ORDER: potential deadlock between %d locks:\n", top - from + 1);
+                for (int i = from; i <= top; i++) {
+                    printIndent();
+                    MSG(RED, "    %s %p (%s) ->\n", lock_stats[stack[i]].rw ? "rwlock" : "mutex",
+                        lock_stats[stack[i]].addr, lockProfSite(site, sizeof(site), lock_stats[stack[i]].site));
+                }
+                printIndent();
+                MSG(RED, "    %p (cycle)\n", lock_stats[w].addr);
+                cycles++;
+            }
+        }
+    }
+    return cycles;
+}
+
+/**
+ * @brief Finish profiling the current test case and report the results.
+ */
+static void lockProfEnd(void) {
+    if (!__atomic_load_n(&lock_prof_active, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&lock_prof_active, false, __ATOMIC_RELEASE);
+    lock_prof_busy = true;
+
+    int top[TEST_LOCK_TOP];
+    int n = 0;
+    for (int i = 0; i < TEST_LOCK_MAX; i++) {
+        if (!lock_stats[i].contended) continue;
+        if (n < TEST_LOCK_TOP) top[n++] = i;
+        else if (lock_stats[i].wait_ns > lock_stats[top[n - 1]].wait_ns) top[n - 1] = i;
+        else continue;
+        for (int j = n - 1; j > 0 && lock_stats[top[j - 1]].wait_ns < lock_stats[top[j]].wait_ns; j--) {
+            int t = top[j];
+            top[j] = top[j - 1];
+            top[j - 1] = t;
+        }
+    }
+    if (n) {
+        printIndent();
+        MSG(CYAN, "lock contention:\n");
+    }
+    for (int i = 0; i < n; i++) {
+        const LockStats* s = &lock_stats[top[i]];
+        char site[96], wait[16], max_wait[16], hold[16], max_hold[16];
+        printIndent();
+        MSG(CYAN, "  #%d %s %p (%s): %llu acq, %llu contended, wait %s (max %s), hold %s (max %s)\n",
+            i + 1, s->rw ? "rwlock" : "mutex", s->addr, lockProfSite(site, sizeof(site), s->site),
+            (unsigned long long)s->acquisitions, (unsigned long long)s->contended,
+            testFormatNs(wait, sizeof(wait), (double)s->wait_ns),
+            testFormatNs(max_wait, sizeof(max_wait), (double)s->max_wait_ns),
+            testFormatNs(hold, sizeof(hold), (double)s->hold_ns),
+            testFormatNs(max_hold, sizeof(max_hold), (double)s->max_hold_ns));
+    }
+    if (lockProfCycles() && lock_prof_fail_on_cycle) failCase();
+    lock_prof_busy = false;
+}
+
+/**
+ * @brief Register the profiler with the test framework.
+ */
+__attribute__((constructor)) static void lockProfRegister(void) {
+    lockProfResolve();
+    testAddCaseHooks(lockProfBegin, lockProfEnd);
+}
+
+/**
+ * @brief Retrieve the statistics of a lock from the current (or last) case.
+ *
+ * @param lock The address of the mutex or rwlock.
+ * @return The statistics, or NULL if the lock has not been seen.
+ */
+const LockStats* lockProfStats(const void* lock) {
+    int idx = lockProfSlot(lock, false, NULL, false);
+    return idx < 0 ? NULL : &lock_stats[idx];
+}
+
+/* -- Interposers --------------------------------------------------------- */
+
+int pthread_mutex_init(pthread_mutex_t* m, const pthread_mutexattr_t* attr) {
+    if (!lock_real.mutex_lock) lockProfResolve();
+    if (!lock_prof_busy) lockProfSlot(m, false, __builtin_return_address(0), true);
+    return lock_real.mutex_init(m, attr);
+}
+
+int pthread_mutex_lock(pthread_mutex_t* m) {
+    if (!lockProfTracking()) return lock_real.mutex_lock ? lock_real.mutex_lock(m) : 0;
+    int idx = lockProfSlot(m, false, __builtin_return_address(0), false);
+    uint64_t start = testClockNs();
+    bool contended = false;
+    int rc = lock_real.mutex_trylock(m);
+    if (rc == EBUSY) {
+        contended = true;
+        rc = lock_real.mutex_lock(m);
+    }
+    if (rc == 0) lockProfAcquired(idx, start, contended);
+    return rc;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t* m) {
+    if (!lockProfTracking()) return lock_real.mutex_trylock ? lock_real.mutex_trylock(m) : 0;
+    int rc = lock_real.mutex_trylock(m);
+    if (rc == 0) lockProfAcquired(lockProfSlot(m, false, __builtin_return_address(0), false), 0, false);
+    return rc;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t* m) {
+    if (lockProfTracking()) lockProfReleased(m);
+    return lock_real.mutex_unlock ? lock_real.mutex_unlock(m) : 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t* m) {
+    if (!lock_real.mutex_lock) lockProfResolve();
+    if (!lock_prof_busy) lockProfForget(m);
+    return lock_real.mutex_destroy(m);
+}
+
+int pthread_rwlock_init(pthread_rwlock_t* l, const pthread_rwlockattr_t* attr) {
+    if (!lock_real.mutex_lock) lockProfResolve();
+    if (!lock_prof_busy) lockProfSlot(l, true, __builtin_return_address(0), true);
+    return lock_real.rwlock_init(l, attr);
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t* l) {
+    if (!lockProfTracking()) return lock_real.rwlock_rdlock(l);
+    int idx = lockProfSlot(l, true, __builtin_return_address(0), false);
+    uint64_t start = testClockNs();
+    bool contended = false;
+    int rc = lock_real.rwlock_tryrdlock(l);
+    if (rc == EBUSY) {
+        contended = true;
+        rc = lock_real.rwlock_rdlock(l);
+    }
+    if (rc == 0) lockProfAcquired(idx, start, contended);
+    return rc;
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t* l) {
+    if (!lockProfTracking()) return lock_real.rwlock_tryrdlock(l);
+    int rc = lock_real.rwlock_tryrdlock(l);
+    if (rc == 0) lockProfAcquired(lockProfSlot(l, true, __builtin_return_address(0), false), 0, false);
+    return rc;
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t* l) {
+    if (!lockProfTracking()) return lock_real.rwlock_wrlock(l);
+    int idx = lockProfSlot(l, true, __builtin_return_address(0), false);
+    uint64_t start = testClockNs();
+    bool contended = false;
+    int rc = lock_real.rwlock_trywrlock(l);
+    if (rc == EBUSY) {
+        contended = true;
+        rc = lock_real.rwlock_wrlock(l);
+    }
+    if (rc == 0) lockProfAcquired(idx, start, contended);
+    return rc;
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t* l) {
+    if (!lockProfTracking()) return lock_real.rwlock_trywrlock(l);
+    int rc = lock_real.rwlock_trywrlock(l);
+    if (rc == 0) lockProfAcquired(lockProfSlot(l, true, __builtin_return_address(0), false), 0, false);
+    return rc;
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t* l) {
+    if (lockProfTracking()) lockProfReleased(l);
+    return lock_real.rwlock_unlock(l);
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t* l) {
+    if (!lock_real.mutex_lock) lockProfResolve();
+    if (!lock_prof_busy) lockProfForget(l);
+    return lock_real.rwlock_destroy(l);
+}
+
+int pthread_cond_wait(pthread_cond_t* c, pthread_mutex_t* m) {
+    if (!lockProfTracking()) return lock_real.cond_wait(c, m);
+    int idx = lockProfSlot(m, false, __builtin_return_address(0), false);
+    if (idx >= 0) __atomic_add_fetch(&lock_stats[idx].cond_waits, 1, __ATOMIC_RELAXED);
+    lockProfReleased(m);
+    int rc = lock_real.cond_wait(c, m);
+    if (idx >= 0) lockProfHold(idx); // the mutex is held again, but not newly acquired
+    return rc;
+}
+
+int pthread_cond_timedwait(pthread_cond_t* c, pthread_mutex_t* m, const struct timespec* abstime) {
+    if (!lockProfTracking()) return lock_real.cond_timedwait(c, m, abstime);
+    int idx = lockProfSlot(m, false, __builtin_return_address(0), false);
+    if (idx >= 0) __atomic_add_fetch(&lock_stats[idx].cond_waits, 1, __ATOMIC_RELAXED);
+    lockProfReleased(m);
+    int rc = lock_real.cond_timedwait(c, m, abstime);
+    if (idx >= 0) lockProfHold(idx);
+    return rc;
+}
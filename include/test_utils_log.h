@@ -0,0 +1,394 @@
+#pragma once
+/**
+ * @file test_utils_log.h
+ *
+ * @brief Asynchronous framework output through a lock-free queue.
+ *
+ * @details
+ * With TEST_ASYNC_LOG defined before test_utils.h is included, MSG and the
+ * LOG_* macros no longer call fprintf on the test thread. Each message is
+ * encoded into bytes, prefixed with its pending indent, and copied into a
+ * bounded multi-producer ring of fixed-size slots. A message claims as many
+ * consecutive slots as it needs with a single compare-and-swap, so messages
+ * from different threads never interleave and producers never take a lock.
+ * One writer thread drains the ring in order and hands whole batches of
+ * slots to writev(2) on the descriptor of TEST_OUT. An idle writer polls
+ * every TEST_LOG_LATENCY_MS and is only woken early once a batch is queued,
+ * so a burst of messages costs one context switch rather than one each.
+ *
+ * When the ring is full, `log_config.mode` decides:
+ *
+ * - LOG_BLOCK (default): the producer yields until the writer frees room.
+ * - LOG_DROP: the message is discarded and counted in `log_dropped`, which
+ *   is reported when the process exits.
+ *
+ * Queued output is flushed at exit, and on SIGSEGV, SIGBUS, SIGILL, SIGFPE,
+ * SIGABRT, SIGTERM and SIGINT before the previous handler runs. After a
+ * fork the child discards the parent's queue and starts its own writer on
+ * first use. Output written to stdout outside the framework is not ordered
+ * with respect to queued messages.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_LOG_SLOTS
+#define TEST_LOG_SLOTS 4096 // slots in the ring, a power of two
+#endif
+
+#define TEST_LOG_PAYLOAD 240 // message bytes per slot
+#define TEST_LOG_BATCH 512   // slots per writev, at most IOV_MAX
+#define TEST_LOG_STACK 4096  // messages longer than this are formatted on the heap
+
+#ifndef TEST_LOG_LATENCY_MS
+#define TEST_LOG_LATENCY_MS 10 // longest a queued message waits for an idle writer
+#endif
+
+_Static_assert((TEST_LOG_SLOTS & (TEST_LOG_SLOTS - 1)) == 0, "TEST_LOG_SLOTS must be a power of two");
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief What a producer does when the ring is full.
+ */
+typedef enum {
+    LOG_BLOCK,
+    LOG_DROP,
+} LogBackpressure;
+
+/**
+ * @brief Asynchronous output configuration.
+ */
+typedef struct {
+    LogBackpressure mode;   // behaviour when the ring is full.
+} LogConfig;
+
+/**
+ * @brief A slot of the ring.
+ */
+typedef struct {
+    _Atomic uint64_t seq;   // ticket + 1 once the slot is published.
+    uint32_t len;
+    char data[TEST_LOG_PAYLOAD];
+} LogSlot;
+
+/**
+ * @brief State of the writer thread.
+ */
+enum {
+    LOG_OFF,        // not started in this process.
+    LOG_STARTING,
+    LOG_RUNNING,
+    LOG_SYNC,       // no writer: messages are written by the producer.
+};
+
+/* -- Global Variables ----------------------------------------------------- */
+
+LogConfig log_config = {
+    .mode = LOG_BLOCK,
+};
+
+_Atomic uint64_t log_dropped = 0; // messages discarded under LOG_DROP.
+
+static LogSlot log_slots[TEST_LOG_SLOTS];
+static _Alignas(64) _Atomic uint64_t log_tail = 0; // next ticket to claim.
+static _Alignas(64) _Atomic uint64_t log_head = 0; // next ticket to write.
+static _Atomic int log_state = LOG_OFF;
+static _Atomic bool log_draining = false; // held by whoever consumes the ring.
+static _Atomic bool log_sleeping = false;
+static _Atomic bool log_stop = false;
+static pthread_t log_thread;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static struct sigaction log_old_actions[NSIG];
+static int log_fd = STDOUT_FILENO; // framework output descriptor, resolved by logStart().
+static __thread uint16_t log_indent = 0; // indent requested by printIndent() for the next message.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Remember the indent of the next message of this thread.
+ */
+void testLogIndent(uint16_t depth) { log_indent = depth; }
+
+/**
+ * @brief Write all iovecs, retrying partial writes and interrupts.
+ */
+static void logWriteAll(int fd, struct iovec* iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t w = writev(fd, iov, cnt);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        while (cnt > 0 && (size_t)w >= iov->iov_len) {
+            w -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + w;
+            iov->iov_len -= (size_t)w;
+        }
+    }
+}
+
+/**
+ * @brief Write one batch of published slots. The caller holds log_draining.
+ *
+ * @return The number of slots written.
+ */
+static uint32_t logDrainLocked(void) {
+    struct iovec iov[TEST_LOG_BATCH];
+    uint64_t h = atomic_load_explicit(&log_head, memory_order_relaxed);
+    int cnt = 0;
+    for (; cnt < TEST_LOG_BATCH; cnt++) {
+        LogSlot* s = &log_slots[(h + (uint64_t)cnt) & (TEST_LOG_SLOTS - 1)];
+        if (atomic_load_explicit(&s->seq, memory_order_acquire) != h + (uint64_t)cnt + 1) break;
+        iov[cnt].iov_base = s->data;
+        iov[cnt].iov_len = s->len;
+    }
+    if (!cnt) return 0;
+    logWriteAll(log_fd, iov, cnt);
+    atomic_store_explicit(&log_head, h + (uint64_t)cnt, memory_order_release);
+    return (uint32_t)cnt;
+}
+
+/**
+ * @brief Wake the writer if it is waiting for messages.
+ */
+static void logWake(void) {
+    if (!atomic_load(&log_sleeping)) return;
+    pthread_mutex_lock(&log_mutex);
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_mutex);
+}
+
+/**
+ * @brief The writer thread: drain the ring in batches, sleep when it is empty.
+ */
+static void* logWriter(void* unused) {
+    (void)unused;
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL); // asynchronous signals go to the test threads
+    for (;;) {
+        bool expect = false;
+        uint32_t n = 0;
+        if (atomic_compare_exchange_strong(&log_draining, &expect, true)) {
+            n = logDrainLocked();
+            atomic_store(&log_draining, false);
+        }
+        if (n) continue;
+        if (atomic_load(&log_stop) && atomic_load(&log_head) == atomic_load(&log_tail)) break;
+        atomic_store(&log_sleeping, true);
+        uint64_t h = atomic_load(&log_head);
+        if (atomic_load(&log_slots[h & (TEST_LOG_SLOTS - 1)].seq) != h + 1 && !atomic_load(&log_stop)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += TEST_LOG_LATENCY_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_mutex_lock(&log_mutex);
+            pthread_cond_timedwait(&log_cond, &log_mutex, &ts);
+            pthread_mutex_unlock(&log_mutex);
+        }
+        atomic_store(&log_sleeping, false);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Flush what is queued and stop the writer, at exit.
+ */
+static void logShutdown(void) {
+    if (atomic_load(&log_state) == LOG_RUNNING) {
+        atomic_store(&log_stop, true);
+        atomic_store(&log_sleeping, true);
+        logWake();
+        pthread_join(log_thread, NULL);
+        atomic_store(&log_state, LOG_SYNC);
+    }
+    bool expect = false;
+    if (atomic_compare_exchange_strong(&log_draining, &expect, true)) {
+        while (logDrainLocked()) {}
+        atomic_store(&log_draining, false);
+    }
+    uint64_t dropped = atomic_load(&log_dropped);
+    if (dropped) {
+        char buf[96];
+        int n = snprintf(buf, sizeof(buf), YELLOW "WARN: LOG: %llu messages dropped\n" RESET,
+                         (unsigned long long)dropped);
+        if (write(log_fd, buf, (size_t)n) < 0) return;
+    }
+}
+
+/**
+ * @brief Flush queued output on a fatal signal, then run the previous handler.
+ */
+static void logFatal(int sig) {
+    // wait (bounded) for a batch in flight; a crashed writer never releases it
+    struct timespec ms = { 0, 1000000 };
+    bool expect = false;
+    for (int i = 0; i < 500 && !atomic_compare_exchange_strong(&log_draining, &expect, true); i++) {
+        expect = false;
+        nanosleep(&ms, NULL);
+    }
+    while (logDrainLocked()) {}
+    sigaction(sig, &log_old_actions[sig], NULL);
+    raise(sig);
+}
+
+/**
+ * @brief In a forked child: forget the parent's queue and writer.
+ */
+static void logAfterFork(void) {
+    atomic_store(&log_head, atomic_load(&log_tail));
+    atomic_store(&log_draining, false);
+    atomic_store(&log_sleeping, false);
+    atomic_store(&log_stop, false);
+    // the parent's writer may have held these at the fork and will never release them here
+    pthread_mutex_init(&log_mutex, NULL);
+    pthread_cond_init(&log_cond, NULL);
+    if (atomic_load(&log_state) != LOG_OFF) atomic_store(&log_state, LOG_OFF);
+}
+
+/**
+ * @brief Start the writer thread on first use.
+ */
+static void logStart(void) {
+    static bool registered = false;
+    int expect = LOG_OFF;
+    if (!atomic_compare_exchange_strong(&log_state, &expect, LOG_STARTING)) {
+        while (atomic_load(&log_state) == LOG_STARTING) sched_yield();
+        return;
+    }
+    if (!registered) { // once per process image, inherited by forked children
+        static const int fatal[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT, SIGTERM, SIGINT };
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = logFatal;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_NODEFER;
+        for (size_t i = 0; i < sizeof(fatal) / sizeof(fatal[0]); i++)
+            sigaction(fatal[i], &sa, &log_old_actions[fatal[i]]);
+        atexit(logShutdown);
+        pthread_atfork(NULL, NULL, logAfterFork);
+        registered = true;
+    }
+    // resolved once, without TEST_OUT: the writer and logFatal() must not touch stdio
+    log_fd = fileno(test_out ? test_out : stdout);
+    bool ok = pthread_create(&log_thread, NULL, logWriter, NULL) == 0;
+    atomic_store(&log_state, ok ? LOG_RUNNING : LOG_SYNC);
+}
+
+/**
+ * @brief Copy an encoded message into the ring.
+ *
+ * @return false if the message was dropped.
+ */
+static bool logEnqueue(const char* buf, size_t len) {
+    uint64_t k = (len + TEST_LOG_PAYLOAD - 1) / TEST_LOG_PAYLOAD;
+    if (k > TEST_LOG_SLOTS) {
+        k = TEST_LOG_SLOTS;
+        len = (size_t)k * TEST_LOG_PAYLOAD;
+    }
+    uint64_t t = atomic_load_explicit(&log_tail, memory_order_relaxed);
+    for (;;) {
+        if (t + k - atomic_load_explicit(&log_head, memory_order_acquire) > TEST_LOG_SLOTS) {
+            if (log_config.mode == LOG_DROP || atomic_load(&log_state) != LOG_RUNNING) {
+                atomic_fetch_add(&log_dropped, 1);
+                return false;
+            }
+            logWake();
+            sched_yield();
+            t = atomic_load_explicit(&log_tail, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&log_tail, &t, t + k, memory_order_acq_rel,
+                                                  memory_order_relaxed))
+            break;
+    }
+    for (uint64_t i = 0; i < k; i++, buf += TEST_LOG_PAYLOAD, len -= TEST_LOG_PAYLOAD) {
+        LogSlot* s = &log_slots[(t + i) & (TEST_LOG_SLOTS - 1)];
+        s->len = (uint32_t)(len < TEST_LOG_PAYLOAD ? len : TEST_LOG_PAYLOAD);
+        memcpy(s->data, buf, s->len);
+        atomic_store_explicit(&s->seq, t + i + 1, memory_order_release);
+        if (len < TEST_LOG_PAYLOAD) break;
+    }
+    // a sleeping writer wakes by itself within TEST_LOG_LATENCY_MS; waking it per
+    // message would cost a context switch each, so only wake it for a full batch
+    if (t + k - atomic_load_explicit(&log_head, memory_order_relaxed) >= TEST_LOG_BATCH) logWake();
+    return true;
+}
+
+/**
+ * @brief Format a message and queue it for the writer thread.
+ *
+ * @param fmt The printf format.
+ * @param (optional) ... The arguments to format.
+ * @return The number of formatted bytes, or -1 if the message was dropped.
+ */
+int testLog(const char* fmt, ...) {
+    char stack[TEST_LOG_STACK];
+    char* buf = stack;
+    size_t pad = 2u * log_indent;
+    va_list ap, copy;
+    log_indent = 0;
+    if (pad > TEST_LOG_STACK / 2) pad = TEST_LOG_STACK / 2;
+    memset(buf, ' ', pad);
+    va_start(ap, fmt);
+    va_copy(copy, ap);
+    int n = vsnprintf(buf + pad, sizeof(stack) - pad, fmt, ap);
+    va_end(ap);
+    if (n >= 0 && pad + (size_t)n >= sizeof(stack)) {
+        buf = (char*)malloc(pad + (size_t)n + 1);
+        if (buf) {
+            memset(buf, ' ', pad);
+            vsnprintf(buf + pad, (size_t)n + 1, fmt, copy);
+        }
+    }
+    va_end(copy);
+    if (n < 0 || !buf) return -1;
+
+    int state = atomic_load(&log_state);
+    if (state == LOG_OFF || state == LOG_STARTING) {
+        logStart();
+        state = atomic_load(&log_state);
+    }
+    bool queued = true;
+    if (state == LOG_SYNC) {
+        struct iovec iov = { buf, pad + (size_t)n };
+        logWriteAll(log_fd, &iov, 1);
+    } else {
+        queued = logEnqueue(buf, pad + (size_t)n);
+    }
+    if (buf != stack) free(buf);
+    return queued ? n : -1;
+}
+
+/**
+ * @brief Wait until everything queued so far has been written.
+ */
+void testLogFlush(void) {
+    uint64_t t = atomic_load(&log_tail);
+    while (atomic_load(&log_state) == LOG_RUNNING && atomic_load(&log_head) < t) {
+        atomic_store(&log_sleeping, true);
+        logWake();
+        sched_yield();
+    }
+}
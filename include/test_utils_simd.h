@@ -0,0 +1,273 @@
+#pragma once
+/**
+ * @file test_utils_simd.h
+ *
+ * @brief Assertions on x86 SIMD vectors with per-lane diffs.
+ *
+ * @details
+ * This header provides the following assertions:
+ *
+ * - ASSERT_EQUAL_M128: Assert that two 128-bit vectors are equal.
+ * - ASSERT_EQUAL_M256: Assert that two 256-bit vectors are equal.
+ * - ASSERT_EQUAL_M512: Assert that two 512-bit vectors are equal.
+ *
+ * The operands may be of any vector type of the right size (`__m128i`,
+ * `__m256`, `__m512d`, ...) and are interpreted as lanes of U8, U16, U32,
+ * U64, F32 or F64. Integer lanes compare bitwise; float lanes compare
+ * numerically, except that NaN equals NaN.
+ *
+ * The comparison itself is vectorized: compare instructions and movemask
+ * (or AVX-512 mask registers) of the widest width the test is compiled for
+ * produce a bitmask of differing lanes. On failure both vectors are printed
+ * lane by lane, with the differing lanes reported through LOG_ERROR.
+ *
+ * @code
+ * __m256i got = shuffleBytes(v, ctl);
+ * ASSERT_EQUAL_M256(got, expected, U8, "shuffle with control %d", i);
+ * @endcode
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+#if !defined(__x86_64__) && !defined(__i386__)
+#error "test_utils_simd.h requires an x86 target"
+#endif
+
+#include <immintrin.h>
+#include <math.h>
+
+/* -- Assertions ----------------------------------------------------------*/
+
+/**
+ * @brief internal helper macro for vector assertions
+ *
+ * @param name The name of the assertion
+ * @param bytes The size of the vector type
+ * @param a The first vector
+ * @param b The second vector
+ * @param lane The lane type: U8, U16, U32, U64, F32 or F64
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_EQUAL_VEC__(name, bytes, a, b, lane, msg, ...)                                   \
+    do {                                                                                        \
+        __typeof__(a) _va = (a);                                                                \
+        __typeof__(b) _vb = (b);                                                                \
+        _Static_assert(sizeof(_va) == (bytes) && sizeof(_vb) == (bytes),                        \
+                       "ASSERT_EQUAL_" name " needs " #bytes "-byte vectors");                  \
+        uint64_t _diff = simdDiff(&_va, &_vb, (bytes), SIMD_##lane);                            \
+        if (_diff) {                                                                            \
+            failCase();                                                                         \
+            printIndent();                                                                      \
+            LOG_ERROR("ASSERT_EQUAL_" name ": %s != %s [%d of %u %s lanes differ] :: " msg "\n", \
+                      #a, #b, __builtin_popcountll(_diff),                                      \
+                      (unsigned)((bytes) / simd_lane_bytes[SIMD_##lane]), #lane, ##__VA_ARGS__); \
+            simdPrintLanes(&_va, &_vb, (bytes), SIMD_##lane, _diff);                            \
+        }                                                                                       \
+    } while (0)
+
+/**
+ * @brief Assert that two 128-bit vectors are equal lane by lane
+ *
+ * @param a The first vector
+ * @param b The second vector
+ * @param lane The lane type: U8, U16, U32, U64, F32 or F64
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_EQUAL_M128(a, b, lane, msg, ...) \
+    ASSERT_EQUAL_VEC__("M128", 16, a, b, lane, msg, ##__VA_ARGS__)
+
+/**
+ * @brief Assert that two 256-bit vectors are equal lane by lane
+ *
+ * @param a The first vector
+ * @param b The second vector
+ * @param lane The lane type: U8, U16, U32, U64, F32 or F64
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_EQUAL_M256(a, b, lane, msg, ...) \
+    ASSERT_EQUAL_VEC__("M256", 32, a, b, lane, msg, ##__VA_ARGS__)
+
+/**
+ * @brief Assert that two 512-bit vectors are equal lane by lane
+ *
+ * @param a The first vector
+ * @param b The second vector
+ * @param lane The lane type: U8, U16, U32, U64, F32 or F64
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_EQUAL_M512(a, b, lane, msg, ...) \
+    ASSERT_EQUAL_VEC__("M512", 64, a, b, lane, msg, ##__VA_ARGS__)
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief How the bytes of a vector are split into lanes.
+ */
+typedef enum {
+    SIMD_U8,
+    SIMD_U16,
+    SIMD_U32,
+    SIMD_U64,
+    SIMD_F32,
+    SIMD_F64,
+} SimdLane;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+const uint8_t simd_lane_bytes[] = { 1, 2, 4, 8, 4, 8 };
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Turn a mask of differing bytes into a mask of differing lanes.
+ *
+ * @param bytes One bit per byte, set where the bytes differ.
+ * @param n The number of bytes covered by the mask.
+ * @param w The lane width in bytes.
+ */
+static inline uint64_t simdLanesFromBytes(uint64_t bytes, unsigned n, unsigned w) {
+    if (w == 1) return bytes;
+    uint64_t lanes = 0, all = (1ull << w) - 1;
+    for (unsigned i = 0; i < n / w; i++)
+        if ((bytes >> (i * w)) & all) lanes |= 1ull << i;
+    return lanes;
+}
+
+/**
+ * @brief Compare two vectors lane by lane.
+ *
+ * @param a The first vector.
+ * @param b The second vector.
+ * @param bytes The size of the vectors (at most 64).
+ * @param lane The lane type.
+ * @return One bit per lane, set where the lanes differ.
+ */
+uint64_t simdDiff(const void* a, const void* b, size_t bytes, SimdLane lane) {
+    const unsigned char* pa = (const unsigned char*)a;
+    const unsigned char* pb = (const unsigned char*)b;
+    unsigned w = simd_lane_bytes[lane];
+    uint64_t diff = 0;
+    size_t off = 0;
+#ifdef __AVX512BW__
+    for (; off + 64 <= bytes; off += 64) {
+        __m512i x = _mm512_loadu_si512((const void*)(pa + off)), y = _mm512_loadu_si512((const void*)(pb + off));
+        uint64_t m;
+        if (lane == SIMD_F32) {
+            __m512 fx = _mm512_castsi512_ps(x), fy = _mm512_castsi512_ps(y);
+            m = (uint16_t)~(_mm512_cmp_ps_mask(fx, fy, _CMP_EQ_OQ) |
+                            (_mm512_cmp_ps_mask(fx, fx, _CMP_UNORD_Q) & _mm512_cmp_ps_mask(fy, fy, _CMP_UNORD_Q)));
+        } else if (lane == SIMD_F64) {
+            __m512d dx = _mm512_castsi512_pd(x), dy = _mm512_castsi512_pd(y);
+            m = (uint8_t)~(_mm512_cmp_pd_mask(dx, dy, _CMP_EQ_OQ) |
+                           (_mm512_cmp_pd_mask(dx, dx, _CMP_UNORD_Q) & _mm512_cmp_pd_mask(dy, dy, _CMP_UNORD_Q)));
+        } else {
+            m = simdLanesFromBytes(~(uint64_t)_mm512_cmpeq_epi8_mask(x, y), 64, w);
+        }
+        diff |= m << (off / w);
+    }
+#endif
+#ifdef __AVX2__
+    for (; off + 32 <= bytes; off += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(pa + off)), y = _mm256_loadu_si256((const __m256i*)(pb + off));
+        uint64_t m;
+        if (lane == SIMD_F32) {
+            __m256 fx = _mm256_castsi256_ps(x), fy = _mm256_castsi256_ps(y);
+            __m256 eq = _mm256_or_ps(_mm256_cmp_ps(fx, fy, _CMP_EQ_OQ),
+                                     _mm256_and_ps(_mm256_cmp_ps(fx, fx, _CMP_UNORD_Q), _mm256_cmp_ps(fy, fy, _CMP_UNORD_Q)));
+            m = ~(unsigned)_mm256_movemask_ps(eq) & 0xFFu;
+        } else if (lane == SIMD_F64) {
+            __m256d dx = _mm256_castsi256_pd(x), dy = _mm256_castsi256_pd(y);
+            __m256d eq = _mm256_or_pd(_mm256_cmp_pd(dx, dy, _CMP_EQ_OQ),
+                                      _mm256_and_pd(_mm256_cmp_pd(dx, dx, _CMP_UNORD_Q), _mm256_cmp_pd(dy, dy, _CMP_UNORD_Q)));
+            m = ~(unsigned)_mm256_movemask_pd(eq) & 0xFu;
+        } else {
+            m = simdLanesFromBytes(~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) & 0xFFFFFFFFull, 32, w);
+        }
+        diff |= m << (off / w);
+    }
+#endif
+#ifdef __SSE2__
+    for (; off + 16 <= bytes; off += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(pa + off)), y = _mm_loadu_si128((const __m128i*)(pb + off));
+        uint64_t m;
+        if (lane == SIMD_F32) {
+            __m128 fx = _mm_castsi128_ps(x), fy = _mm_castsi128_ps(y);
+            __m128 eq = _mm_or_ps(_mm_cmpeq_ps(fx, fy), _mm_and_ps(_mm_cmpunord_ps(fx, fx), _mm_cmpunord_ps(fy, fy)));
+            m = ~(unsigned)_mm_movemask_ps(eq) & 0xFu;
+        } else if (lane == SIMD_F64) {
+            __m128d dx = _mm_castsi128_pd(x), dy = _mm_castsi128_pd(y);
+            __m128d eq = _mm_or_pd(_mm_cmpeq_pd(dx, dy), _mm_and_pd(_mm_cmpunord_pd(dx, dx), _mm_cmpunord_pd(dy, dy)));
+            m = ~(unsigned)_mm_movemask_pd(eq) & 0x3u;
+        } else {
+            m = simdLanesFromBytes(~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFFu, 16, w);
+        }
+        diff |= m << (off / w);
+    }
+#endif
+    for (; off + w <= bytes; off += w) { // targets without SSE2
+        bool differs;
+        if (lane == SIMD_F32) {
+            float x, y;
+            memcpy(&x, pa + off, 4);
+            memcpy(&y, pb + off, 4);
+            differs = !(x == y || (isnan(x) && isnan(y)));
+        } else if (lane == SIMD_F64) {
+            double x, y;
+            memcpy(&x, pa + off, 8);
+            memcpy(&y, pb + off, 8);
+            differs = !(x == y || (isnan(x) && isnan(y)));
+        } else {
+            differs = memcmp(pa + off, pb + off, w) != 0;
+        }
+        if (differs) diff |= 1ull << (off / w);
+    }
+    return diff;
+}
+
+/**
+ * @brief Format one lane.
+ */
+static void simdFormatLane(char* buf, size_t len, const unsigned char* p, SimdLane lane) {
+    uint64_t u = 0;
+    if (lane == SIMD_F32) {
+        float f;
+        memcpy(&f, p, 4);
+        snprintf(buf, len, "%.9g", f);
+    } else if (lane == SIMD_F64) {
+        double d;
+        memcpy(&d, p, 8);
+        snprintf(buf, len, "%.17g", d);
+    } else {
+        memcpy(&u, p, simd_lane_bytes[lane]); // little endian
+        snprintf(buf, len, "%llu (0x%0*llx)", (unsigned long long)u, 2 * simd_lane_bytes[lane], (unsigned long long)u);
+    }
+}
+
+/**
+ * @brief Print two vectors lane by lane, reporting the differing lanes as errors.
+ *
+ * @param a The first vector.
+ * @param b The second vector.
+ * @param bytes The size of the vectors.
+ * @param lane The lane type.
+ * @param diff The differing lanes, from simdDiff().
+ */
+void simdPrintLanes(const void* a, const void* b, size_t bytes, SimdLane lane, uint64_t diff) {
+    unsigned w = simd_lane_bytes[lane];
+    char x[48], y[48];
+    depth++;
+    for (unsigned i = 0; i < bytes / w; i++) {
+        simdFormatLane(x, sizeof(x), (const unsigned char*)a + i * w, lane);
+        simdFormatLane(y, sizeof(y), (const unsigned char*)b + i * w, lane);
+        printIndent();
+        if (diff >> i & 1) LOG_ERROR("lane %2u: %26s != %s\n", i, x, y);
+        else MSG(RESET, "lane %2u: %26s == %s\n", i, x, y);
+    }
+    depth--;
+}
@@ -0,0 +1,327 @@
+#pragma once
+/**
+ * @file test_utils_smoke.h
+ *
+ * @brief Time-budgeted smoke mode choosing tests by failure history and duration.
+ *
+ * @details
+ * Tests registered with SMOKE_EVAL(fn) are run by smokeRun() with the same
+ * output as TEST_EVAL. Every run records each test's duration and whether it
+ * failed in a small history file (`TEST_SMOKE_DB`, default "test_smoke.db"),
+ * as exponentially decayed counts, so recent behaviour dominates.
+ *
+ * Without a budget every test runs in registration order. With a budget in
+ * seconds (`smoke_config.budget_s` or `TEST_SMOKE_BUDGET`), the tests to run
+ * are chosen by a 0/1 knapsack over time, solved by dynamic programming on
+ * TEST_SMOKE_BUCKETS time buckets. It maximizes the sum of each test's
+ * estimated failure probability `(fails + 0.05) / (runs + 1)` within the
+ * budget. Tests with no history count as certain to fail, so new tests always
+ * run if they fit. The chosen tests run in decreasing order of failure
+ * probability per second, and the skipped ones are listed at the end.
+ *
+ * @code
+ * int main(void) {
+ *     SMOKE_EVAL(testParse);
+ *     SMOKE_EVAL(testRoundTrip);
+ *     smokeRun();
+ *     return testGetStatus();
+ * }
+ * @endcode
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_clock.h"
+
+#include <math.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_SMOKE_MAX
+#define TEST_SMOKE_MAX 1024 // registered tests and history entries
+#endif
+
+#ifndef TEST_SMOKE_BUCKETS
+#define TEST_SMOKE_BUCKETS 1000 // time resolution of the knapsack
+#endif
+
+#define TEST_SMOKE_NAME 96
+
+/**
+ * @brief Register a test function for smokeRun().
+ *
+ * @param fn The test function, `void fn(void)`.
+ */
+#define SMOKE_EVAL(fn) smokeAdd(#fn, fn)
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief A test function.
+ */
+typedef void (*SmokeFn)(void);
+
+/**
+ * @brief Smoke mode configuration.
+ */
+typedef struct {
+    double budget_s;    // time budget in seconds, 0 to run everything.
+    double decay;       // weight of the existing history when a run is recorded.
+    const char* db;     // history file, NULL for TEST_SMOKE_DB or "test_smoke.db".
+} SmokeConfig;
+
+/**
+ * @brief The recorded history of a test.
+ */
+typedef struct {
+    char name[TEST_SMOKE_NAME];
+    double runs;        // decayed number of runs.
+    double fails;       // decayed number of failed runs.
+    double ns;          // decayed mean duration in ns.
+} SmokeHistory;
+
+/**
+ * @brief A registered test.
+ */
+typedef struct {
+    const char* name;
+    SmokeFn fn;
+    SmokeHistory* history;  // NULL if the test has never run.
+    double p;               // estimated failure probability.
+    double ns;              // estimated duration.
+    bool selected;
+} SmokeTest;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+SmokeConfig smoke_config = {
+    .budget_s = 0,
+    .decay = 0.9,
+    .db = NULL,
+};
+
+SmokeTest smoke_tests[TEST_SMOKE_MAX];
+uint16_t smoke_test_count = 0;
+SmokeHistory smoke_history[TEST_SMOKE_MAX];
+uint16_t smoke_history_count = 0;
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Register a test function.
+ *
+ * @return false if the registry is full.
+ */
+bool smokeAdd(const char* name, SmokeFn fn) {
+    if (smoke_test_count >= TEST_SMOKE_MAX) return false;
+    smoke_tests[smoke_test_count].name = name;
+    smoke_tests[smoke_test_count].fn = fn;
+    smoke_test_count++;
+    return true;
+}
+
+/**
+ * @brief The history file path.
+ */
+static const char* smokeDb(void) {
+    const char* db = smoke_config.db;
+    if (!db || !*db) db = getenv("TEST_SMOKE_DB");
+    return db && *db ? db : "test_smoke.db";
+}
+
+/**
+ * @brief Load the history file, keeping entries of tests this binary does not register.
+ */
+static void smokeLoad(void) {
+    char line[256];
+    smoke_history_count = 0;
+    FILE* f = fopen(smokeDb(), "r");
+    while (f && smoke_history_count < TEST_SMOKE_MAX && fgets(line, sizeof(line), f)) {
+        SmokeHistory* h = &smoke_history[smoke_history_count];
+        if (sscanf(line, "%95s %lf %lf %lf", h->name, &h->runs, &h->fails, &h->ns) == 4) smoke_history_count++;
+    }
+    if (f) fclose(f);
+}
+
+/**
+ * @brief Write the history file through a temporary file and rename.
+ */
+static bool smokeSave(void) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.%d", smokeDb(), (int)getpid());
+    FILE* f = fopen(tmp, "w");
+    if (!f) return false;
+    for (uint16_t i = 0; i < smoke_history_count; i++) {
+        const SmokeHistory* h = &smoke_history[i];
+        fprintf(f, "%s %.6f %.6f %.0f\n", h->name, h->runs, h->fails, h->ns);
+    }
+    bool ok = fclose(f) == 0 && rename(tmp, smokeDb()) == 0;
+    if (!ok) unlink(tmp);
+    return ok;
+}
+
+/**
+ * @brief Record a run of a test in its history.
+ */
+static void smokeRecord(SmokeTest* t, double ns, bool failed) {
+    SmokeHistory* h = t->history;
+    if (!h) {
+        if (smoke_history_count >= TEST_SMOKE_MAX) return;
+        h = t->history = &smoke_history[smoke_history_count++];
+        memset(h, 0, sizeof(SmokeHistory));
+        snprintf(h->name, sizeof(h->name), "%s", t->name);
+        h->ns = ns;
+    }
+    double d = smoke_config.decay;
+    h->runs = h->runs * d + 1;
+    h->fails = h->fails * d + (failed ? 1 : 0);
+    h->ns = h->ns * d + ns * (1 - d);
+}
+
+/**
+ * @brief qsort comparator for doubles, ascending.
+ */
+static int smokeCmpDouble(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Order by failure probability per second, highest first.
+ */
+static int smokeCmp(const void* a, const void* b) {
+    const SmokeTest* x = *(const SmokeTest* const*)a;
+    const SmokeTest* y = *(const SmokeTest* const*)b;
+    double rx = x->p / (x->ns + 1), ry = y->p / (y->ns + 1);
+    return (rx < ry) - (rx > ry);
+}
+
+/**
+ * @brief Choose the tests maximizing expected failures within the budget (0/1 knapsack).
+ *
+ * @return The expected number of failures of the chosen tests.
+ */
+static double smokeSelect(double budget_ns) {
+    const uint32_t W = TEST_SMOKE_BUCKETS;
+    double unit = budget_ns / W;
+    uint16_t n = smoke_test_count;
+    double* best = (double*)calloc(W + 1, sizeof(double));
+    uint8_t* take = (uint8_t*)calloc((size_t)n * (W + 1), 1);
+    double expected = 0;
+    if (!best || !take) { // no memory: greedy by probability per second
+        double used = 0;
+        SmokeTest* order[TEST_SMOKE_MAX];
+        for (uint16_t i = 0; i < n; i++) order[i] = &smoke_tests[i];
+        qsort(order, n, sizeof(SmokeTest*), smokeCmp);
+        for (uint16_t i = 0; i < n; i++) {
+            if (used + order[i]->ns > budget_ns) continue;
+            used += order[i]->ns;
+            order[i]->selected = true;
+            expected += order[i]->p;
+        }
+        free(best);
+        free(take);
+        return expected;
+    }
+    for (uint16_t i = 0; i < n; i++) {
+        double w = ceil(smoke_tests[i].ns / unit);
+        if (w > W) continue;
+        for (uint32_t c = W; c >= (uint32_t)w; c--) {
+            double v = best[c - (uint32_t)w] + smoke_tests[i].p;
+            if (v > best[c]) {
+                best[c] = v;
+                take[(size_t)i * (W + 1) + c] = 1;
+            }
+            if (c == 0) break;
+        }
+    }
+    for (uint32_t c = W, i = n; i-- > 0; ) {
+        if (!take[(size_t)i * (W + 1) + c]) continue;
+        smoke_tests[i].selected = true;
+        expected += smoke_tests[i].p;
+        c -= (uint32_t)ceil(smoke_tests[i].ns / unit);
+    }
+    free(best);
+    free(take);
+    return expected;
+}
+
+/**
+ * @brief Run the registered tests, within the budget if one is set, and record their history.
+ */
+void smokeRun(void) {
+    static SmokeTest* order[TEST_SMOKE_MAX];
+    const char* env = getenv("TEST_SMOKE_BUDGET");
+    double budget_s = env && *env ? atof(env) : smoke_config.budget_s;
+    smokeLoad();
+
+    // estimate each test from its history
+    double known_ns[TEST_SMOKE_MAX], fallback_ns = 1e9;
+    uint16_t known = 0;
+    for (uint16_t i = 0; i < smoke_test_count; i++) {
+        SmokeTest* t = &smoke_tests[i];
+        t->history = NULL;
+        t->selected = budget_s <= 0;
+        for (uint16_t j = 0; j < smoke_history_count; j++)
+            if (strcmp(smoke_history[j].name, t->name) == 0) t->history = &smoke_history[j];
+        if (t->history) known_ns[known++] = t->history->ns;
+    }
+    if (known) { // unknown tests are assumed to take the median known duration
+        qsort(known_ns, known, sizeof(double), smokeCmpDouble);
+        fallback_ns = known_ns[known / 2];
+    }
+    double total_p = 0, total_ns = 0;
+    for (uint16_t i = 0; i < smoke_test_count; i++) {
+        SmokeTest* t = &smoke_tests[i];
+        t->p = t->history ? (t->history->fails + 0.05) / (t->history->runs + 1) : 1.0;
+        t->ns = t->history ? t->history->ns : fallback_ns;
+        total_p += t->p;
+        total_ns += t->ns;
+    }
+
+    uint16_t n = 0;
+    double expected = total_p;
+    if (budget_s > 0) {
+        expected = smokeSelect(budget_s * 1e9);
+        for (uint16_t i = 0; i < smoke_test_count; i++)
+            if (smoke_tests[i].selected) order[n++] = &smoke_tests[i];
+        qsort(order, n, sizeof(SmokeTest*), smokeCmp);
+        char b[16], all[16];
+        MSG(BLUE, "smoke: %u of %u tests in a %s budget (suite ~%s), %.0f%% of expected failures\n", n,
+            smoke_test_count, testFormatNs(b, sizeof(b), budget_s * 1e9), testFormatNs(all, sizeof(all), total_ns),
+            total_p > 0 ? 100.0 * expected / total_p : 100.0);
+    } else {
+        for (uint16_t i = 0; i < smoke_test_count; i++) order[n++] = &smoke_tests[i];
+    }
+
+    uint64_t start = testClockNs();
+    for (uint16_t i = 0; i < n; i++) {
+        SmokeTest* t = order[i];
+        if (!testEvalEnter(t->name)) continue;
+        bool failed_before = test_failed;
+        test_failed = false;
+        uint64_t t0 = testClockNs();
+        MSG(MAGENTA, "%s():\n", t->name);
+        depth++;
+        t->fn();
+        depth--;
+        testEvalLeave();
+        if (!test_eval_only) smokeRecord(t, (double)(testClockNs() - t0), test_failed);
+        test_failed = test_failed || failed_before;
+    }
+    if (budget_s > 0) {
+        char took[16], est[16];
+        MSG(BLUE, "smoke: ran %u tests in %s\n", n, testFormatNs(took, sizeof(took), (double)(testClockNs() - start)));
+        depth++;
+        for (uint16_t i = 0; i < smoke_test_count; i++) {
+            const SmokeTest* t = &smoke_tests[i];
+            if (t->selected) continue;
+            printIndent();
+            MSG(YELLOW, "skipped: %s (p=%.3f, ~%s)\n", t->name, t->p, testFormatNs(est, sizeof(est), t->ns));
+        }
+        depth--;
+    }
+    if (!test_eval_only && !smokeSave()) LOG_WARN("SMOKE: cannot write %s\n", smokeDb());
+}
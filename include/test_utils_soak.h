@@ -0,0 +1,332 @@
+#pragma once
+/**
+ * @file test_utils_soak.h
+ *
+ * @brief Soak (endurance) mode for test functions.
+ *
+ * @details
+ * SOAK_EVAL(fn) is a drop-in replacement for TEST_EVAL(fn). By default it runs
+ * the function once. When soak mode is enabled, either by setting
+ * `soak_config.seconds` or the `TEST_SOAK_SECONDS` environment variable, the
+ * function is looped for that duration instead:
+ *
+ * - The first iteration prints its output as usual, later iterations are quiet.
+ * - RSS, heap statistics (mallinfo2) and per-iteration latency are sampled
+ *   into a fixed series of TEST_SOAK_POINTS points, independent of duration.
+ * - After a warm-up fraction, a Theil-Sen trend is fitted to each series and
+ *   the test fails when RSS or heap growth, or latency drift, exceeds the
+ *   configured slope. Growth that stays within the configured noise floor over
+ *   the fitted window never fails, so short runs are not judged on jitter.
+ *
+ * Only a bounded summary is printed: totals, start/end values, slopes and a
+ * short sparkline per series.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_clock.h"
+
+#include <malloc.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_SOAK_POINTS
+#define TEST_SOAK_POINTS 256 // samples kept per soak run
+#endif
+
+#ifndef TEST_SOAK_SPARK
+#define TEST_SOAK_SPARK 32 // width of the summary sparklines
+#endif
+
+/**
+ * @brief Loop a test function in soak mode (or run it once when soak mode is off).
+ *
+ * @param arg The test function to evaluate.
+ */
+#define SOAK_EVAL(arg)                      \
+    if (testEvalEnter(#arg)) {              \
+        MSG(MAGENTA, "%s():\n", #arg);      \
+        depth++;                            \
+        soakRun(arg);                       \
+        depth--;                            \
+        testEvalLeave();                    \
+    }
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Soak mode configuration.
+ */
+typedef struct {
+    double seconds;             // soak duration, 0 to run once (TEST_SOAK_SECONDS overrides).
+    double warmup;              // leading fraction of the run excluded from the trends.
+    double max_rss_slope;       // allowed RSS growth in bytes per hour.
+    double max_heap_slope;      // allowed in-use heap growth in bytes per hour.
+    double max_latency_drift;   // allowed latency drift as a fraction of the initial latency per hour.
+    double rss_noise;           // RSS growth in bytes over the run that is never reported.
+    double heap_noise;          // heap growth in bytes over the run that is never reported.
+    double latency_noise;       // latency drift fraction over the run that is never reported.
+} SoakConfig;
+
+/**
+ * @brief One point of the soak time series.
+ */
+typedef struct {
+    double t;           // seconds since the start of the run.
+    double latency;     // mean iteration latency since the previous point, in ns.
+    double max_latency; // max iteration latency since the previous point, in ns.
+    double rss;         // resident set size in bytes.
+    double heap_used;   // allocated heap bytes.
+    double heap_mapped; // heap bytes obtained from the system.
+} SoakPoint;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+SoakConfig soak_config = {
+    .seconds = 0,
+    .warmup = 0.1,
+    .max_rss_slope = 1024.0 * 1024.0,
+    .max_heap_slope = 1024.0 * 1024.0,
+    .max_latency_drift = 0.05,
+    .rss_noise = 256.0 * 1024.0,
+    .heap_noise = 64.0 * 1024.0,
+    .latency_noise = 0.10,
+};
+
+SoakPoint soak_points[TEST_SOAK_POINTS]; // series of the last soak run.
+uint16_t soak_point_count = 0; // number of valid points in soak_points.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Read the resident set size of the process in bytes.
+ */
+static double soakRss(void) {
+    FILE* f = fopen("/proc/self/statm", "r");
+    unsigned long size = 0, resident = 0;
+    if (!f) return 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return (double)resident * (double)sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * @brief Read the in-use and mapped heap size in bytes.
+ */
+static void soakHeap(double* used, double* mapped) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+#else
+    struct mallinfo mi = mallinfo();
+#endif
+    *used = (double)mi.uordblks + (double)mi.hblkhd;
+    *mapped = (double)mi.arena + (double)mi.hblkhd;
+}
+
+/**
+ * @brief Select the k-th smallest value (destructive, three-way quickselect).
+ */
+static double soakSelect(double* v, size_t n, size_t k) {
+    long lo = 0, hi = (long)n - 1;
+    while (lo < hi) {
+        double pivot = v[lo + (hi - lo) / 2];
+        long lt = lo, gt = hi, i = lo;
+        while (i <= gt) {
+            double t = v[i];
+            if (t < pivot) {
+                v[i++] = v[lt];
+                v[lt++] = t;
+            } else if (t > pivot) {
+                v[i] = v[gt];
+                v[gt--] = t;
+            } else {
+                i++;
+            }
+        }
+        if ((long)k < lt) hi = lt - 1;
+        else if ((long)k > gt) lo = gt + 1;
+        else return pivot;
+    }
+    return v[k];
+}
+
+/**
+ * @brief Fit a Theil-Sen line through a soak series.
+ *
+ * @param first The first point to include.
+ * @param field Offset of the field within SoakPoint.
+ * @param intercept Receives the value of the line at the first point.
+ * @return The slope per second.
+ */
+static double soakTrend(uint16_t first, size_t field, double* intercept) {
+    static double slopes[TEST_SOAK_POINTS * (TEST_SOAK_POINTS - 1) / 2];
+    static double values[TEST_SOAK_POINTS];
+    size_t n = 0, count = soak_point_count - first;
+#define SOAK_FIELD(i) (*(const double*)((const char*)&soak_points[i] + field))
+    *intercept = count ? SOAK_FIELD(first) : 0;
+    if (count < 2) return 0;
+    for (uint16_t i = first; i < soak_point_count; i++)
+        for (uint16_t j = i + 1; j < soak_point_count; j++)
+            if (soak_points[j].t > soak_points[i].t)
+                slopes[n++] = (SOAK_FIELD(j) - SOAK_FIELD(i)) / (soak_points[j].t - soak_points[i].t);
+    if (!n) return 0;
+    double slope = soakSelect(slopes, n, n / 2);
+    for (uint16_t i = first; i < soak_point_count; i++)
+        values[i - first] = SOAK_FIELD(i) - slope * (soak_points[i].t - soak_points[first].t);
+    *intercept = soakSelect(values, count, count / 2);
+#undef SOAK_FIELD
+    return slope;
+}
+
+/**
+ * @brief Format a byte count with a binary unit.
+ */
+static char* soakBytes(char* buf, size_t len, double bytes) {
+    const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    int u = 0;
+    double mag = bytes < 0 ? -bytes : bytes;
+    while (mag >= 1024.0 && u < 4) {
+        mag /= 1024.0;
+        bytes /= 1024.0;
+        u++;
+    }
+    snprintf(buf, len, "%.3g%s", bytes, units[u]);
+    return buf;
+}
+
+/**
+ * @brief Print a fixed-width sparkline of a soak series.
+ */
+static void soakSpark(const char* label, size_t field) {
+    static const char ramp[] = " .:-=+*#%@";
+    char line[TEST_SOAK_SPARK + 1];
+    double lo = 0, hi = 0, v[TEST_SOAK_SPARK];
+    int width = soak_point_count < TEST_SOAK_SPARK ? soak_point_count : TEST_SOAK_SPARK;
+    for (int c = 0; c < width; c++) {
+        uint16_t a = (uint16_t)(c * soak_point_count / width);
+        uint16_t b = (uint16_t)((c + 1) * soak_point_count / width);
+        double sum = 0;
+        for (uint16_t i = a; i < b; i++) sum += *(const double*)((const char*)&soak_points[i] + field);
+        v[c] = sum / (b - a);
+        if (c == 0 || v[c] < lo) lo = v[c];
+        if (c == 0 || v[c] > hi) hi = v[c];
+    }
+    for (int c = 0; c < width; c++)
+        line[c] = ramp[hi > lo ? (int)((v[c] - lo) / (hi - lo) * 9.0 + 0.5) : 0];
+    line[width] = '\0';
+    printIndent();
+    MSG(CYAN, "  %-8s |%s|\n", label, line);
+}
+
+/**
+ * @brief Check a trend against its limit and report it.
+ *
+ * @return true if the limit was exceeded.
+ */
+static bool soakCheck(const char* what, const char* value, const char* limit, bool exceeded) {
+    printIndent();
+    if (exceeded) LOG_ERROR("SOAK: %s %s/h exceeds %s/h\n", what, value, limit);
+    else MSG(CYAN, "  %-8s %s/h (limit %s/h)\n", what, value, limit);
+    return exceeded;
+}
+
+/**
+ * @brief Run a test function in soak mode and report the bounded summary.
+ *
+ * @param fn The test function to loop.
+ */
+void soakRun(void (*fn)(void)) {
+    double seconds = soak_config.seconds;
+    const char* env = getenv("TEST_SOAK_SECONDS");
+    if (env && *env) seconds = atof(env);
+    if (seconds <= 0) {
+        fn();
+        return;
+    }
+
+    bool saved_failed = test_failed, saved_quiet = test_quiet;
+    uint64_t iterations = 0, failures = 0, first_failure = 0;
+    uint64_t start = testClockNs();
+    uint64_t end = start + (uint64_t)(seconds * 1e9);
+    uint64_t interval = (end - start) / TEST_SOAK_POINTS;
+    uint64_t next_sample = start, lat_sum = 0, lat_max = 0, lat_n = 0;
+    soak_point_count = 0;
+
+    for (uint64_t now = start; now < end || soak_point_count == 0; ) {
+        test_failed = false;
+        uint64_t t0 = testClockNs();
+        fn();
+        now = testClockNs();
+        test_quiet = true;
+        uint64_t lat = now - t0;
+        iterations++;
+        if (test_failed && !failures++) first_failure = iterations;
+        lat_sum += lat;
+        lat_n++;
+        if (lat > lat_max) lat_max = lat;
+
+        if (now >= next_sample && soak_point_count < TEST_SOAK_POINTS) {
+            SoakPoint* p = &soak_points[soak_point_count++];
+            p->t = (double)(now - start) / 1e9;
+            p->latency = (double)lat_sum / (double)lat_n;
+            p->max_latency = (double)lat_max;
+            p->rss = soakRss();
+            soakHeap(&p->heap_used, &p->heap_mapped);
+            lat_sum = lat_max = lat_n = 0;
+            next_sample += interval;
+            if (next_sample < now) next_sample = now + interval / 2;
+        }
+    }
+    test_quiet = saved_quiet;
+    test_failed = saved_failed || failures;
+
+    uint16_t first = 0;
+    while (first + 2 < soak_point_count && soak_points[first].t < soak_config.warmup * seconds) first++;
+    double rss0, heap0, lat0, mapped0;
+    double rss_slope = soakTrend(first, offsetof(SoakPoint, rss), &rss0) * 3600.0;
+    double heap_slope = soakTrend(first, offsetof(SoakPoint, heap_used), &heap0) * 3600.0;
+    double mapped_slope = soakTrend(first, offsetof(SoakPoint, heap_mapped), &mapped0) * 3600.0;
+    double lat_slope = soakTrend(first, offsetof(SoakPoint, latency), &lat0) * 3600.0;
+    double drift = lat0 > 0 ? lat_slope / lat0 : 0;
+    const SoakPoint* last = &soak_points[soak_point_count - 1];
+    double window = (last->t - soak_points[first].t) / 3600.0; // fitted hours
+
+    char a[16], b[16], c[16], d[16], e[16];
+    printIndent();
+    MSG(BLUE, "soak: " RESET "%llu iterations in %.1fs, %u samples (%.1fs warm-up excluded)\n",
+        (unsigned long long)iterations, (double)(testClockNs() - start) / 1e9, soak_point_count,
+        soak_points[first].t);
+    if (failures) {
+        printIndent();
+        LOG_ERROR("SOAK: %llu failing iterations, first at iteration %llu\n",
+                  (unsigned long long)failures, (unsigned long long)first_failure);
+    }
+    printIndent();
+    MSG(CYAN, "  rss      %s -> %s\n", soakBytes(a, sizeof(a), soak_points[first].rss), soakBytes(b, sizeof(b), last->rss));
+    printIndent();
+    MSG(CYAN, "  heap     %s -> %s in use, %s -> %s mapped (%s/h)\n",
+        soakBytes(a, sizeof(a), soak_points[first].heap_used), soakBytes(b, sizeof(b), last->heap_used),
+        soakBytes(c, sizeof(c), soak_points[first].heap_mapped), soakBytes(d, sizeof(d), last->heap_mapped),
+        soakBytes(e, sizeof(e), mapped_slope));
+    printIndent();
+    MSG(CYAN, "  latency  %s -> %s mean, %s max\n", testFormatNs(a, sizeof(a), soak_points[first].latency),
+        testFormatNs(b, sizeof(b), last->latency), testFormatNs(c, sizeof(c), last->max_latency));
+
+    bool failed = false;
+    failed |= soakCheck("rss", soakBytes(a, sizeof(a), rss_slope),
+                        soakBytes(b, sizeof(b), soak_config.max_rss_slope),
+                        rss_slope > soak_config.max_rss_slope && rss_slope * window > soak_config.rss_noise);
+    failed |= soakCheck("heap", soakBytes(a, sizeof(a), heap_slope),
+                        soakBytes(b, sizeof(b), soak_config.max_heap_slope),
+                        heap_slope > soak_config.max_heap_slope && heap_slope * window > soak_config.heap_noise);
+    snprintf(a, sizeof(a), "%+.2f%%", drift * 100.0);
+    snprintf(b, sizeof(b), "%.2f%%", soak_config.max_latency_drift * 100.0);
+    failed |= soakCheck("drift", a, b,
+                        drift > soak_config.max_latency_drift && drift * window > soak_config.latency_noise);
+    soakSpark("rss", offsetof(SoakPoint, rss));
+    soakSpark("heap", offsetof(SoakPoint, heap_used));
+    soakSpark("latency", offsetof(SoakPoint, latency));
+    if (failed) failTest();
+}
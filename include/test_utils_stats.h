@@ -0,0 +1,493 @@
+#pragma once
+/**
+ * @file test_utils_stats.h
+ *
+ * @brief Streaming statistics and distribution assertions.
+ *
+ * @details
+ * This header provides the following O(1) memory accumulators:
+ *
+ * - StatMoments: Count, mean, variance (Welford), min and max.
+ * - StatP2: A single quantile estimated with the P-square algorithm.
+ * - StatHist: A histogram with fixed bins over [lo, hi) plus under/overflow.
+ *
+ * Each has a statXxxMerge() function, so threads can accumulate privately and
+ * combine at the end. Moments and histograms merge exactly; P-square merges
+ * approximately by inverting the mixture of the two marker CDFs.
+ *
+ * The following assertions test at significance `stat_alpha`:
+ *
+ * - ASSERT_UNIFORM_CHI2: Pearson's chi-square test of a histogram against
+ *   the uniform distribution over its bins.
+ * - ASSERT_KS_MATCHES: Kolmogorov-Smirnov test of a histogram against a CDF.
+ *   The statistic is evaluated at the bin edges, so it can only see
+ *   deviations the bins resolve and errs towards passing.
+ * - ASSERT_MEAN_WITHIN: Fails when the confidence interval of the mean lies
+ *   entirely outside expected +- tolerance.
+ *
+ * A correct implementation still fails a test with probability `stat_alpha`,
+ * so keep it small (the default is 1e-3) and the seeds fixed.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+#include <math.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_STATS_MAX_BINS
+#define TEST_STATS_MAX_BINS 1024 // bins per histogram
+#endif
+
+/* -- Assertions ----------------------------------------------------------*/
+
+/**
+ * @brief Assert that a histogram is consistent with a uniform distribution over its bins
+ *
+ * Samples outside [lo, hi) always fail the assertion.
+ *
+ * @param hist The StatHist
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_UNIFORM_CHI2(hist, msg, ...)                                                         \
+    do {                                                                                            \
+        double _chi2, _p = statChi2Uniform(hist, &_chi2);                                           \
+        if (_p < stat_alpha) {                                                                      \
+            failCase();                                                                             \
+            printIndent();                                                                          \
+            LOG_ERROR("ASSERT_UNIFORM_CHI2: %s [chi2 %.2f, df %u, p %.3g < %.3g] :: " msg "\n",     \
+                      #hist, _chi2, (hist)->bins - 1, _p, stat_alpha, ##__VA_ARGS__);               \
+        }                                                                                           \
+    } while (0)
+
+/**
+ * @brief Assert that a histogram is consistent with a distribution (Kolmogorov-Smirnov)
+ *
+ * @param hist The StatHist
+ * @param cdf The expected CDF, `double cdf(double x)`
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_KS_MATCHES(hist, cdf, msg, ...)                                                      \
+    do {                                                                                            \
+        double _d, _p = statKsHist(hist, cdf, &_d);                                                 \
+        if (_p < stat_alpha) {                                                                      \
+            failCase();                                                                             \
+            printIndent();                                                                          \
+            LOG_ERROR("ASSERT_KS_MATCHES: %s ~ %s [D %.4g, n %llu, p %.3g < %.3g] :: " msg "\n",    \
+                      #hist, #cdf, _d, (unsigned long long)(hist)->n, _p, stat_alpha,               \
+                      ##__VA_ARGS__);                                                               \
+        }                                                                                           \
+    } while (0)
+
+/**
+ * @brief Assert that a mean is consistent with expected +- tol
+ *
+ * @param moments The StatMoments
+ * @param expected The expected mean
+ * @param tol The tolerated difference (0 for a plain z-test)
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_MEAN_WITHIN(moments, expected, tol, msg, ...)                                        \
+    do {                                                                                            \
+        double _half = statMeanInterval(moments);                                                   \
+        double _off = fabs((moments)->mean - (expected));                                           \
+        if (!(_off - _half <= (tol))) {                                                             \
+            failCase();                                                                             \
+            printIndent();                                                                          \
+            LOG_ERROR("ASSERT_MEAN_WITHIN: %s [%.6g +- %.3g, expected %.6g +- %.3g] :: " msg "\n",  \
+                      #moments, (moments)->mean, _half, (double)(expected), (double)(tol),          \
+                      ##__VA_ARGS__);                                                               \
+        }                                                                                           \
+    } while (0)
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Streaming count, mean, variance and range.
+ */
+typedef struct {
+    uint64_t n;
+    double mean;
+    double m2;      // sum of squared deviations from the mean.
+    double min;
+    double max;
+} StatMoments;
+
+/**
+ * @brief Streaming estimate of one quantile (P-square, Jain & Chlamtac).
+ */
+typedef struct {
+    double p;       // the quantile, in (0, 1).
+    uint64_t n;     // samples seen.
+    double q[5];    // marker heights.
+    double pos[5];  // marker positions (1-based).
+    double want[5]; // desired marker positions.
+} StatP2;
+
+/**
+ * @brief Fixed-bin histogram over [lo, hi).
+ */
+typedef struct {
+    double lo;
+    double hi;
+    uint32_t bins;
+    uint64_t n;         // all samples, including under/overflow.
+    uint64_t under;     // samples below lo (or NaN).
+    uint64_t over;      // samples at or above hi.
+    uint64_t counts[TEST_STATS_MAX_BINS];
+} StatHist;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+double stat_alpha = 1e-3; // significance level of the distribution assertions.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Reset moments.
+ */
+void statMomentsInit(StatMoments* m) {
+    memset(m, 0, sizeof(StatMoments));
+    m->min = INFINITY;
+    m->max = -INFINITY;
+}
+
+/**
+ * @brief Add a sample to moments (Welford).
+ */
+static inline void statMomentsPush(StatMoments* m, double x) {
+    double d = x - m->mean;
+    m->n++;
+    m->mean += d / (double)m->n;
+    m->m2 += d * (x - m->mean);
+    if (x < m->min) m->min = x;
+    if (x > m->max) m->max = x;
+}
+
+/**
+ * @brief Merge moments b into a (Chan et al.).
+ */
+void statMomentsMerge(StatMoments* a, const StatMoments* b) {
+    if (!b->n) return;
+    uint64_t n = a->n + b->n;
+    double d = b->mean - a->mean;
+    a->mean += d * (double)b->n / (double)n;
+    a->m2 += b->m2 + d * d * (double)a->n * (double)b->n / (double)n;
+    a->n = n;
+    if (b->min < a->min) a->min = b->min;
+    if (b->max > a->max) a->max = b->max;
+}
+
+/**
+ * @brief Sample variance of moments.
+ */
+double statVariance(const StatMoments* m) { return m->n > 1 ? m->m2 / (double)(m->n - 1) : 0; }
+
+/**
+ * @brief Sample standard deviation of moments.
+ */
+double statStddev(const StatMoments* m) { return sqrt(statVariance(m)); }
+
+/**
+ * @brief Start estimating quantile p.
+ */
+void statP2Init(StatP2* e, double p) {
+    memset(e, 0, sizeof(StatP2));
+    e->p = p;
+}
+
+/**
+ * @brief Set the desired marker positions for n samples.
+ */
+static void statP2Want(StatP2* e) {
+    double n = (double)e->n;
+    e->want[0] = 1;
+    e->want[1] = 1 + (n - 1) * e->p / 2;
+    e->want[2] = 1 + (n - 1) * e->p;
+    e->want[3] = 1 + (n - 1) * (1 + e->p) / 2;
+    e->want[4] = n;
+}
+
+/**
+ * @brief Add a sample to a P-square estimator.
+ */
+void statP2Push(StatP2* e, double x) {
+    if (e->n < 5) {
+        // collect the first five samples sorted
+        int i = (int)e->n++;
+        while (i > 0 && e->q[i - 1] > x) {
+            e->q[i] = e->q[i - 1];
+            i--;
+        }
+        e->q[i] = x;
+        for (int k = 0; k < 5; k++) e->pos[k] = k + 1;
+        statP2Want(e);
+        return;
+    }
+    int k;
+    if (x < e->q[0]) {
+        e->q[0] = x;
+        k = 0;
+    } else if (x >= e->q[4]) {
+        if (x > e->q[4]) e->q[4] = x;
+        k = 3;
+    } else {
+        for (k = 0; k < 3 && x >= e->q[k + 1]; k++) {}
+    }
+    for (int i = k + 1; i < 5; i++) e->pos[i]++;
+    e->n++;
+    statP2Want(e);
+    for (int i = 1; i < 4; i++) {
+        double d = e->want[i] - e->pos[i];
+        if ((d >= 1 && e->pos[i + 1] - e->pos[i] > 1) || (d <= -1 && e->pos[i - 1] - e->pos[i] < -1)) {
+            double s = d > 0 ? 1 : -1;
+            double np = e->pos[i + 1] - e->pos[i], nm = e->pos[i] - e->pos[i - 1];
+            // piecewise parabolic prediction, linear if it leaves the neighbours
+            double q = e->q[i] + s / (e->pos[i + 1] - e->pos[i - 1]) *
+                       ((nm + s) * (e->q[i + 1] - e->q[i]) / np + (np - s) * (e->q[i] - e->q[i - 1]) / nm);
+            if (!(q > e->q[i - 1] && q < e->q[i + 1])) {
+                int j = i + (int)s;
+                q = e->q[i] + s * (e->q[j] - e->q[i]) / (e->pos[j] - e->pos[i]);
+            }
+            e->q[i] = q;
+            e->pos[i] += s;
+        }
+    }
+}
+
+/**
+ * @brief The current quantile estimate.
+ */
+double statP2Value(const StatP2* e) {
+    if (!e->n) return NAN;
+    if (e->n >= 5) return e->q[2];
+    uint64_t i = (uint64_t)(e->p * (double)(e->n - 1) + 0.5);
+    return e->q[i];
+}
+
+/**
+ * @brief Fraction of the samples of an estimator at or below x, interpolated between markers.
+ */
+static double statP2Cdf(const StatP2* e, double x) {
+    uint32_t m = e->n < 5 ? (uint32_t)e->n : 5;
+    double n = (double)e->n;
+    if (x < e->q[0]) return 0;
+    if (x >= e->q[m - 1]) return 1;
+    for (uint32_t i = 1; i < m; i++) {
+        if (x >= e->q[i]) continue;
+        double f = e->q[i] > e->q[i - 1] ? (x - e->q[i - 1]) / (e->q[i] - e->q[i - 1]) : 1;
+        return (e->pos[i - 1] + f * (e->pos[i] - e->pos[i - 1])) / n;
+    }
+    return 1;
+}
+
+/**
+ * @brief Merge estimator b into a (approximate).
+ *
+ * The markers of each estimator describe a piecewise linear CDF. The merged
+ * markers are placed where the sample-weighted mixture of both reaches the
+ * desired positions. Both estimators must track the same quantile.
+ */
+void statP2Merge(StatP2* a, const StatP2* b) {
+    if (b->n < 5) { // b still holds its raw samples
+        for (uint64_t i = 0; i < b->n; i++) statP2Push(a, b->q[i]);
+        return;
+    }
+    if (a->n < 5) {
+        StatP2 t = *a;
+        *a = *b;
+        for (uint64_t i = 0; i < t.n; i++) statP2Push(a, t.q[i]);
+        return;
+    }
+    StatP2 r = *a;
+    double na = (double)a->n, nb = (double)b->n;
+    r.n = a->n + b->n;
+    statP2Want(&r);
+    r.q[0] = a->q[0] < b->q[0] ? a->q[0] : b->q[0];
+    r.q[4] = a->q[4] > b->q[4] ? a->q[4] : b->q[4];
+    for (int i = 1; i < 4; i++) {
+        double target = r.want[i] / (double)r.n, lo = r.q[0], hi = r.q[4];
+        for (int it = 0; it < 100 && hi - lo > 1e-12 * (fabs(lo) + fabs(hi) + 1e-300); it++) {
+            double mid = (lo + hi) / 2;
+            double f = (na * statP2Cdf(a, mid) + nb * statP2Cdf(b, mid)) / (na + nb);
+            if (f < target) lo = mid;
+            else hi = mid;
+        }
+        r.q[i] = (lo + hi) / 2;
+    }
+    for (int i = 0; i < 5; i++) r.pos[i] = r.want[i] < i + 1 ? i + 1 : r.want[i];
+    r.pos[4] = (double)r.n;
+    *a = r;
+}
+
+/**
+ * @brief Reset a histogram with bins equal bins over [lo, hi).
+ */
+void statHistInit(StatHist* h, double lo, double hi, uint32_t bins) {
+    memset(h, 0, sizeof(StatHist));
+    h->lo = lo;
+    h->hi = hi;
+    h->bins = bins < 1 ? 1 : bins > TEST_STATS_MAX_BINS ? TEST_STATS_MAX_BINS : bins;
+}
+
+/**
+ * @brief Add a sample to a histogram.
+ */
+static inline void statHistPush(StatHist* h, double x) {
+    h->n++;
+    if (!(x >= h->lo)) {
+        h->under++;
+    } else if (x >= h->hi) {
+        h->over++;
+    } else {
+        uint32_t b = (uint32_t)((x - h->lo) / (h->hi - h->lo) * h->bins);
+        h->counts[b < h->bins ? b : h->bins - 1]++;
+    }
+}
+
+/**
+ * @brief Merge histogram b into a.
+ *
+ * @return false if the histograms have different bins.
+ */
+bool statHistMerge(StatHist* a, const StatHist* b) {
+    if (a->lo != b->lo || a->hi != b->hi || a->bins != b->bins) return false;
+    a->n += b->n;
+    a->under += b->under;
+    a->over += b->over;
+    for (uint32_t i = 0; i < a->bins; i++) a->counts[i] += b->counts[i];
+    return true;
+}
+
+/**
+ * @brief Quantile q of a histogram, interpolated within its bin.
+ */
+double statHistQuantile(const StatHist* h, double q) {
+    double want = q * (double)h->n, seen = (double)h->under, width = (h->hi - h->lo) / h->bins;
+    if (!h->n) return NAN;
+    if (want < seen) return h->lo;
+    for (uint32_t i = 0; i < h->bins; i++) {
+        if (h->counts[i] && seen + (double)h->counts[i] >= want)
+            return h->lo + width * (i + (want - seen) / (double)h->counts[i]);
+        seen += (double)h->counts[i];
+    }
+    return h->hi;
+}
+
+/**
+ * @brief Regularized upper incomplete gamma function Q(a, x).
+ */
+double statGammaQ(double a, double x) {
+    if (x <= 0) return 1;
+    double lg = a * log(x) - x - lgamma(a);
+    if (x < a + 1) {
+        // series for P(a, x)
+        double sum = 1 / a, term = sum;
+        for (int n = 1; n < 10000 && fabs(term) > fabs(sum) * 1e-15; n++) {
+            term *= x / (a + n);
+            sum += term;
+        }
+        double p = sum * exp(lg);
+        return p < 1 ? 1 - p : 0;
+    }
+    // continued fraction for Q(a, x) (modified Lentz)
+    double b = x + 1 - a, c = 1e300, d = 1 / b, h = d;
+    for (int i = 1; i < 10000; i++) {
+        double an = -i * (i - a);
+        b += 2;
+        d = an * d + b;
+        if (fabs(d) < 1e-300) d = 1e-300;
+        c = b + an / c;
+        if (fabs(c) < 1e-300) c = 1e-300;
+        d = 1 / d;
+        double del = d * c;
+        h *= del;
+        if (fabs(del - 1) < 1e-15) break;
+    }
+    return exp(lg) * h;
+}
+
+/**
+ * @brief Chi-square test of a histogram against the uniform distribution over its bins.
+ *
+ * @param h The histogram.
+ * @param chi2 Receives the statistic (may be NULL).
+ * @return The p-value, 0 if any sample fell outside the histogram range.
+ */
+double statChi2Uniform(const StatHist* h, double* chi2) {
+    double n = (double)(h->n - h->under - h->over), e = n / h->bins, x = 0;
+    for (uint32_t i = 0; i < h->bins; i++) x += ((double)h->counts[i] - e) * ((double)h->counts[i] - e);
+    x = e > 0 ? x / e : 0;
+    if (chi2) *chi2 = x;
+    if (h->under || h->over || h->bins < 2 || e <= 0) return 0;
+    return statGammaQ((h->bins - 1) / 2.0, x / 2.0);
+}
+
+/**
+ * @brief Kolmogorov-Smirnov test of a histogram against a CDF, evaluated at the bin edges.
+ *
+ * @param h The histogram.
+ * @param cdf The expected CDF.
+ * @param dmax Receives the statistic D (may be NULL).
+ * @return The p-value (Stephens' approximation of the Kolmogorov distribution).
+ */
+double statKsHist(const StatHist* h, double (*cdf)(double), double* dmax) {
+    double n = (double)h->n, seen = (double)h->under, width = (h->hi - h->lo) / h->bins, d = 0;
+    if (!h->n) {
+        if (dmax) *dmax = 0;
+        return 1;
+    }
+    for (uint32_t i = 0; i <= h->bins; i++) {
+        double diff = fabs(seen / n - cdf(h->lo + width * i));
+        if (diff > d) d = diff;
+        if (i < h->bins) seen += (double)h->counts[i];
+    }
+    if (dmax) *dmax = d;
+    double sn = sqrt(n), lambda = (sn + 0.12 + 0.11 / sn) * d, p = 0;
+    if (lambda < 0.3) return 1;
+    for (int k = 1; k <= 100; k++) {
+        double term = exp(-2.0 * k * k * lambda * lambda);
+        p += k % 2 ? term : -term;
+        if (term < 1e-16) break;
+    }
+    p *= 2;
+    return p < 0 ? 0 : p > 1 ? 1 : p;
+}
+
+/**
+ * @brief Standard normal quantile (Acklam's approximation, relative error below 1.2e-9).
+ */
+double statNormalQuantile(double p) {
+    static const double a[] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                                1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00 };
+    static const double b[] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                                6.680131188771972e+01, -1.328068155288572e+01 };
+    static const double c[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                                -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00 };
+    static const double d[] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                                3.754408661907416e+00 };
+    if (p <= 0) return -INFINITY;
+    if (p >= 1) return INFINITY;
+    if (p < 0.02425 || p > 1 - 0.02425) {
+        double q = sqrt(-2 * log(p < 0.5 ? p : 1 - p));
+        double x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+                   ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+        return p < 0.5 ? x : -x;
+    }
+    double q = p - 0.5, r = q * q;
+    return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+           (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+/**
+ * @brief Half-width of the (1 - stat_alpha) confidence interval of the mean.
+ */
+double statMeanInterval(const StatMoments* m) {
+    if (m->n < 2) return INFINITY;
+    return statNormalQuantile(1 - stat_alpha / 2) * statStddev(m) / sqrt((double)m->n);
+}
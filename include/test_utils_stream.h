@@ -0,0 +1,262 @@
+#pragma once
+/**
+ * @file test_utils_stream.h
+ *
+ * @brief Equality assertion over two byte streams of unbounded size.
+ *
+ * @details
+ * This header provides the following assertion:
+ *
+ * - ASSERT_STREAMS_EQUAL: Assert that two streams produce the same bytes.
+ *
+ * A stream is either a producer callback, made with streamProducer(), which
+ * fills a buffer and returns the number of bytes written (0 at the end), or a
+ * file, opened with streamFile() and closed by the assertion. Both streams are
+ * pulled in chunks of TEST_STREAM_CHUNK bytes into two buffers, so memory is
+ * bounded whatever the size of the output, and producers may return fewer
+ * bytes than asked for. Chunks are compared with a SIMD kernel (AVX-512BW,
+ * AVX2 or SSE2, as enabled at compile time) that returns the first differing
+ * byte. On a mismatch the global offset of the first differing byte, or of the
+ * end of the shorter stream, is printed with the bytes of both streams from
+ * that offset.
+ *
+ * @code
+ * size_t encodeChunk(void* ctx, void* buf, size_t cap) { return encoderPull((Encoder*)ctx, buf, cap); }
+ *
+ * ASSERT_STREAMS_EQUAL(streamFile("golden.bin"), streamProducer(encodeChunk, &enc), "encoder output");
+ * @endcode
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_STREAM_CHUNK
+#define TEST_STREAM_CHUNK (64 * 1024) // bytes pulled from each stream at a time
+#endif
+
+#define TEST_STREAM_CONTEXT 16 // bytes printed from each stream at the mismatch
+
+/* -- Assertions ----------------------------------------------------------*/
+
+/**
+ * @brief Assert that two streams produce the same bytes, printing the first mismatch otherwise
+ *
+ * @param a The expected stream (TestStream)
+ * @param b The actual stream (TestStream)
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_STREAMS_EQUAL(a, b, msg, ...)                                    \
+    do {                                                                        \
+        StreamMismatch _sm;                                                     \
+        if (!streamCompare((a), (b), &_sm)) {                                   \
+            failCase();                                                         \
+            printIndent();                                                      \
+            LOG_ERROR("ASSERT_STREAMS_EQUAL: %s != %s :: " msg "\n",            \
+                      #a, #b, ##__VA_ARGS__);                                   \
+            streamPrintMismatch(&_sm);                                          \
+        }                                                                       \
+    } while (0)
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Fill buf with up to cap bytes of output.
+ *
+ * @return The number of bytes written, 0 at the end of the stream.
+ */
+typedef size_t (*StreamFn)(void* ctx, void* buf, size_t cap);
+
+/**
+ * @brief A byte stream.
+ */
+typedef struct {
+    StreamFn fn;
+    void* ctx;
+    FILE* file;         // opened by streamFile(), closed after the comparison.
+    const char* path;   // the file path, for errors.
+} TestStream;
+
+/**
+ * @brief The first difference between two streams.
+ */
+typedef struct {
+    uint64_t offset;                    // offset of the first differing byte.
+    bool a_ended;                       // a ended at offset.
+    bool b_ended;                       // b ended at offset.
+    const char* error;                  // a stream could not be read.
+    uint8_t a[TEST_STREAM_CONTEXT];     // bytes of a from offset.
+    uint8_t b[TEST_STREAM_CONTEXT];     // bytes of b from offset.
+    uint32_t a_len;
+    uint32_t b_len;
+} StreamMismatch;
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief A stream pulling from a producer callback.
+ */
+TestStream streamProducer(StreamFn fn, void* ctx) {
+    TestStream s = { fn, ctx, NULL, NULL };
+    return s;
+}
+
+/**
+ * @brief Read from a stdio file.
+ */
+static size_t streamFileRead(void* ctx, void* buf, size_t cap) {
+    return fread(buf, 1, cap, (FILE*)ctx);
+}
+
+/**
+ * @brief A stream reading a file, closed once compared.
+ */
+TestStream streamFile(const char* path) {
+    TestStream s = { NULL, NULL, fopen(path, "rb"), path };
+    if (s.file) {
+        s.fn = streamFileRead;
+        s.ctx = s.file;
+    }
+    return s;
+}
+
+/**
+ * @brief Find the first differing byte of two buffers.
+ *
+ * @return The index of the first difference, or n if the buffers are equal.
+ */
+size_t streamFirstDiff(const uint8_t* a, const uint8_t* b, size_t n) {
+    size_t i = 0;
+#ifdef __AVX512BW__
+    for (; i + 64 <= n; i += 64) {
+        __mmask64 ne = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512((const void*)(a + i)),
+                                               _mm512_loadu_si512((const void*)(b + i)));
+        if (ne) return i + (size_t)__builtin_ctzll(ne);
+    }
+#endif
+#ifdef __AVX2__
+    for (; i + 64 <= n; i += 64) { // two vectors per branch
+        __m256i x0 = _mm256_loadu_si256((const __m256i*)(a + i)), y0 = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i x1 = _mm256_loadu_si256((const __m256i*)(a + i + 32)), y1 = _mm256_loadu_si256((const __m256i*)(b + i + 32));
+        uint64_t eq = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x0, y0)) |
+                      (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x1, y1)) << 32;
+        if (~eq) return i + (size_t)__builtin_ctzll(~eq);
+    }
+#endif
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        unsigned eq = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+                                                                 _mm_loadu_si128((const __m128i*)(b + i))));
+        if (eq != 0xFFFFu) return i + (size_t)__builtin_ctz(~eq);
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y) break; // located byte by byte below
+    }
+    for (; i < n; i++)
+        if (a[i] != b[i]) return i;
+    return n;
+}
+
+/**
+ * @brief Pull the next chunk of a stream once the previous one is consumed.
+ *
+ * @return The number of unconsumed bytes, 0 at the end of the stream.
+ */
+static size_t streamFill(const TestStream* s, uint8_t* buf, size_t* len, size_t* pos, bool* eof) {
+    while (*pos == *len && !*eof) {
+        *pos = 0;
+        *len = s->fn(s->ctx, buf, TEST_STREAM_CHUNK);
+        if (*len == 0) *eof = true;
+    }
+    return *len - *pos;
+}
+
+/**
+ * @brief Compare two streams chunk by chunk, closing the files among them.
+ *
+ * @param a The first stream.
+ * @param b The second stream.
+ * @param m Filled with the first difference.
+ * @return true if both streams produced the same bytes.
+ */
+bool streamCompare(TestStream a, TestStream b, StreamMismatch* m) {
+    memset(m, 0, sizeof(StreamMismatch));
+    uint8_t* ba = (uint8_t*)malloc(TEST_STREAM_CHUNK);
+    uint8_t* bb = (uint8_t*)malloc(TEST_STREAM_CHUNK);
+    bool equal = false;
+    if (!a.fn || !b.fn) {
+        m->error = !a.fn ? (a.path ? a.path : "first stream") : (b.path ? b.path : "second stream");
+    } else if (!ba || !bb) {
+        m->error = "out of memory";
+    } else {
+        size_t la = 0, pa = 0, lb = 0, pb = 0;
+        bool ea = false, eb = false;
+        for (;;) {
+            size_t na = streamFill(&a, ba, &la, &pa, &ea);
+            size_t nb = streamFill(&b, bb, &lb, &pb, &eb);
+            if (!na || !nb) {
+                equal = !na && !nb;
+                m->a_ended = !na;
+                m->b_ended = !nb;
+            } else {
+                size_t n = na < nb ? na : nb;
+                size_t d = streamFirstDiff(ba + pa, bb + pb, n);
+                m->offset += d;
+                pa += d;
+                pb += d;
+                if (d == n) continue;
+            }
+            if (!equal) {
+                m->a_len = (uint32_t)((la - pa) < TEST_STREAM_CONTEXT ? la - pa : TEST_STREAM_CONTEXT);
+                m->b_len = (uint32_t)((lb - pb) < TEST_STREAM_CONTEXT ? lb - pb : TEST_STREAM_CONTEXT);
+                memcpy(m->a, ba + pa, m->a_len);
+                memcpy(m->b, bb + pb, m->b_len);
+            }
+            break;
+        }
+    }
+    free(ba);
+    free(bb);
+    if (a.file) fclose(a.file);
+    if (b.file) fclose(b.file);
+    return equal;
+}
+
+/**
+ * @brief Print bytes in hex, for streamPrintMismatch().
+ */
+static void streamPrintBytes(const char* label, const uint8_t* p, uint32_t n, bool ended) {
+    char hex[TEST_STREAM_CONTEXT * 3 + 1] = "";
+    for (uint32_t i = 0; i < n; i++) snprintf(hex + 3 * i, 4, "%02x ", p[i]);
+    printIndent();
+    MSG(RESET, "  %s: %s%s\n", label, hex, ended ? "<end>" : "");
+}
+
+/**
+ * @brief Print the first difference found by streamCompare().
+ */
+void streamPrintMismatch(const StreamMismatch* m) {
+    if (m->error) {
+        printIndent();
+        MSG(RESET, "  cannot read %s\n", m->error);
+        return;
+    }
+    printIndent();
+    if (m->a_ended || m->b_ended)
+        MSG(RESET, "  %s stream ended at byte %llu\n", m->a_ended ? "first" : "second", (unsigned long long)m->offset);
+    else
+        MSG(RESET, "  first mismatch at byte %llu\n", (unsigned long long)m->offset);
+    streamPrintBytes("a", m->a, m->a_len, m->a_ended);
+    streamPrintBytes("b", m->b, m->b_len, m->b_ended);
+}
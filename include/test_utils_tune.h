@@ -0,0 +1,371 @@
+#pragma once
+/**
+ * @file test_utils_tune.h
+ *
+ * @brief Autotuning of kernel parameters on top of the benchmark harness.
+ *
+ * @details
+ * A TuneSpace declares integer parameters (block sizes, unroll factors,
+ * thread counts, ...) of a kernel, a function that runs the kernel with one
+ * configuration, and a function that verifies the output of a configuration
+ * with the usual ASSERT_* macros:
+ *
+ * @code
+ * static const TuneParam gemm_params[] = {
+ *     TUNE_PARAM(BLOCK, 16, 32, 64, 128),
+ *     TUNE_PARAM(UNROLL, 1, 2, 4, 8),
+ * };
+ * TuneSpace gemm = TUNE_SPACE(GEMM, gemm_params, gemmRun, gemmVerify, &data);
+ * TUNE_EVAL(gemm);
+ * @endcode
+ *
+ * TUNE_EVAL searches the space according to `tune_config.strategy`:
+ *
+ * - TUNE_EXHAUSTIVE: benchmark every configuration.
+ * - TUNE_RANDOM: benchmark `tune_config.budget` random configurations.
+ * - TUNE_HALVING: successive halving; start with `tune_config.budget`
+ *   configurations (all if 0) and few samples, keep the best 1/eta and
+ *   multiply the samples by eta each round.
+ *
+ * At most TEST_TUNE_MAX_CONFIGS configurations are evaluated; a larger
+ * search is truncated to a uniform random sample of that many, with a warning.
+ *
+ * Each configuration is verified once before it is timed; configurations
+ * whose assertions fail are reported, fail the test and are excluded.
+ * Configurations are ranked by median time per call (see test_utils_bench.h).
+ *
+ * The best configuration is written to `tune_<name>.h` (one
+ * `#define <NAME>_<PARAM> value` per parameter) and `tune_<name>.json` in
+ * `tune_config.out_dir` (or the `TEST_TUNE_DIR` environment variable), for the
+ * build to pick up, e.g. with `#if __has_include("tune_gemm.h")`.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_bench.h"
+
+#include <ctype.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_TUNE_MAX_PARAMS
+#define TEST_TUNE_MAX_PARAMS 8 // parameters per space
+#endif
+
+#ifndef TEST_TUNE_MAX_CONFIGS
+#define TEST_TUNE_MAX_CONFIGS 4096 // configurations evaluated per search
+#endif
+
+#ifndef TEST_TUNE_TOP
+#define TEST_TUNE_TOP 5 // configurations listed in the report
+#endif
+
+/**
+ * @brief Declare a tuning parameter and its candidate values.
+ *
+ * @param name The parameter name (an identifier, used in the generated macros).
+ * @param ... The candidate values.
+ */
+#define TUNE_PARAM(name, ...)                                               \
+    { #name, (const int64_t[]){ __VA_ARGS__ },                              \
+      (uint16_t)(sizeof((int64_t[]){ __VA_ARGS__ }) / sizeof(int64_t)) }
+
+/**
+ * @brief Declare a tuning space.
+ *
+ * @param name The space name (an identifier, prefix of the generated macros).
+ * @param params An array of TUNE_PARAM entries.
+ * @param run The kernel, `void run(const int64_t* values, void* arg)`.
+ * @param verify The verifier (may be NULL), same signature as run.
+ * @param arg The argument passed to run and verify.
+ */
+#define TUNE_SPACE(name, params, run, verify, arg)                          \
+    { #name, params, (uint16_t)(sizeof(params) / sizeof(TuneParam)), run, verify, arg }
+
+/**
+ * @brief Search a tuning space and emit the best configuration.
+ *
+ * @param space The TuneSpace to search.
+ */
+#define TUNE_EVAL(space)                            \
+    MSG(MAGENTA, "%s [tune]:\n", #space);           \
+    depth++;                                        \
+    tuneRun(&(space), NULL);                        \
+    depth--;
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief A kernel (or its verifier) run with one configuration.
+ *
+ * @param values The value of each parameter, in declaration order.
+ * @param arg The argument of the space.
+ */
+typedef void (*TuneFn)(const int64_t* values, void* arg);
+
+/**
+ * @brief A tuning parameter.
+ */
+typedef struct {
+    const char* name;
+    const int64_t* values;
+    uint16_t count;
+} TuneParam;
+
+/**
+ * @brief A tuning space.
+ */
+typedef struct {
+    const char* name;
+    const TuneParam* params;
+    uint16_t count;
+    TuneFn run;
+    TuneFn verify;
+    void* arg;
+} TuneSpace;
+
+/**
+ * @brief Search strategies.
+ */
+typedef enum {
+    TUNE_EXHAUSTIVE,
+    TUNE_RANDOM,
+    TUNE_HALVING,
+} TuneStrategy;
+
+/**
+ * @brief Autotuning configuration.
+ */
+typedef struct {
+    TuneStrategy strategy;
+    uint32_t budget;        // configurations for TUNE_RANDOM / initial ones for TUNE_HALVING (0 = all).
+    uint8_t eta;            // successive halving reduction factor.
+    uint64_t seed;          // seed of the random strategies.
+    const char* out_dir;    // directory of the generated files (TEST_TUNE_DIR overrides).
+} TuneConfig;
+
+/**
+ * @brief A measured configuration.
+ */
+typedef struct {
+    uint64_t index;         // mixed-radix index of the configuration.
+    double median;          // median ns per call.
+    double ci95;            // 95% CI half-width in ns.
+    bool valid;             // passed verification.
+} TuneResult;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+TuneConfig tune_config = {
+    .strategy = TUNE_EXHAUSTIVE,
+    .budget = 64,
+    .eta = 3,
+    .seed = 1,
+    .out_dir = ".",
+};
+
+TuneResult tune_results[TEST_TUNE_MAX_CONFIGS]; // configurations of the last search.
+uint32_t tune_result_count = 0; // number of valid entries in tune_results.
+
+static const TuneSpace* tune_space = NULL;
+static int64_t tune_values[TEST_TUNE_MAX_PARAMS];
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Number of configurations of a space.
+ */
+uint64_t tuneSize(const TuneSpace* s) {
+    uint64_t n = 1;
+    for (uint16_t p = 0; p < s->count; p++) n *= s->params[p].count;
+    return n;
+}
+
+/**
+ * @brief Decode a configuration index into parameter values.
+ */
+void tuneDecode(const TuneSpace* s, uint64_t index, int64_t* values) {
+    for (uint16_t p = 0; p < s->count; p++) {
+        values[p] = s->params[p].values[index % s->params[p].count];
+        index /= s->params[p].count;
+    }
+}
+
+/**
+ * @brief Format a configuration as name=value pairs.
+ */
+static char* tuneFormat(const TuneSpace* s, const int64_t* values, char* buf, size_t len) {
+    size_t used = 0;
+    buf[0] = '\0';
+    for (uint16_t p = 0; p < s->count && used < len; p++)
+        used += (size_t)snprintf(buf + used, len - used, "%s%s=%lld", p ? " " : "",
+                                 s->params[p].name, (long long)values[p]);
+    return buf;
+}
+
+/**
+ * @brief Benchmark adapter running the kernel with the current configuration.
+ */
+static void tuneBench(void* arg) {
+    tune_space->run(tune_values, arg);
+}
+
+/**
+ * @brief Verify and time one configuration.
+ */
+static void tuneMeasure(const TuneSpace* s, TuneResult* r, uint32_t samples, bool verify) {
+    static double buf[TEST_BENCH_MAX_SAMPLES];
+    uint32_t counts[1] = { samples < TEST_BENCH_MAX_SAMPLES ? samples : TEST_BENCH_MAX_SAMPLES };
+    char desc[256];
+    tuneDecode(s, r->index, tune_values);
+    if (verify && s->verify) {
+        bool saved = case_failed;
+        case_failed = false;
+        s->verify(tune_values, s->arg);
+        r->valid = !case_failed;
+        if (!r->valid) {
+            printIndent();
+            LOG_ERROR("TUNE: %s fails verification\n", tuneFormat(s, tune_values, desc, sizeof(desc)));
+            failTest();
+        }
+        case_failed = saved;
+        if (!r->valid) return;
+    } else if (verify) {
+        r->valid = true;
+    }
+    BenchResult b = { 0 };
+    benchSample(tuneBench, s->arg, 0, buf, counts[0]);
+    benchAggregate(buf, counts, 1, &b);
+    r->median = b.median;
+    r->ci95 = b.ci95;
+}
+
+/**
+ * @brief Order results: valid before invalid, then by median.
+ */
+static int tuneCmp(const void* a, const void* b) {
+    const TuneResult* x = (const TuneResult*)a;
+    const TuneResult* y = (const TuneResult*)b;
+    if (x->valid != y->valid) return x->valid ? -1 : 1;
+    return (x->median > y->median) - (x->median < y->median);
+}
+
+/**
+ * @brief Write the generated header and JSON of the best configuration.
+ *
+ * @return true if both files were written.
+ */
+bool tuneEmit(const TuneSpace* s, const TuneResult* best) {
+    char path[512], upper[64], lower[64];
+    const char* dir = getenv("TEST_TUNE_DIR");
+    if (!dir || !*dir) dir = tune_config.out_dir;
+    size_t i = 0;
+    for (; s->name[i] && i < sizeof(upper) - 1; i++) {
+        upper[i] = (char)toupper((unsigned char)s->name[i]);
+        lower[i] = (char)tolower((unsigned char)s->name[i]);
+    }
+    upper[i] = lower[i] = '\0';
+    tuneDecode(s, best->index, tune_values);
+
+    snprintf(path, sizeof(path), "%s/tune_%s.h", dir, lower);
+    FILE* h = fopen(path, "w");
+    if (!h) return false;
+    fprintf(h, "#pragma once\n/* generated by test_utils autotuning: %.1f ns/call (+-%.1f) */\n",
+            best->median, best->ci95);
+    for (uint16_t p = 0; p < s->count; p++)
+        fprintf(h, "#define %s_%s %lld\n", upper, s->params[p].name, (long long)tune_values[p]);
+    bool ok = fclose(h) == 0;
+
+    snprintf(path, sizeof(path), "%s/tune_%s.json", dir, lower);
+    FILE* j = fopen(path, "w");
+    if (!j) return false;
+    fprintf(j, "{\n  \"name\": \"%s\",\n  \"params\": {", s->name);
+    for (uint16_t p = 0; p < s->count; p++)
+        fprintf(j, "%s\n    \"%s\": %lld", p ? "," : "", s->params[p].name, (long long)tune_values[p]);
+    fprintf(j, "\n  },\n  \"ns_per_call\": %.3f,\n  \"ci95\": %.3f\n}\n", best->median, best->ci95);
+    return (fclose(j) == 0) && ok;
+}
+
+/**
+ * @brief Search a tuning space, report the best configurations and emit the best one.
+ *
+ * @param s The space to search.
+ * @param best Receives the best configuration's values (may be NULL).
+ * @return true if a valid configuration was found.
+ */
+bool tuneRun(const TuneSpace* s, int64_t* best) {
+    uint64_t total = tuneSize(s), seed = tune_config.seed;
+    uint32_t n = 0, samples = bench_config.samples;
+    char desc[256], med[16], ci[16];
+    tune_space = s;
+    if (s->count > TEST_TUNE_MAX_PARAMS) {
+        printIndent();
+        LOG_ERROR("TUNE: %s has more than %d parameters\n", s->name, TEST_TUNE_MAX_PARAMS);
+        failTest();
+        return false;
+    }
+
+    // choose the configurations to evaluate
+    bool sample = tune_config.strategy != TUNE_EXHAUSTIVE && tune_config.budget && tune_config.budget < total;
+    uint64_t want = sample ? tune_config.budget : total;
+    bool truncated = want > TEST_TUNE_MAX_CONFIGS;
+    if (truncated) { // more than fit: a uniform sample rather than the first TEST_TUNE_MAX_CONFIGS
+        want = TEST_TUNE_MAX_CONFIGS;
+        sample = true;
+    }
+    for (uint64_t i = 0; i < total && n < want; i++) {
+        // selection sampling keeps a uniform subset of `want` configurations
+        if (!sample || benchMix(&seed) % (total - i) < want - n) tune_results[n++].index = i;
+    }
+    tune_result_count = n;
+
+    if (truncated) {
+        printIndent();
+        LOG_WARN("TUNE: %s: search truncated to a random sample of %u configurations (TEST_TUNE_MAX_CONFIGS)\n",
+                 s->name, n);
+    }
+    printIndent();
+    MSG(BLUE, "%s: %llu configurations, evaluating %u\n", s->name, (unsigned long long)total, n);
+    if (tune_config.strategy == TUNE_HALVING && n > 1) {
+        uint8_t eta = tune_config.eta > 1 ? tune_config.eta : 2;
+        uint32_t alive = n, round_samples = samples;
+        for (uint32_t k = n; k > 1; k /= eta) round_samples = round_samples / eta ? round_samples / eta : 1;
+        if (round_samples < 3) round_samples = 3;
+        for (bool first = true; alive > 0; first = false) {
+            for (uint32_t i = 0; i < alive; i++) tuneMeasure(s, &tune_results[i], round_samples, first);
+            qsort(tune_results, alive, sizeof(TuneResult), tuneCmp);
+            while (alive && !tune_results[alive - 1].valid) alive--;
+            printIndent();
+            MSG(CYAN, "round: %u configurations x %u samples\n", alive, round_samples);
+            if (alive <= 1) break;
+            alive = (alive + eta - 1) / eta;
+            round_samples *= eta;
+        }
+    } else {
+        for (uint32_t i = 0; i < n; i++) tuneMeasure(s, &tune_results[i], samples, true);
+        qsort(tune_results, n, sizeof(TuneResult), tuneCmp);
+    }
+
+    if (!n || !tune_results[0].valid) {
+        printIndent();
+        LOG_ERROR("TUNE: %s has no valid configuration\n", s->name);
+        failTest();
+        return false;
+    }
+    for (uint32_t i = 0; i < n && i < TEST_TUNE_TOP && tune_results[i].valid; i++) {
+        tuneDecode(s, tune_results[i].index, tune_values);
+        testFormatNs(med, sizeof(med), tune_results[i].median);
+        testFormatNs(ci, sizeof(ci), tune_results[i].ci95);
+        tuneFormat(s, tune_values, desc, sizeof(desc));
+        printIndent();
+        if (i == 0) MSG(GREEN, "#%u %s/call \xc2\xb1%s  %s\n", i + 1, med, ci, desc);
+        else MSG(CYAN, "#%u %s/call \xc2\xb1%s  %s\n", i + 1, med, ci, desc);
+    }
+    if (best) tuneDecode(s, tune_results[0].index, best);
+    if (!tuneEmit(s, &tune_results[0])) {
+        printIndent();
+        LOG_WARN("TUNE: cannot write the generated files of %s\n", s->name);
+    }
+    return true;
+}
@@ -0,0 +1,410 @@
+#pragma once
+/**
+ * @file test_utils_ulp.h
+ *
+ * @brief Accuracy harness measuring ULP error against high-precision references.
+ *
+ * @details
+ * An UlpFunc pairs an implementation, either single or double precision,
+ * scalar or batched (for vectorized kernels), with one reference:
+ *
+ * - ref_ld: a `long double` version, e.g. expl.
+ * - ref_dd: a double-double version returning hi + lo.
+ * - ref_cr: a correctly rounded double oracle. Against a float implementation
+ *   this is a high-precision reference. Against a double implementation,
+ *   errors are whole ULPs away from the correctly rounded result.
+ *
+ * ulpRun() evaluates the implementation over [lo, hi] and measures each
+ * result's distance from the reference in units of the last place of the
+ * output type. Inputs are uniform in ULP space (every representable value is
+ * equally likely), so small magnitudes are covered as well as large ones.
+ * `ulp_config.mode` picks random samples or an evenly spaced sweep (which is
+ * exhaustive when the domain has at most `ulp_config.samples` values). Work
+ * is split across `ulp_config.threads` threads.
+ *
+ * The report shows the max and mean ULP error, the worst inputs and a
+ * histogram. NaN or infinity where the reference has a finite value (or the
+ * reverse) counts as an infinite error.
+ *
+ * @code
+ * static void vexpf(const float* x, float* y, size_t n) { ... }
+ * UlpFunc f = { .name = "vexpf", .f32v = vexpf, .ref_ld = expl };
+ * ASSERT_MAX_ULP(f, -87.0, 88.0, 1.0, "vexpf within 1 ulp");
+ * @endcode
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_bench.h"
+
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#ifndef TEST_ULP_WORST
+#define TEST_ULP_WORST 8 // worst inputs kept per run
+#endif
+
+#ifndef TEST_ULP_MAX_THREADS
+#define TEST_ULP_MAX_THREADS 64
+#endif
+
+#define TEST_ULP_BINS 20  // histogram: <= 0.5, <= 1, <= 2, ... <= 64K, more, non-finite
+#define TEST_ULP_CHUNK 1024 // inputs per batch call
+
+/**
+ * @brief Measure and print the ULP error of a function over a domain.
+ *
+ * @param func The UlpFunc.
+ * @param lo The lowest input.
+ * @param hi The highest input.
+ */
+#define ULP_EVAL(func, lo, hi)                                  \
+    MSG(MAGENTA, "%s() [ulp]:\n", (func).name ? (func).name : #func); \
+    depth++;                                                    \
+    ulpRun(&(func), (lo), (hi), &ulp_last);                     \
+    depth--;
+
+/* -- Assertions ----------------------------------------------------------*/
+
+/**
+ * @brief Assert that a function is accurate to a number of ULPs over a domain
+ *
+ * @param func The UlpFunc.
+ * @param lo The lowest input.
+ * @param hi The highest input.
+ * @param max_ulp The largest acceptable error in ULPs.
+ * @param msg The message to print
+ * @param (optional) ... The arguments to format the message
+ */
+#define ASSERT_MAX_ULP(func, lo, hi, max_ulp, msg, ...)                                         \
+    do {                                                                                        \
+        ulpRun(&(func), (lo), (hi), &ulp_last);                                                 \
+        if (!(ulp_last.max <= (max_ulp))) {                                                     \
+            failCase();                                                                         \
+            printIndent();                                                                      \
+            LOG_ERROR("ASSERT_MAX_ULP: %s max error %.3g ulp > %.3g ulp at x = %.9g :: " msg "\n", \
+                      ulp_last.name, ulp_last.max, (double)(max_ulp), ulp_last.worst[0].x,      \
+                      ##__VA_ARGS__);                                                           \
+        }                                                                                       \
+    } while (0)
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief A reference value as the unevaluated sum hi + lo.
+ */
+typedef struct {
+    double hi;
+    double lo;
+} UlpDD;
+
+/**
+ * @brief A function under test and its reference. Set one implementation and one reference.
+ */
+typedef struct {
+    const char* name;
+    float (*f32)(float);                                // scalar single precision.
+    void (*f32v)(const float* x, float* y, size_t n);   // batched single precision.
+    double (*f64)(double);                              // scalar double precision.
+    void (*f64v)(const double* x, double* y, size_t n); // batched double precision.
+    long double (*ref_ld)(long double);                 // long double reference.
+    UlpDD (*ref_dd)(double);                            // double-double reference.
+    double (*ref_cr)(double);                           // correctly rounded oracle.
+} UlpFunc;
+
+/**
+ * @brief How inputs are chosen.
+ */
+typedef enum {
+    ULP_SAMPLE, // uniform random in ULP space.
+    ULP_SWEEP,  // evenly spaced in ULP space, exhaustive for small domains.
+} UlpMode;
+
+/**
+ * @brief Accuracy harness configuration.
+ */
+typedef struct {
+    UlpMode mode;
+    uint64_t samples;   // inputs per run.
+    uint16_t threads;   // worker threads, 0 for one per CPU.
+    uint64_t seed;      // seed of ULP_SAMPLE.
+} UlpConfig;
+
+/**
+ * @brief One evaluated input.
+ */
+typedef struct {
+    double x;
+    double got;         // the implementation's result.
+    double ref;         // the reference, rounded to double.
+    double ulp;         // the error in ULPs.
+} UlpSample;
+
+/**
+ * @brief The result of an accuracy run.
+ */
+typedef struct {
+    const char* name;
+    uint64_t count;             // inputs evaluated.
+    double max;                 // largest error in ULPs.
+    double mean;                // mean error over the finite errors.
+    uint64_t hist[TEST_ULP_BINS];
+    UlpSample worst[TEST_ULP_WORST]; // largest errors, worst first.
+    uint8_t worst_count;
+} UlpResult;
+
+/**
+ * @brief The work of one thread.
+ */
+typedef struct {
+    const UlpFunc* func;
+    bool single;
+    int64_t lo;                 // ordered representation of the domain bounds.
+    uint64_t span;
+    uint64_t begin, end;        // input indices of this thread.
+    double sum;
+    UlpResult result;
+} UlpTask;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+UlpConfig ulp_config = {
+    .mode = ULP_SAMPLE,
+    .samples = 1u << 20,
+    .threads = 0,
+    .seed = 1,
+};
+
+UlpResult ulp_last = { 0 }; // result of the last ULP_EVAL or ASSERT_MAX_ULP.
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Map a float to an integer that orders like the float (-0 and +0 both map to 0).
+ */
+static int64_t ulpOrd32(float v) {
+    int32_t b;
+    memcpy(&b, &v, sizeof(b));
+    return b < 0 ? -(int64_t)(b & 0x7FFFFFFF) : (int64_t)b;
+}
+
+static float ulpFromOrd32(int64_t o) {
+    int32_t b = o < 0 ? (int32_t)(-o) | INT32_MIN : (int32_t)o;
+    float v;
+    memcpy(&v, &b, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Map a double to an integer that orders like the double.
+ */
+static int64_t ulpOrd64(double v) {
+    int64_t b;
+    memcpy(&b, &v, sizeof(b));
+    return b < 0 ? -(b & INT64_MAX) : b;
+}
+
+static double ulpFromOrd64(int64_t o) {
+    int64_t b = o < 0 ? (-o) | INT64_MIN : o;
+    double v;
+    memcpy(&v, &b, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Evaluate the reference at x.
+ */
+static long double ulpReference(const UlpFunc* f, double x) {
+    if (f->ref_ld) return f->ref_ld((long double)x);
+    if (f->ref_dd) {
+        UlpDD r = f->ref_dd(x);
+        return (long double)r.hi + (long double)r.lo;
+    }
+    return (long double)f->ref_cr(x);
+}
+
+/**
+ * @brief Error of got against ref in ULPs of the output type.
+ *
+ * @param single true for float output, false for double.
+ */
+double ulpError(long double ref, long double got, bool single) {
+    int mant = single ? FLT_MANT_DIG : DBL_MANT_DIG;
+    int emin = single ? FLT_MIN_EXP - 1 : DBL_MIN_EXP - 1;
+    int emax = single ? FLT_MAX_EXP - 1 : DBL_MAX_EXP - 1;
+    if (isnan(ref) || isnan(got)) return isnan(ref) && isnan(got) ? 0 : INFINITY;
+    if (isinf(ref)) return got == ref ? 0 : INFINITY;
+    if (isinf(got)) {
+        // fine if the reference rounds to infinity in the output type
+        long double overflow = ldexpl(1, emax + 1) - ldexpl(1, emax - mant);
+        return fabsl(ref) >= overflow && signbit(ref) == signbit(got) ? 0 : INFINITY;
+    }
+    int e = ref != 0 ? ilogbl(ref) : emin;
+    if (e < emin) e = emin; // subnormals share the smallest spacing
+    return (double)(fabsl(got - ref) / ldexpl(1, e - (mant - 1)));
+}
+
+/**
+ * @brief Record an evaluated input in a result.
+ */
+static void ulpAccount(UlpTask* t, double x, double got, long double ref) {
+    UlpResult* r = &t->result;
+    double e = ulpError(ref, got, t->single);
+    int bin = TEST_ULP_BINS - 1;
+    if (isfinite(e)) {
+        t->sum += e;
+        bin = 0;
+        for (double edge = 0.5; bin < TEST_ULP_BINS - 2 && e > edge; edge *= 2) bin++;
+    }
+    r->hist[bin]++;
+    r->count++;
+    if (e > r->max || r->count == 1) r->max = e;
+    if (r->worst_count == TEST_ULP_WORST && !(e > r->worst[TEST_ULP_WORST - 1].ulp)) return;
+    int i = r->worst_count < TEST_ULP_WORST ? r->worst_count++ : TEST_ULP_WORST - 1;
+    for (; i > 0 && e > r->worst[i - 1].ulp; i--) r->worst[i] = r->worst[i - 1];
+    r->worst[i] = (UlpSample){ x, got, (double)ref, e };
+}
+
+/**
+ * @brief Pick the i-th input of a run in the ordered representation.
+ */
+static int64_t ulpInput(const UlpTask* t, uint64_t i, uint64_t* rng) {
+    uint64_t n = ulp_config.samples;
+    if (ulp_config.mode == ULP_SWEEP) {
+        if (t->span < n) return t->lo + (int64_t)(i < t->span ? i : t->span);
+        return t->lo + (int64_t)((unsigned __int128)i * t->span / (n > 1 ? n - 1 : 1));
+    }
+    uint64_t r = benchMix(rng);
+    return t->lo + (int64_t)(t->span == UINT64_MAX ? r : r % (t->span + 1));
+}
+
+/**
+ * @brief Worker: evaluate this thread's share of the inputs in batches.
+ */
+static void* ulpWorker(void* p) {
+    UlpTask* t = (UlpTask*)p;
+    const UlpFunc* f = t->func;
+    float xf[TEST_ULP_CHUNK], yf[TEST_ULP_CHUNK];
+    double xd[TEST_ULP_CHUNK], yd[TEST_ULP_CHUNK];
+    uint64_t rng = ulp_config.seed ^ (t->begin * 0x9E3779B97F4A7C15ull);
+    for (uint64_t i = t->begin; i < t->end; ) {
+        size_t n = t->end - i < TEST_ULP_CHUNK ? (size_t)(t->end - i) : TEST_ULP_CHUNK;
+        for (size_t k = 0; k < n; k++) {
+            int64_t o = ulpInput(t, i + k, &rng);
+            if (t->single) xf[k] = ulpFromOrd32(o);
+            else xd[k] = ulpFromOrd64(o);
+        }
+        if (t->single) {
+            if (f->f32v) f->f32v(xf, yf, n);
+            else for (size_t k = 0; k < n; k++) yf[k] = f->f32(xf[k]);
+            for (size_t k = 0; k < n; k++) ulpAccount(t, xf[k], yf[k], ulpReference(f, xf[k]));
+        } else {
+            if (f->f64v) f->f64v(xd, yd, n);
+            else for (size_t k = 0; k < n; k++) yd[k] = f->f64(xd[k]);
+            for (size_t k = 0; k < n; k++) ulpAccount(t, xd[k], yd[k], ulpReference(f, xd[k]));
+        }
+        i += n;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Print an accuracy result.
+ */
+void ulpReport(const UlpResult* r, double lo, double hi, uint16_t threads) {
+    static const char* labels[TEST_ULP_BINS] = { "<=0.5", "<=1", "<=2", "<=4", "<=8", "<=16", "<=32", "<=64",
+                                                 "<=128", "<=256", "<=512", "<=1K", "<=2K", "<=4K", "<=8K",
+                                                 "<=16K", "<=32K", "<=64K", ">64K", "non-finite" };
+    char hist[512];
+    size_t len = 0;
+    printIndent();
+    MSG(CYAN, "[%.9g, %.9g]: %llu inputs (%s, %u threads)\n", lo, hi, (unsigned long long)r->count,
+        ulp_config.mode == ULP_SWEEP ? "sweep" : "sampled", threads);
+    if (!r->count) return;
+    printIndent();
+    if (isfinite(r->max)) MSG(CYAN, "max %.3f ulp, mean %.4f ulp\n", r->max, r->mean);
+    else MSG(YELLOW, "max inf ulp (%llu non-finite mismatches), mean %.4f ulp\n",
+             (unsigned long long)r->hist[TEST_ULP_BINS - 1], r->mean);
+    for (int b = 0; b < TEST_ULP_BINS; b++) {
+        if (!r->hist[b] || len >= sizeof(hist)) continue;
+        len += (size_t)snprintf(hist + len, sizeof(hist) - len, "%s%s: %.4g%%", len ? " | " : "",
+                                labels[b], 100.0 * (double)r->hist[b] / (double)r->count);
+    }
+    printIndent();
+    MSG(CYAN, "%s\n", hist);
+    for (uint8_t i = 0; i < r->worst_count && r->worst[i].ulp > 0; i++) {
+        printIndent();
+        MSG(CYAN, "x = %-16.9g (%a): got %.17g, ref %.17g, %.3f ulp\n", r->worst[i].x, r->worst[i].x,
+            r->worst[i].got, r->worst[i].ref, r->worst[i].ulp);
+    }
+}
+
+/**
+ * @brief Measure the ULP error of a function over [lo, hi] and report it.
+ *
+ * @param f The function and its reference.
+ * @param lo The lowest input.
+ * @param hi The highest input.
+ * @param result Receives the result.
+ */
+void ulpRun(const UlpFunc* f, double lo, double hi, UlpResult* result) {
+    static UlpTask tasks[TEST_ULP_MAX_THREADS];
+    pthread_t threads[TEST_ULP_MAX_THREADS];
+    memset(result, 0, sizeof(UlpResult));
+    result->name = f->name ? f->name : "?";
+    bool single = f->f32 || f->f32v;
+    if ((!single && !f->f64 && !f->f64v) || (!f->ref_ld && !f->ref_dd && !f->ref_cr) || !(lo <= hi)) {
+        printIndent();
+        LOG_ERROR("ULP: %s needs an implementation, a reference and a domain\n", result->name);
+        failCase();
+        return;
+    }
+    int64_t olo = single ? ulpOrd32((float)lo) : ulpOrd64(lo);
+    int64_t ohi = single ? ulpOrd32((float)hi) : ulpOrd64(hi);
+    uint64_t span = (uint64_t)ohi - (uint64_t)olo;
+    uint64_t n = ulp_config.samples;
+    if (ulp_config.mode == ULP_SWEEP && span < n) n = span + 1;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint16_t nt = ulp_config.threads ? ulp_config.threads : (uint16_t)(cpus > 0 ? cpus : 1);
+    if (nt > TEST_ULP_MAX_THREADS) nt = TEST_ULP_MAX_THREADS;
+    if (nt > n) nt = n ? (uint16_t)n : 1;
+    for (uint16_t i = 0; i < nt; i++) {
+        memset(&tasks[i], 0, sizeof(UlpTask));
+        tasks[i].func = f;
+        tasks[i].single = single;
+        tasks[i].lo = olo;
+        tasks[i].span = span;
+        tasks[i].begin = n * i / nt;
+        tasks[i].end = n * (i + 1) / nt;
+    }
+    uint16_t started = 1;
+    while (started < nt && pthread_create(&threads[started], NULL, ulpWorker, &tasks[started]) == 0) started++;
+    ulpWorker(&tasks[0]);
+    for (uint16_t i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    for (uint16_t i = started; i < nt; i++) ulpWorker(&tasks[i]); // threads that failed to start
+
+    double sum = 0;
+    for (uint16_t i = 0; i < nt; i++) {
+        const UlpResult* r = &tasks[i].result;
+        sum += tasks[i].sum;
+        if (r->count && (r->max > result->max || !result->count)) result->max = r->max;
+        result->count += r->count;
+        for (int b = 0; b < TEST_ULP_BINS; b++) result->hist[b] += r->hist[b];
+        for (uint8_t w = 0; w < r->worst_count; w++) {
+            if (result->worst_count == TEST_ULP_WORST && !(r->worst[w].ulp > result->worst[TEST_ULP_WORST - 1].ulp))
+                break;
+            int j = result->worst_count < TEST_ULP_WORST ? result->worst_count++ : TEST_ULP_WORST - 1;
+            for (; j > 0 && r->worst[w].ulp > result->worst[j - 1].ulp; j--) result->worst[j] = result->worst[j - 1];
+            result->worst[j] = r->worst[w];
+        }
+    }
+    uint64_t finite = result->count - result->hist[TEST_ULP_BINS - 1];
+    result->mean = finite ? sum / (double)finite : 0;
+    ulpReport(result, lo, hi, nt);
+}
@@ -0,0 +1,55 @@
+/**
+ * @file test_asserts.c
+ *
+ * @brief Assertion semantics shared by the inline and TEST_LIGHT_ASSERTS expansions.
+ *
+ * @details
+ * Built twice, once with TEST_LIGHT_ASSERTS; both builds must pass. Every
+ * operand has a side effect, so an assertion that evaluates an operand more
+ * than once either fails or shifts the counters checked after it.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+static int calls = 0;
+
+static int next(void) { return ++calls; }
+static char nextChar(void) { return (char)('a' + calls++); }
+static bool nextTrue(void) { calls++; return true; }
+static int* nextPtr(void) { calls++; return &calls; }
+
+static void testOperandsOnce(void) {
+    TEST_CASE("integers");
+    calls = 0;
+    ASSERT_EQUAL_INT(next(), 1, "first call");
+    ASSERT_EQUAL_INT(calls, 1, "one call");
+    ASSERT_NOT_EQUAL_INT(next(), 1, "second call");
+    ASSERT_LT_INT(next(), 4, "third call");
+    ASSERT_EQUAL_INT(calls, 3, "three calls");
+    CASE_COMPLETE;
+
+    TEST_CASE("chars and pointers");
+    static int values[4];
+    calls = 0;
+    ASSERT_EQUAL_CHAR(nextChar(), 'a', "first char");
+    ASSERT_NOT_EQUAL_CHAR(nextChar(), 'a', "second char");
+    ASSERT_EQUAL_PTR(&values[next() - 1], &values[2], "third slot");
+    ASSERT_NOT_EQUAL_PTR(values, &values[next()], "array operand");
+    ASSERT_EQUAL_INT(calls, 4, "four calls");
+    CASE_COMPLETE;
+
+    TEST_CASE("booleans");
+    calls = 0;
+    ASSERT_TRUE(nextTrue(), "first call");
+    ASSERT_FALSE(!nextTrue(), "second call");
+    ASSERT_NOT_NULL(nextPtr(), "third call");
+    ASSERT_EQUAL_INT(calls, 3, "three calls");
+    CASE_COMPLETE;
+}
+
+int main(void) {
+    TEST_EVAL(testOperandsOnce);
+    return testGetStatus() ? 1 : 0;
+}
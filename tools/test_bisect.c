@@ -0,0 +1,439 @@
+/**
+ * @file test_bisect.c
+ *
+ * @brief Benchmark bisection across git history.
+ *
+ * @details
+ * Given a good and a bad commit and a benchmark name, finds the first commit
+ * on the first-parent path between them where the benchmark regressed. The
+ * commits are checked out into a single `git worktree` in a fresh
+ * `test_bisect.XXXXXX` directory created under `-w` (default $TMPDIR), so the build directory survives from one step to the next and
+ * each step is an incremental rebuild, and the user's checkout is never
+ * touched.
+ *
+ * Every measured commit is built with the build command and its benchmark
+ * command is run `-n` times, each run recording into a history file (the
+ * benchmark binary must include test_utils_history.h at every commit in the
+ * range). The log of the run medians is the sample of a commit, so noise
+ * between processes is part of it.
+ *
+ * The good and bad commits are measured first, and a Welch t-test at 95% must
+ * show the bad one slower, otherwise there is nothing to bisect. The
+ * threshold for each midpoint is the geometric mean of the good and bad
+ * medians. A midpoint is bad when its mean is significantly above the
+ * threshold, i.e. the 95% interval of its mean lies entirely above it, and
+ * good when the interval lies entirely below it. While neither holds, `-n`
+ * more runs are taken, up to `-m` runs in total. After that the nearer side
+ * wins and the step is reported as uncertain. Commits that fail to build or
+ * to produce a result are skipped, like `git bisect skip`.
+ *
+ * @code
+ * test_bisect -b "cmake -S . -B _b -DCMAKE_BUILD_TYPE=Release && cmake --build _b" \
+ *             -t "_b/benchmarks" v1.4 HEAD sortLarge
+ * @endcode
+ *
+ * The exit status is 0 when a first bad commit was found, 1 when the bad
+ * commit is not significantly slower than the good one, and 2 on errors.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_clock.h"
+#include "test_utils_history.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#define BISECT_MAX_RUNS 64
+#define BISECT_SHA 41
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief The state of a commit in the range.
+ */
+typedef enum {
+    BISECT_UNTESTED,
+    BISECT_GOOD,
+    BISECT_BAD,
+    BISECT_SKIP,    // did not build or produced no result.
+} BisectState;
+
+/**
+ * @brief The measurements of one commit.
+ */
+typedef struct {
+    double log_median[BISECT_MAX_RUNS]; // log of the median of every run.
+    uint32_t runs;
+    double mean;                        // mean of the logs.
+    double sd;                          // standard deviation of the logs.
+} BisectSample;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+static const char* bisect_repo = ".";
+static const char* bisect_build = NULL;
+static const char* bisect_run = NULL;
+static const char* bisect_bench = NULL;
+static unsigned bisect_timeout = 600;
+static uint32_t bisect_repeats = 5;
+static uint32_t bisect_max_runs = 20;
+static char bisect_work[512] = "";
+static char bisect_tree[600] = "";
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Run a command in a directory, optionally capturing its standard output.
+ *
+ * @param argv The command, or NULL to run `sh -c cmd` with output silenced.
+ * @param cmd The shell command when argv is NULL.
+ * @param dir The working directory, or NULL.
+ * @param out Receives the output of argv (NUL terminated), or NULL to discard it.
+ * @param len The size of out.
+ * @param timeout Seconds before the command's process group is killed, 0 for none.
+ * @return The exit status, 128 + signal if killed by a signal, -1 on timeout.
+ */
+static int bisectExec(char* const* argv, const char* cmd, const char* dir, char* out, size_t len,
+                      unsigned timeout) {
+    int pipefd[2] = { -1, -1 };
+    if (out && pipe(pipefd) != 0) return 127;
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        setpgid(0, 0);
+        if (null >= 0) {
+            dup2(null, STDIN_FILENO);
+            dup2(out ? pipefd[1] : null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        if (dir && chdir(dir) != 0) _exit(127);
+        if (argv) execvp(argv[0], argv);
+        else execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+        _exit(127);
+    }
+    if (out) {
+        size_t used = 0;
+        close(pipefd[1]);
+        while (pid > 0) {
+            ssize_t r = read(pipefd[0], out + used, len - 1 - used);
+            if (r > 0 && used + (size_t)r < len - 1) used += (size_t)r;
+            else if (r > 0) used = len - 1;
+            else if (r == 0 || errno != EINTR) break;
+        }
+        out[used] = '\0';
+        close(pipefd[0]);
+    }
+    if (pid < 0) return 127;
+    struct timespec poll = { 0, 10 * 1000 * 1000 };
+    time_t deadline = time(NULL) + (time_t)timeout;
+    int status;
+    for (;;) {
+        pid_t r = waitpid(pid, &status, timeout ? WNOHANG : 0);
+        if (r == pid) break;
+        if (r < 0 && errno != EINTR) return 127;
+        if (timeout && time(NULL) >= deadline) {
+            kill(-pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+        if (r == 0) nanosleep(&poll, NULL);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/**
+ * @brief Run git in the repository, capturing its output without the trailing newline.
+ */
+static bool bisectGit(char* out, size_t len, const char* a0, const char* a1, const char* a2, const char* a3,
+                      const char* a4, const char* a5) {
+    char* argv[] = { "git", "-C", (char*)bisect_repo, (char*)a0, (char*)a1, (char*)a2, (char*)a3, (char*)a4,
+                     (char*)a5, NULL };
+    char scratch[256];
+    if (!out) {
+        out = scratch;
+        len = sizeof(scratch);
+    }
+    if (bisectExec(argv, NULL, NULL, out, len, 0) != 0) return false;
+    size_t n = strlen(out);
+    while (n && (out[n - 1] == '\n' || out[n - 1] == '\r')) out[--n] = '\0';
+    return true;
+}
+
+/**
+ * @brief Mean and standard deviation of the logs of a sample.
+ */
+static void bisectStats(BisectSample* s) {
+    double sum = 0, sq = 0;
+    for (uint32_t i = 0; i < s->runs; i++) sum += s->log_median[i];
+    s->mean = s->runs ? sum / s->runs : 0;
+    for (uint32_t i = 0; i < s->runs; i++) sq += (s->log_median[i] - s->mean) * (s->log_median[i] - s->mean);
+    s->sd = s->runs > 1 ? sqrt(sq / (s->runs - 1)) : 0;
+}
+
+/**
+ * @brief Check out and build a commit in the worktree.
+ */
+static bool bisectBuild(const char* sha) {
+    char* argv[] = { "git", "-C", bisect_tree, "checkout", "-q", "--detach", (char*)sha, NULL };
+    char out[256];
+    if (bisectExec(argv, NULL, NULL, out, sizeof(out), 0) != 0) {
+        LOG_WARN("BISECT: cannot check out %s\n", sha);
+        return false;
+    }
+    return bisectExec(NULL, bisect_build, bisect_tree, NULL, 0, 0) == 0;
+}
+
+/**
+ * @brief Run the benchmark of the checked out commit `count` more times.
+ *
+ * @return false if a run produced no result for the benchmark.
+ */
+static bool bisectMeasure(const char* sha, BisectSample* s, uint32_t count) {
+    char hist[600];
+    snprintf(hist, sizeof(hist), "%s/%s.hist", bisect_work, sha);
+    for (uint32_t k = 0; k < count && s->runs < BISECT_MAX_RUNS; k++) {
+        unlink(hist);
+        setenv("TEST_BENCH_HISTORY", hist, 1);
+        setenv("TEST_BENCH_COMMIT", sha, 1);
+        int rc = bisectExec(NULL, bisect_run, bisect_tree, NULL, 0, bisect_timeout);
+        if (rc < 0) LOG_WARN("BISECT: %.12s: benchmark timed out\n", sha);
+        uint32_t count_recs = 0;
+        HistoryRecord* recs = historyLoad(hist, &count_recs);
+        double median = 0;
+        for (uint32_t i = 0; recs && i < count_recs; i++)
+            if (strcmp(recs[i].name, bisect_bench) == 0) median = recs[i].median;
+        free(recs);
+        if (median <= 0) return false;
+        s->log_median[s->runs++] = log(median);
+    }
+    unlink(hist);
+    bisectStats(s);
+    return true;
+}
+
+/**
+ * @brief Build and measure a good or bad endpoint of the range.
+ */
+static bool bisectEndpoint(const char* label, const char* sha, BisectSample* s) {
+    char med[16];
+    if (!bisectBuild(sha)) {
+        LOG_ERROR("BISECT: the %s commit %.12s does not build (%s)\n", label, sha, bisect_build);
+        return false;
+    }
+    if (!bisectMeasure(sha, s, bisect_repeats)) {
+        LOG_ERROR("BISECT: the %s commit %.12s produced no result for %s (%s)\n", label, sha, bisect_bench,
+                  bisect_run);
+        return false;
+    }
+    printIndent();
+    MSG(CYAN, "%-4s %.12s: %s/op, \xc2\xb1%.1f%% over %u runs\n", label, sha,
+        testFormatNs(med, sizeof(med), exp(s->mean)), 100.0 * s->sd, s->runs);
+    return true;
+}
+
+/**
+ * @brief Classify a midpoint against the threshold, measuring more until it is significant.
+ *
+ * @param uncertain Set when the limit of runs was reached without significance.
+ */
+static BisectState bisectClassify(const char* sha, double threshold, bool* uncertain) {
+    BisectSample s = { .runs = 0 };
+    *uncertain = false;
+    if (!bisectBuild(sha)) return BISECT_SKIP;
+    while (s.runs < bisect_max_runs) {
+        uint32_t more = bisect_max_runs - s.runs < bisect_repeats ? bisect_max_runs - s.runs : bisect_repeats;
+        if (!bisectMeasure(sha, &s, more)) return BISECT_SKIP;
+        double half = s.runs > 1 ? benchT95(s.runs - 1) * s.sd / sqrt(s.runs) : INFINITY;
+        if (s.mean - half > threshold) return BISECT_BAD;
+        if (s.mean + half < threshold) return BISECT_GOOD;
+    }
+    *uncertain = true;
+    return s.mean > threshold ? BISECT_BAD : BISECT_GOOD;
+}
+
+/**
+ * @brief Print usage.
+ */
+static void bisectUsage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s -b BUILD -t RUN [options] GOOD BAD BENCH\n"
+            "  -b BUILD   shell command building the tree (run in the worktree)\n"
+            "  -t RUN     shell command running the benchmarks (run in the worktree)\n"
+            "  -r REPO    repository to bisect (default .)\n"
+            "  -n RUNS    runs per measurement round (default 5)\n"
+            "  -m RUNS    runs per commit before an undecided step is settled (default 20)\n"
+            "  -T SECS    timeout of one benchmark run (default 600)\n"
+            "  -w DIR     where the work directory test_bisect.XXXXXX is created (default $TMPDIR)\n"
+            "  -k         keep the work directory and its worktree\n",
+            argv0);
+}
+
+int main(int argc, char** argv) {
+    bool keep = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:t:r:n:m:T:w:kh")) != -1) {
+        switch (opt) {
+        case 'b': bisect_build = optarg; break;
+        case 't': bisect_run = optarg; break;
+        case 'r': bisect_repo = optarg; break;
+        case 'n': bisect_repeats = (uint32_t)atoi(optarg); break;
+        case 'm': bisect_max_runs = (uint32_t)atoi(optarg); break;
+        case 'T': bisect_timeout = (unsigned)atoi(optarg); break;
+        case 'w': snprintf(bisect_work, sizeof(bisect_work), "%s", optarg); break;
+        case 'k': keep = true; break;
+        default: bisectUsage(argv[0]); return 2;
+        }
+    }
+    if (!bisect_build || !bisect_run || argc - optind != 3) {
+        bisectUsage(argv[0]);
+        return 2;
+    }
+    bisect_bench = argv[optind + 2];
+    if (bisect_repeats < 2) bisect_repeats = 2;
+    if (bisect_max_runs > BISECT_MAX_RUNS) bisect_max_runs = BISECT_MAX_RUNS;
+    if (bisect_max_runs < bisect_repeats) bisect_max_runs = bisect_repeats;
+
+    char good[BISECT_SHA], bad[BISECT_SHA], spec[2 * BISECT_SHA + 4];
+    char gspec[128], bspec[128];
+    snprintf(gspec, sizeof(gspec), "%s^{commit}", argv[optind]);
+    snprintf(bspec, sizeof(bspec), "%s^{commit}", argv[optind + 1]);
+    if (!bisectGit(good, sizeof(good), "rev-parse", "--verify", "-q", gspec, NULL, NULL) ||
+        !bisectGit(bad, sizeof(bad), "rev-parse", "--verify", "-q", bspec, NULL, NULL)) {
+        LOG_ERROR("BISECT: unknown commit %s or %s in %s\n", argv[optind], argv[optind + 1], bisect_repo);
+        return 2;
+    }
+
+    // commits after good up to bad on the first-parent path, oldest first
+    size_t list_len = 1 << 22;
+    char* list = (char*)malloc(list_len);
+    snprintf(spec, sizeof(spec), "%s..%s", good, bad);
+    if (!list || !bisectGit(list, list_len, "rev-list", "--reverse", "--first-parent", "--ancestry-path", spec,
+                            NULL) || !*list) {
+        LOG_ERROR("BISECT: %.12s is not an ancestor of %.12s\n", good, bad);
+        free(list);
+        return 2;
+    }
+    uint32_t n = 0;
+    for (char* p = list; *p; p++) n += *p == '\n';
+    n++;
+    char (*shas)[BISECT_SHA] = (char (*)[BISECT_SHA])calloc(n, BISECT_SHA);
+    BisectState* state = (BisectState*)calloc(n, sizeof(BisectState));
+    n = 0;
+    for (char* line = strtok(list, "\n"); shas && line; line = strtok(NULL, "\n"))
+        snprintf(shas[n++], BISECT_SHA, "%s", line);
+    free(list);
+    if (!shas || !state) return 2;
+
+    // a directory of our own inside -w, so cleaning up never touches anything else there
+    char base[400];
+    const char* tmp = getenv("TMPDIR");
+    snprintf(base, sizeof(base), "%s", *bisect_work ? bisect_work : tmp && *tmp ? tmp : "/tmp");
+    snprintf(bisect_work, sizeof(bisect_work), "%s/test_bisect.XXXXXX", base);
+    char* mkdir_argv[] = { "mkdir", "-p", base, NULL };
+    if (bisectExec(mkdir_argv, NULL, NULL, NULL, 0, 0) != 0 || !mkdtemp(bisect_work)) {
+        LOG_ERROR("BISECT: cannot create a work directory in %s\n", base);
+        return 2;
+    }
+    snprintf(bisect_tree, sizeof(bisect_tree), "%s/tree", bisect_work);
+    if (!bisectGit(NULL, 0, "worktree", "add", "-q", "--detach", bisect_tree, good)) {
+        LOG_ERROR("BISECT: cannot create a worktree in %s\n", bisect_tree);
+        rmdir(bisect_work);
+        return 2;
+    }
+
+    MSG(MAGENTA, "%s: bisecting %u commits, %.12s (good) .. %.12s (bad):\n", bisect_bench, n, good, bad);
+    depth++;
+    int rc = 2;
+    BisectSample gs = { .runs = 0 }, bs = { .runs = 0 };
+    if (bisectEndpoint("good", good, &gs) && bisectEndpoint("bad", bad, &bs)) {
+        double se = sqrt(gs.sd * gs.sd / gs.runs + bs.sd * bs.sd / bs.runs);
+        double vg = gs.sd * gs.sd / gs.runs, vb = bs.sd * bs.sd / bs.runs;
+        double df = (vg + vb) * (vg + vb) / (vg * vg / (gs.runs - 1) + vb * vb / (bs.runs - 1) + 1e-300);
+        if (!(bs.mean - gs.mean > benchT95(df < 1 ? 1 : (uint32_t)df) * se)) {
+            printIndent();
+            LOG_WARN("BISECT: %.12s is not significantly slower than %.12s, nothing to bisect\n", bad, good);
+            rc = 1;
+        } else {
+            double threshold = (gs.mean + bs.mean) / 2;
+            char thr[16];
+            printIndent();
+            MSG(CYAN, "threshold %s/op (%+.1f%% regression)\n", testFormatNs(thr, sizeof(thr), exp(threshold)),
+                100.0 * (exp(bs.mean - gs.mean) - 1));
+
+            // invariant: lo is good (-1 for the good commit), hi is bad (n - 1 is the bad commit)
+            int64_t lo = -1, hi = (int64_t)n - 1;
+            state[n - 1] = BISECT_BAD;
+            bool any_uncertain = false;
+            for (;;) {
+                int64_t mid = -1, center = lo + (hi - lo) / 2;
+                for (int64_t d = 0; mid < 0 && d < hi - lo; d++) { // nearest untested commit to the center
+                    if (center + d > lo && center + d < hi && state[center + d] != BISECT_SKIP) mid = center + d;
+                    else if (center - d > lo && center - d < hi && state[center - d] != BISECT_SKIP) mid = center - d;
+                }
+                if (mid < 0) break;
+                uint32_t left = 0;
+                for (int64_t i = lo + 1; i < hi; i++) left += state[i] != BISECT_SKIP;
+                bool uncertain;
+                state[mid] = bisectClassify(shas[mid], threshold, &uncertain);
+                char subject[128] = "";
+                bisectGit(subject, sizeof(subject), "log", "-1", "--format=%s", shas[mid], NULL, NULL);
+                printIndent();
+                if (state[mid] == BISECT_SKIP)
+                    MSG(YELLOW, "[%u left] %.12s skipped (no build or no result)  %s\n", left, shas[mid], subject);
+                else if (state[mid] == BISECT_BAD)
+                    MSG(RED, "[%u left] %.12s bad%s  %s\n", left, shas[mid], uncertain ? " (uncertain)" : "",
+                        subject);
+                else
+                    MSG(GREEN, "[%u left] %.12s good%s  %s\n", left, shas[mid], uncertain ? " (uncertain)" : "",
+                        subject);
+                any_uncertain = any_uncertain || uncertain;
+                if (state[mid] == BISECT_BAD) hi = mid;
+                else if (state[mid] == BISECT_GOOD) lo = mid;
+            }
+
+            char subject[128] = "";
+            bisectGit(subject, sizeof(subject), "log", "-1", "--format=%h %s", shas[hi], NULL, NULL);
+            uint32_t skipped = 0;
+            for (int64_t i = lo + 1; i < hi; i++) skipped += state[i] == BISECT_SKIP;
+            printIndent();
+            if (skipped)
+                MSG(RED, "first bad commit is one of %u skipped commits before %s\n", skipped, subject);
+            else
+                MSG(RED, "first bad commit: %s\n", subject);
+            if (any_uncertain) {
+                printIndent();
+                LOG_WARN("BISECT: some steps stayed within the noise after %u runs, raise -m to confirm\n",
+                         bisect_max_runs);
+            }
+            rc = 0;
+        }
+    }
+    depth--;
+
+    if (!keep) { // only what was created: the worktree, the history files and the directory
+        bisectGit(NULL, 0, "worktree", "remove", "--force", bisect_tree, NULL, NULL);
+        char hist[600];
+        snprintf(hist, sizeof(hist), "%s/%s.hist", bisect_work, good);
+        unlink(hist);
+        for (uint32_t i = 0; i < n; i++) {
+            snprintf(hist, sizeof(hist), "%s/%s.hist", bisect_work, shas[i]);
+            unlink(hist);
+        }
+        if (rmdir(bisect_work) != 0) LOG_WARN("BISECT: %s is not empty, left in place\n", bisect_work);
+    } else {
+        MSG(BLUE, "work directory kept: %s\n", bisect_work);
+    }
+    free(shas);
+    free(state);
+    return rc;
+}
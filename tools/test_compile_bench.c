@@ -0,0 +1,156 @@
+/**
+ * @file test_compile_bench.c
+ *
+ * @brief Compile-time benchmark of the assertion expansion modes.
+ *
+ * @details
+ * Generates a test file with a large number of assertions and compiles it
+ * with the default expansion and with TEST_LIGHT_ASSERTS, at each requested
+ * optimization level. Reports the best of several compile times and the
+ * object size of every combination. Run through the `compile_bench` CMake
+ * target, or directly:
+ *
+ * @code
+ * test_compile_bench -c cc -I include -n 20000 -O0 -O2
+ * @endcode
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_clock.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#define CB_MAX_OPTS 8
+#define CB_PER_FUNCTION 100 // assertions per generated test function
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Write the generated test file.
+ */
+static bool cbGenerate(const char* path, unsigned asserts) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    unsigned functions = (asserts + CB_PER_FUNCTION - 1) / CB_PER_FUNCTION;
+    fprintf(f, "#include \"test_utils.h\"\n\nvolatile int v[256];\nvolatile char c[256];\nint* volatile p;\n\n");
+    for (unsigned fn = 0, a = 0; fn < functions; fn++) {
+        fprintf(f, "static void test%u(void) {\n    TEST_CASE(\"block %u\");\n", fn, fn);
+        for (unsigned i = 0; i < CB_PER_FUNCTION && a < asserts; i++, a++) {
+            switch (a % 4) {
+            case 0: fprintf(f, "    ASSERT_EQUAL_INT(v[%u], %u, \"v[%%d]\", %u);\n", a % 256, a, a % 256); break;
+            case 1: fprintf(f, "    ASSERT_TRUE(v[%u] <= %u, \"bounded\");\n", a % 256, a); break;
+            case 2: fprintf(f, "    ASSERT_NOT_EQUAL_CHAR(c[%u], 'x', \"char %%u\", %uu);\n", a % 256, a); break;
+            case 3: fprintf(f, "    ASSERT_NOT_NULL(p + %u, \"pointer\");\n", a % 256); break;
+            }
+        }
+        fprintf(f, "    CASE_COMPLETE;\n}\n\n");
+    }
+    fprintf(f, "int main(void) {\n");
+    for (unsigned fn = 0; fn < functions; fn++) fprintf(f, "    TEST_EVAL(test%u);\n", fn);
+    fprintf(f, "    return testGetStatus();\n}\n");
+    return fclose(f) == 0;
+}
+
+/**
+ * @brief Compile the generated file once.
+ *
+ * @return The compile time in ns, or 0 on failure.
+ */
+static uint64_t cbCompile(const char* cc, const char* include, const char* opt, bool light, const char* src,
+                          const char* obj) {
+    char inc[1024], level[32];
+    snprintf(inc, sizeof(inc), "-I%s", include);
+    snprintf(level, sizeof(level), "-O%s", opt);
+    char* argv[10];
+    int argc = 0;
+    argv[argc++] = (char*)cc;
+    argv[argc++] = inc;
+    argv[argc++] = level;
+    if (light) argv[argc++] = "-DTEST_LIGHT_ASSERTS";
+    argv[argc++] = "-c";
+    argv[argc++] = (char*)src;
+    argv[argc++] = "-o";
+    argv[argc++] = (char*)obj;
+    argv[argc] = NULL;
+    uint64_t t0 = testClockNs();
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(cc, argv);
+        _exit(127);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status)) return 0;
+    return testClockNs() - t0;
+}
+
+int main(int argc, char** argv) {
+    const char* cc = "cc";
+    const char* include = "include";
+    const char* work = ".";
+    const char* opts[CB_MAX_OPTS];
+    unsigned asserts = 20000, repeat = 3, nopts = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:I:n:r:w:O:")) != -1) {
+        switch (opt) {
+        case 'c': cc = optarg; break;
+        case 'I': include = optarg; break;
+        case 'n': asserts = (unsigned)atoi(optarg); break;
+        case 'r': repeat = (unsigned)atoi(optarg); break;
+        case 'w': work = optarg; break;
+        case 'O': if (nopts < CB_MAX_OPTS) opts[nopts++] = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-c CC] [-I INCLUDE] [-n ASSERTS] [-r REPEAT] [-w DIR] [-OLEVEL]...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!nopts) {
+        opts[nopts++] = "0";
+        opts[nopts++] = "2";
+    }
+    if (!repeat) repeat = 1;
+
+    char src[1024], obj[1024];
+    mkdir(work, 0755);
+    snprintf(src, sizeof(src), "%s/compile_bench.c", work);
+    snprintf(obj, sizeof(obj), "%s/compile_bench.o", work);
+    if (!cbGenerate(src, asserts)) {
+        LOG_ERROR("COMPILE_BENCH: cannot write %s\n", src);
+        return 1;
+    }
+    MSG(MAGENTA, "compile time of %u assertions (%s, best of %u):\n", asserts, cc, repeat);
+    depth++;
+    int rc = 0;
+    for (unsigned o = 0; o < nopts; o++) {
+        uint64_t best[2] = { 0, 0 };
+        off_t size[2] = { 0, 0 };
+        for (int light = 0; light < 2; light++) {
+            for (unsigned r = 0; r < repeat; r++) {
+                uint64_t ns = cbCompile(cc, include, opts[o], light, src, obj);
+                if (!ns) {
+                    LOG_ERROR("COMPILE_BENCH: %s -O%s failed\n", cc, opts[o]);
+                    rc = 1;
+                    break;
+                }
+                if (!best[light] || ns < best[light]) best[light] = ns;
+            }
+            struct stat st;
+            if (stat(obj, &st) == 0) size[light] = st.st_size;
+            unlink(obj);
+        }
+        char d[16], l[16];
+        printIndent();
+        MSG(CYAN, "-O%-2s default %9s %8lld KiB | light %9s %8lld KiB | %.2fx faster, %.2fx smaller\n", opts[o],
+            testFormatNs(d, sizeof(d), (double)best[0]), (long long)size[0] / 1024,
+            testFormatNs(l, sizeof(l), (double)best[1]), (long long)size[1] / 1024,
+            best[1] ? (double)best[0] / (double)best[1] : 0.0, size[1] ? (double)size[0] / (double)size[1] : 0.0);
+    }
+    depth--;
+    return rc;
+}
@@ -0,0 +1,233 @@
+/**
+ * @file test_history.c
+ *
+ * @brief Change-point analysis of a benchmark history file.
+ *
+ * @details
+ * Reads a history written through test_utils_history.h, splits it into one
+ * series per benchmark and machine, and runs PELT over the log of the
+ * medians, so shifts are found relative to the benchmark's own noise and
+ * reported as percentages. For every shift it prints the run that
+ * introduced it (index, commit and date) and the segment medians before and
+ * after it:
+ *
+ * @code
+ * test_history -f bench.hist            # analyze every series
+ * test_history -f bench.hist -b sort -v # one benchmark, with its runs
+ * test_history -f bench.hist -l         # list the series
+ * @endcode
+ *
+ * Options: `-p` the penalty per change point as a multiple of ln(n) (default
+ * 2), `-m` the minimum runs per segment (default 3), `-e` the smallest shift
+ * in percent worth reporting (default 0.5). The exit status is 1 when the
+ * last segment of any series is a slowdown, i.e. the latest runs are still
+ * regressed.
+ *
+ * With `-c BASE:NEW` the tool instead compares, per series, the latest run
+ * recorded with commit ID BASE against the latest recorded with NEW, e.g. a
+ * plain and a profile-optimized build (see cmake/TestUtilsPGO.cmake). A
+ * difference counts when it exceeds the combined 95% intervals of the two
+ * means; the exit status is 1 when NEW is significantly slower anywhere.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+#include "test_utils_clock.h"
+#include "test_utils_history.h"
+
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Format the wall clock time of a record.
+ */
+static char* histDate(char* buf, size_t len, uint64_t time_ns) {
+    time_t t = (time_t)(time_ns / 1000000000ull);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(buf, len, "%Y-%m-%d %H:%M", &tm);
+    return buf;
+}
+
+/**
+ * @brief Median of the medians of runs [from, to) of a series.
+ */
+static double histSegment(const HistoryRecord* recs, const uint32_t* idx, uint32_t from, uint32_t to,
+                          double* scratch) {
+    for (uint32_t i = from; i < to; i++) scratch[i - from] = recs[idx[i]].median;
+    return benchMedian(scratch, to - from);
+}
+
+/**
+ * @brief Analyze one series and print its change points.
+ *
+ * @return true if the latest segment is a slowdown.
+ */
+static bool histAnalyze(const HistoryRecord* recs, const uint32_t* idx, uint32_t n, double penalty,
+                        uint32_t min_seg, double min_pct, bool verbose) {
+    double* y = (double*)malloc(n * sizeof(double));
+    double* scratch = (double*)malloc(n * sizeof(double));
+    uint32_t* cps = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    char date[32], before[16], after[16];
+    bool regressed = false;
+    if (!y || !scratch || !cps) {
+        free(y);
+        free(scratch);
+        free(cps);
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) y[i] = log(recs[idx[i]].median > 0 ? recs[idx[i]].median : 1e-9);
+
+    MSG(MAGENTA, "%s @ %016llx (%u runs):\n", recs[idx[0]].name, (unsigned long long)recs[idx[0]].machine, n);
+    depth++;
+    if (verbose) {
+        for (uint32_t i = 0; i < n; i++) {
+            const HistoryRecord* r = &recs[idx[i]];
+            char med[16];
+            printIndent();
+            MSG(RESET, "#%-4u %s  %-12s %s/op\n", i, histDate(date, sizeof(date), r->time_ns), r->commit,
+                testFormatNs(med, sizeof(med), r->median));
+        }
+    }
+    uint32_t found = historyChangePoints(y, n, penalty, min_seg, cps), reported = 0;
+    for (uint32_t c = 0; c < found; c++) {
+        uint32_t from = c ? cps[c - 1] : 0, at = cps[c], to = c + 1 < found ? cps[c + 1] : n;
+        double a = histSegment(recs, idx, from, at, scratch);
+        double b = histSegment(recs, idx, at, to, scratch);
+        double pct = 100.0 * (b - a) / a;
+        if (fabs(pct) < min_pct) continue;
+        const HistoryRecord* r = &recs[idx[at]];
+        testFormatNs(before, sizeof(before), a);
+        testFormatNs(after, sizeof(after), b);
+        histDate(date, sizeof(date), r->time_ns);
+        printIndent();
+        if (pct > 0)
+            MSG(YELLOW, "run #%u (commit %s, %s): %s -> %s/op, %+.1f%% slower\n", at, r->commit, date, before,
+                after, pct);
+        else
+            MSG(GREEN, "run #%u (commit %s, %s): %s -> %s/op, %.1f%% faster\n", at, r->commit, date, before,
+                after, -pct);
+        reported++;
+        if (c + 1 == found && pct > 0) regressed = true;
+    }
+    if (!reported) {
+        printIndent();
+        MSG(CYAN, "no significant shift\n");
+    }
+    depth--;
+    free(y);
+    free(scratch);
+    free(cps);
+    return regressed;
+}
+
+/**
+ * @brief Compare the latest runs of two commits in one series.
+ *
+ * @return true if the run of `head` is significantly slower than the run of `base`.
+ */
+static bool histCompare(const HistoryRecord* recs, const uint32_t* idx, uint32_t n, const char* base,
+                        const char* head) {
+    const HistoryRecord* a = NULL;
+    const HistoryRecord* b = NULL;
+    for (uint32_t i = 0; i < n; i++) {
+        if (strcmp(recs[idx[i]].commit, base) == 0) a = &recs[idx[i]];
+        if (strcmp(recs[idx[i]].commit, head) == 0) b = &recs[idx[i]];
+    }
+    if (!a || !b) return false;
+    char am[16], bm[16];
+    double pct = 100.0 * (b->median - a->median) / a->median;
+    bool significant = fabs(b->mean - a->mean) > sqrt(a->ci95 * a->ci95 + b->ci95 * b->ci95);
+    testFormatNs(am, sizeof(am), a->median);
+    testFormatNs(bm, sizeof(bm), b->median);
+    printIndent();
+    if (significant && pct > 0)
+        MSG(YELLOW, "%-32s %s: %s/op, %s: %s/op, %+.1f%% slower\n", a->name, base, am, head, bm, pct);
+    else if (significant)
+        MSG(GREEN, "%-32s %s: %s/op, %s: %s/op, %.1f%% faster\n", a->name, base, am, head, bm, -pct);
+    else
+        MSG(CYAN, "%-32s %s: %s/op, %s: %s/op, no significant difference\n", a->name, base, am, head, bm);
+    return significant && pct > 0;
+}
+
+int main(int argc, char** argv) {
+    const char* path = getenv("TEST_BENCH_HISTORY");
+    const char* only = NULL;
+    char* base = NULL;
+    char* head = NULL;
+    double penalty = 2.0, min_pct = 0.5;
+    uint32_t min_seg = 3;
+    bool list = false, verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:b:p:m:e:c:lv")) != -1) {
+        switch (opt) {
+        case 'f': path = optarg; break;
+        case 'b': only = optarg; break;
+        case 'p': penalty = atof(optarg); break;
+        case 'm': min_seg = (uint32_t)atoi(optarg); break;
+        case 'e': min_pct = atof(optarg); break;
+        case 'c':
+            base = optarg;
+            head = strchr(optarg, ':');
+            if (head) *head++ = '\0';
+            break;
+        case 'l': list = true; break;
+        case 'v': verbose = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-f FILE] [-b BENCH] [-p PENALTY] [-m MIN_RUNS] [-e MIN_PCT] [-c BASE:NEW] [-l] [-v]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (base && (!head || !*base || !*head)) {
+        LOG_ERROR("HISTORY: -c expects BASE:NEW\n");
+        return 2;
+    }
+    if (!path || !*path) {
+        LOG_ERROR("HISTORY: no history file (-f or TEST_BENCH_HISTORY)\n");
+        return 2;
+    }
+    uint32_t count = 0;
+    HistoryRecord* recs = historyLoad(path, &count);
+    if (!recs) {
+        LOG_ERROR("HISTORY: cannot read %s\n", path);
+        return 2;
+    }
+
+    // group into series by benchmark and machine, in order of first appearance
+    uint32_t* idx = (uint32_t*)malloc((count ? count : 1) * sizeof(uint32_t));
+    bool* done = (bool*)calloc(count ? count : 1, sizeof(bool));
+    bool regressed = false;
+    uint32_t series = 0;
+    for (uint32_t i = 0; idx && done && i < count; i++) {
+        if (done[i] || (only && strcmp(recs[i].name, only) != 0)) continue;
+        uint32_t n = 0;
+        for (uint32_t j = i; j < count; j++) {
+            if (done[j] || recs[j].machine != recs[i].machine || strcmp(recs[j].name, recs[i].name) != 0) continue;
+            done[j] = true;
+            idx[n++] = j;
+        }
+        series++;
+        if (list) {
+            char date[32], med[16];
+            const HistoryRecord* r = &recs[idx[n - 1]];
+            MSG(CYAN, "%-32s %016llx %5u runs, latest %s (%s) %s/op\n", r->name, (unsigned long long)r->machine, n,
+                histDate(date, sizeof(date), r->time_ns), r->commit, testFormatNs(med, sizeof(med), r->median));
+            continue;
+        }
+        if (base) {
+            if (histCompare(recs, idx, n, base, head)) regressed = true;
+            continue;
+        }
+        if (histAnalyze(recs, idx, n, penalty, min_seg, min_pct, verbose)) regressed = true;
+    }
+    if (!series) LOG_WARN("HISTORY: no matching series in %s\n", path);
+    free(idx);
+    free(done);
+    free(recs);
+    return regressed ? 1 : 0;
+}
@@ -0,0 +1,648 @@
+/**
+ * @file test_mutate.c
+ *
+ * @brief Parallel mutation testing driver.
+ *
+ * @details
+ * Applies source-level mutations to the code under test, rebuilds and runs
+ * the tests once per mutant, and reports which mutants the tests failed to
+ * detect. The mutations are:
+ *
+ * - relational: `<` <-> `<=`, `>` <-> `>=`, `==` <-> `!=`, `&&` <-> `||`.
+ * - constant: integer literal 0 -> 1, 1 -> 0, n -> n + 1.
+ * - drop: an expression statement (assignment, call, increment) is removed.
+ *
+ * Comments, string and character literals and preprocessor lines are never
+ * mutated. Every job slot gets its own copy of the source tree, built once up
+ * front, so each mutant costs an incremental rebuild. A mutant is killed when
+ * the test command fails or times out, survives when it passes and is invalid
+ * when it does not build. Tests run with TEST_FAIL_FAST=1, so a test_utils
+ * binary exits at the first failed case.
+ *
+ * @code
+ * test_mutate -j 8 -b "cmake -S . -B _mut && cmake --build _mut" \
+ *             -t "_mut/tests" src/ring.c src/hash.c
+ * @endcode
+ *
+ * The score of a file is killed / (killed + survived). The exit status is 1
+ * when the overall score is below `-m`.
+ *
+ * @author Nicholas Schneider
+ */
+
+#include "test_utils.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* -- Defines -------------------------------------------------------------*/
+
+#define MUT_MAX_FILES 256
+#define MUT_MAX_JOBS 64
+
+/* -- typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief The kind of a mutation.
+ */
+typedef enum {
+    MUT_RELATIONAL,
+    MUT_CONSTANT,
+    MUT_DROP,
+} MutKind;
+
+/**
+ * @brief The outcome of a mutant.
+ */
+typedef enum {
+    MUT_PENDING,
+    MUT_KILLED,     // the tests failed.
+    MUT_TIMEOUT,    // the tests did not finish in time (counts as killed).
+    MUT_SURVIVED,   // the tests passed.
+    MUT_INVALID,    // the mutant did not build.
+} MutStatus;
+
+/**
+ * @brief A single mutation of a source file.
+ */
+typedef struct {
+    uint32_t file;
+    uint32_t line;
+    size_t off;         // start of the replaced text.
+    size_t len;         // length of the replaced text.
+    char repl[32];      // replacement text.
+    char orig[48];      // original text, shortened for the report.
+    MutKind kind;
+    MutStatus status;
+} Mutant;
+
+/**
+ * @brief A source file under mutation.
+ */
+typedef struct {
+    const char* path;   // relative to the source root.
+    char* data;
+    size_t size;
+    uint32_t counts[MUT_INVALID + 1];
+} MutFile;
+
+/* -- Global Variables ----------------------------------------------------- */
+
+MutFile mut_files[MUT_MAX_FILES];
+uint32_t mut_file_count = 0;
+Mutant* mutants = NULL;
+size_t mutant_count = 0;
+size_t mutant_cap = 0;
+
+const char* mut_build = NULL;   // build command, run in the slot directory.
+const char* mut_test = NULL;    // test command, run in the slot directory.
+const char* mut_root = ".";     // source tree copied into every slot.
+char mut_work[512] = "";        // directory holding the slots.
+unsigned mut_timeout = 60;      // seconds before a test run counts as a timeout.
+
+static const char* mut_kind_names[] = { "relational", "constant", "drop" };
+
+/* -- Function Declarations ----------------------------------------------- */
+
+/**
+ * @brief Append a mutant.
+ */
+static void mutAdd(uint32_t file, uint32_t line, size_t off, size_t len, const char* repl, MutKind kind) {
+    if (mutant_count == mutant_cap) {
+        mutant_cap = mutant_cap ? mutant_cap * 2 : 1024;
+        mutants = (Mutant*)realloc(mutants, mutant_cap * sizeof(Mutant));
+        if (!mutants) {
+            LOG_ERROR("out of memory\n");
+            exit(2);
+        }
+    }
+    Mutant* m = &mutants[mutant_count++];
+    memset(m, 0, sizeof(Mutant));
+    m->file = file;
+    m->line = line;
+    m->off = off;
+    m->len = len;
+    m->kind = kind;
+    snprintf(m->repl, sizeof(m->repl), "%s", repl);
+    const char* src = mut_files[file].data + off;
+    size_t k = 0;
+    for (size_t i = 0; i < len && k < sizeof(m->orig) - 4; i++) {
+        char c = isspace((unsigned char)src[i]) ? ' ' : src[i];
+        if (c == ' ' && k && m->orig[k - 1] == ' ') continue;
+        m->orig[k++] = c;
+    }
+    if (k < len && k >= sizeof(m->orig) - 4) memcpy(m->orig + k, "...", 4);
+    else m->orig[k] = '\0';
+}
+
+/**
+ * @brief Is a statement safe to drop: an expression statement, not a declaration or jump.
+ */
+static bool mutDroppable(const char* s, size_t len) {
+    static const char* keywords[] = {
+        "return", "break", "continue", "goto", "case", "default", "if", "else", "for", "while", "do",
+        "switch", "typedef", "struct", "union", "enum", "static", "const", "volatile", "register",
+        "extern", "int", "char", "short", "long", "unsigned", "signed", "float", "double", "void",
+        "bool", "_Bool", "auto", "inline", "_Static_assert", "static_assert",
+    };
+    size_t i = 0, word;
+    while (i < len && isspace((unsigned char)s[i])) i++;
+    if (i == len || !(isalpha((unsigned char)s[i]) || s[i] == '_' || s[i] == '*' || s[i] == '(' ||
+                      s[i] == '+' || s[i] == '-'))
+        return false;
+    word = i;
+    while (i < len && (isalnum((unsigned char)s[i]) || s[i] == '_')) i++;
+    for (size_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++)
+        if (strlen(keywords[k]) == i - word && !strncmp(s + word, keywords[k], i - word)) return false;
+    size_t j = i;
+    while (j < len && isspace((unsigned char)s[j])) j++;
+    // "Type name", "Type* name" and "label:" are not expression statements
+    if (i > word && j < len && (isalpha((unsigned char)s[j]) || s[j] == '_' || s[j] == ':')) return false;
+    if (i > word && j < len && s[j] == '*') {
+        size_t k = j + 1;
+        while (k < len && (s[k] == '*' || isspace((unsigned char)s[k]))) k++;
+        if (k < len && (isalpha((unsigned char)s[k]) || s[k] == '_')) return false;
+    }
+    for (size_t k = 0; k + 1 < len; k++) {
+        if (s[k] == '(' || (s[k] == '+' && s[k + 1] == '+') || (s[k] == '-' && s[k + 1] == '-')) return true;
+        if (s[k] == '=' && s[k + 1] != '=' && (!k || !strchr("=!<>", s[k - 1]))) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Is a token one of a '|' separated list of words.
+ */
+static bool mutIsWord(const char* tok, size_t len, const char* words) {
+    for (const char* w = words; *w; ) {
+        size_t wl = strcspn(w, "|");
+        if (wl == len && !strncmp(tok, w, len)) return true;
+        w += wl + (w[wl] == '|');
+    }
+    return false;
+}
+
+/**
+ * @brief Collect the mutants of a file.
+ */
+static void mutScan(uint32_t file) {
+    static const char* ops3[] = { "<<=", ">>=", "..." };
+    static const char* ops2[] = { "<=", ">=", "==", "!=", "&&", "||", "<<", ">>", "->", "++", "--",
+                                  "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=" };
+    static const char* swaps[][2] = { { "<", "<=" }, { "<=", "<" }, { ">", ">=" }, { ">=", ">" },
+                                      { "==", "!=" }, { "!=", "==" }, { "&&", "||" }, { "||", "&&" } };
+    const char* s = mut_files[file].data;
+    size_t n = mut_files[file].size, stmt = 0;
+    uint32_t line = 1, stmt_line = 1;
+    int braces = 0, parens = 0;
+    bool line_start = true, in_fn = false; // only function bodies are mutated
+    bool stmt_empty = true; // no token of the current statement seen yet
+    bool ctrl = false; // inside the parentheses of if/for/while/switch
+    char prev = 0; // last significant character
+
+    for (size_t i = 0; i < n; ) {
+        char c = s[i];
+        if (c == '\n') {
+            line++;
+            line_start = true;
+            i++;
+            continue;
+        }
+        if (isspace((unsigned char)c)) {
+            i++;
+            continue;
+        }
+        if (c == '#' && line_start) { // preprocessor line, with continuations
+            while (i < n && s[i] != '\n') {
+                if (s[i] == '\\' && i + 1 < n && s[i + 1] == '\n') {
+                    line++;
+                    i++;
+                }
+                i++;
+            }
+            continue;
+        }
+        line_start = false;
+        if (c == '/' && i + 1 < n && s[i + 1] == '/') {
+            while (i < n && s[i] != '\n') i++;
+            continue;
+        }
+        if (c == '/' && i + 1 < n && s[i + 1] == '*') {
+            for (i += 2; i + 1 < n && !(s[i] == '*' && s[i + 1] == '/'); i++)
+                if (s[i] == '\n') line++;
+            i += 2;
+            continue;
+        }
+        if (stmt_empty) {
+            stmt = i;
+            stmt_line = line;
+            stmt_empty = false;
+        }
+        if (c == '"' || c == '\'') {
+            for (i++; i < n && s[i] != c; i++) {
+                if (s[i] == '\\') i++;
+                else if (s[i] == '\n') line++;
+            }
+            i++;
+            prev = c;
+            continue;
+        }
+        if (isalpha((unsigned char)c) || c == '_') {
+            size_t start = i;
+            while (i < n && (isalnum((unsigned char)s[i]) || s[i] == '_')) i++;
+            prev = 'a';
+            // the body of a control statement starts a new statement
+            if (parens == 0 && mutIsWord(s + start, i - start, "if|for|while|switch")) ctrl = true;
+            if (mutIsWord(s + start, i - start, "else|do")) stmt_empty = true;
+            continue;
+        }
+        if (isdigit((unsigned char)c)) {
+            size_t start = i;
+            while (i < n && (isalnum((unsigned char)s[i]) || s[i] == '_' || s[i] == '.' ||
+                             ((s[i] == '+' || s[i] == '-') && strchr("eEpP", s[i - 1]))))
+                i++;
+            char lit[64], repl[32];
+            size_t len = i - start;
+            prev = '0';
+            if (!in_fn || len >= sizeof(lit)) continue;
+            memcpy(lit, s + start, len);
+            lit[len] = '\0';
+            bool hex = len > 1 && lit[0] == '0' && (lit[1] == 'x' || lit[1] == 'X');
+            if (strpbrk(lit, hex ? ".pP" : ".eEfF")) continue; // floating point
+            char* end;
+            errno = 0;
+            unsigned long long v = strtoull(lit, &end, 0);
+            if (errno || (*end && strspn(end, "uUlL") != strlen(end))) continue;
+            if (v == 0) snprintf(repl, sizeof(repl), "1%s", end);
+            else if (v == 1) snprintf(repl, sizeof(repl), "0%s", end);
+            else if (v == ~0ull) continue;
+            else snprintf(repl, sizeof(repl), hex ? "0x%llx%s" : "%llu%s", v + 1, end);
+            mutAdd(file, line, start, len, repl, MUT_CONSTANT);
+            continue;
+        }
+
+        size_t len = 1;
+        for (size_t k = 0; k < sizeof(ops3) / sizeof(ops3[0]) && len == 1; k++)
+            if (!strncmp(s + i, ops3[k], 3)) len = 3;
+        for (size_t k = 0; k < sizeof(ops2) / sizeof(ops2[0]) && len == 1; k++)
+            if (!strncmp(s + i, ops2[k], 2)) len = 2;
+        if (in_fn) {
+            for (size_t k = 0; k < sizeof(swaps) / sizeof(swaps[0]); k++)
+                if (strlen(swaps[k][0]) == len && !strncmp(s + i, swaps[k][0], len))
+                    mutAdd(file, line, i, len, swaps[k][1], MUT_RELATIONAL);
+        }
+        if (len == 1) {
+            if (c == '(') parens++;
+            else if (c == ')' && parens > 0 && --parens == 0 && ctrl) {
+                ctrl = false;
+                stmt_empty = true;
+            }
+            else if (c == '{' || c == '}') {
+                if (c == '{' && braces == 0) in_fn = prev == ')';
+                braces += c == '{' ? 1 : -1;
+                if (braces <= 0) in_fn = false;
+                parens = 0;
+            } else if (c == ';' && parens == 0 && in_fn && mutDroppable(s + stmt, i - stmt)) {
+                mutAdd(file, stmt_line, stmt, i + 1 - stmt, ";", MUT_DROP);
+            }
+            if ((c == ';' && parens == 0) || c == '{' || c == '}') stmt_empty = true;
+        }
+        prev = s[i + len - 1];
+        i += len;
+    }
+}
+
+/**
+ * @brief Read a whole file.
+ */
+static char* mutRead(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    char* data = NULL;
+    long len = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+    if (len >= 0 && fseek(f, 0, SEEK_SET) == 0 && (data = (char*)malloc((size_t)len + 1))) {
+        if (fread(data, 1, (size_t)len, f) != (size_t)len) {
+            free(data);
+            data = NULL;
+        } else {
+            data[len] = '\0';
+            *size = (size_t)len;
+        }
+    }
+    fclose(f);
+    return data;
+}
+
+/**
+ * @brief Write a file, optionally with one mutation applied.
+ */
+static bool mutWrite(const char* path, const MutFile* f, const Mutant* m) {
+    FILE* out = fopen(path, "wb");
+    if (!out) return false;
+    bool ok;
+    if (m) {
+        ok = fwrite(f->data, 1, m->off, out) == m->off &&
+             fputs(m->repl, out) >= 0 &&
+             fwrite(f->data + m->off + m->len, 1, f->size - m->off - m->len, out) == f->size - m->off - m->len;
+    } else {
+        ok = fwrite(f->data, 1, f->size, out) == f->size;
+    }
+    return fclose(out) == 0 && ok;
+}
+
+/**
+ * @brief Run a command, silenced, in a directory.
+ *
+ * @param argv The command, or NULL to run `sh -c cmd`.
+ * @param cmd The shell command when argv is NULL.
+ * @param dir The working directory, or NULL.
+ * @param timeout Seconds before the command's process group is killed, 0 for none.
+ * @return The exit status, 128 + signal if killed by a signal, -1 on timeout.
+ */
+static int mutExec(char* const* argv, const char* cmd, const char* dir, unsigned timeout) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        setpgid(0, 0);
+        if (null >= 0) {
+            dup2(null, STDIN_FILENO);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        if (dir && chdir(dir) != 0) _exit(127);
+        if (argv) execvp(argv[0], argv);
+        else execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+        _exit(127);
+    }
+    if (pid < 0) return 127;
+    struct timespec poll = { 0, 10 * 1000 * 1000 };
+    time_t deadline = time(NULL) + (time_t)timeout;
+    int status;
+    for (;;) {
+        pid_t r = waitpid(pid, &status, timeout ? WNOHANG : 0);
+        if (r == pid) break;
+        if (r < 0 && errno != EINTR) return 127;
+        if (timeout && time(NULL) >= deadline) {
+            kill(-pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+        if (r == 0) nanosleep(&poll, NULL);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/**
+ * @brief Directory of job slot k.
+ */
+static void mutSlot(char* buf, size_t len, unsigned k) {
+    snprintf(buf, len, "%s/slot%u", mut_work, k);
+}
+
+/**
+ * @brief Worker: build and test one mutant in a slot, exit with its outcome.
+ */
+static void mutWorker(const Mutant* m, unsigned slot) {
+    char dir[600], path[1200];
+    mutSlot(dir, sizeof(dir), slot);
+    snprintf(path, sizeof(path), "%s/%s", dir, mut_files[m->file].path);
+    if (!mutWrite(path, &mut_files[m->file], m)) _exit(MUT_INVALID);
+    if (mutExec(NULL, mut_build, dir, 0) != 0) _exit(MUT_INVALID);
+    int rc = mutExec(NULL, mut_test, dir, mut_timeout);
+    _exit(rc < 0 ? MUT_TIMEOUT : rc == 0 ? MUT_SURVIVED : MUT_KILLED);
+}
+
+/**
+ * @brief Copy the source tree into every slot and build it once.
+ *
+ * @return true if every slot built and the unmutated tests pass.
+ */
+static bool mutSetup(unsigned jobs) {
+    char dir[600], src[600];
+    pid_t pids[MUT_MAX_JOBS];
+    bool ok = true;
+    snprintf(src, sizeof(src), "%s/.", mut_root);
+    char* mkdir_argv[] = { "mkdir", "-p", mut_work, NULL };
+    if (mutExec(mkdir_argv, NULL, NULL, 0) != 0) return false;
+    fflush(NULL);
+    for (unsigned k = 0; k < jobs; k++) {
+        pids[k] = fork();
+        if (pids[k] == 0) {
+            mutSlot(dir, sizeof(dir), k);
+            char* cp_argv[] = { "cp", "-a", src, dir, NULL };
+            _exit(mutExec(cp_argv, NULL, NULL, 0) == 0 && mutExec(NULL, mut_build, dir, 0) == 0 ? 0 : 1);
+        }
+    }
+    for (unsigned k = 0; k < jobs; k++) {
+        int status = 1;
+        if (pids[k] > 0) waitpid(pids[k], &status, 0);
+        ok = ok && pids[k] > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    if (!ok) {
+        LOG_ERROR("MUTATE: copying or building the unmutated tree failed (%s)\n", mut_build);
+        return false;
+    }
+    mutSlot(dir, sizeof(dir), 0);
+    if (mutExec(NULL, mut_test, dir, mut_timeout) != 0) {
+        LOG_ERROR("MUTATE: the tests fail without mutations (%s)\n", mut_test);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Build and test every mutant, jobs at a time.
+ */
+static void mutRunAll(unsigned jobs) {
+    pid_t pids[MUT_MAX_JOBS] = { 0 };
+    size_t which[MUT_MAX_JOBS];
+    size_t next = 0, done = 0, counts[MUT_INVALID + 1] = { 0 };
+    fflush(NULL);
+    while (done < mutant_count) {
+        for (unsigned k = 0; k < jobs && next < mutant_count; k++) {
+            if (pids[k]) continue;
+            pid_t pid = fork();
+            if (pid == 0) mutWorker(&mutants[next], k);
+            if (pid < 0) break;
+            pids[k] = pid;
+            which[k] = next++;
+        }
+        // wait on the workers only, never on children the tool did not start
+        struct timespec poll = { 0, 10 * 1000 * 1000 };
+        int status = 0;
+        pid_t pid = 0;
+        unsigned running = 0;
+        bool lost = false;
+        for (unsigned k = 0; k < jobs && pid <= 0; k++) {
+            if (!pids[k]) continue;
+            running++;
+            pid = waitpid(pids[k], &status, WNOHANG);
+            if (pid < 0 && errno != EINTR) { // lost the worker: count its mutant as invalid
+                lost = true;
+                pid = pids[k];
+            }
+        }
+        if (!running) {
+            LOG_ERROR("MUTATE: cannot fork a worker\n");
+            break;
+        }
+        if (pid <= 0) {
+            nanosleep(&poll, NULL);
+            continue;
+        }
+        for (unsigned k = 0; k < jobs; k++) {
+            if (pids[k] != pid) continue;
+            Mutant* m = &mutants[which[k]];
+            char path[1200];
+            mutSlot(path, sizeof(path), k);
+            snprintf(path + strlen(path), sizeof(path) - strlen(path), "/%s", mut_files[m->file].path);
+            mutWrite(path, &mut_files[m->file], NULL); // restore the slot
+            m->status = !lost && WIFEXITED(status) && WEXITSTATUS(status) <= MUT_INVALID ? (MutStatus)WEXITSTATUS(status)
+                                                                                 : MUT_INVALID;
+            mut_files[m->file].counts[m->status]++;
+            counts[m->status]++;
+            done++;
+            pids[k] = 0;
+            if (m->status == MUT_SURVIVED) {
+                printIndent();
+                MSG(YELLOW, "survived %s:%u: %s `%s` -> `%s`\n", mut_files[m->file].path, m->line,
+                    mut_kind_names[m->kind], m->orig, m->repl);
+            }
+            if (done % 10 == 0 || done == mutant_count) {
+                printIndent();
+                MSG(CYAN, "[%zu/%zu] %zu killed, %zu timed out, %zu survived, %zu invalid\n", done, mutant_count,
+                    counts[MUT_KILLED], counts[MUT_TIMEOUT], counts[MUT_SURVIVED], counts[MUT_INVALID]);
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Print the per-file scores and surviving mutants.
+ *
+ * @return The overall mutation score in percent.
+ */
+static double mutReport(void) {
+    uint32_t killed = 0, survived = 0;
+    MSG(MAGENTA, "mutation score:\n");
+    depth++;
+    for (uint32_t f = 0; f < mut_file_count; f++) {
+        const MutFile* mf = &mut_files[f];
+        uint32_t k = mf->counts[MUT_KILLED] + mf->counts[MUT_TIMEOUT], s = mf->counts[MUT_SURVIVED];
+        double score = k + s ? 100.0 * k / (k + s) : 100.0;
+        killed += k;
+        survived += s;
+        printIndent();
+        if (s)
+            MSG(YELLOW, "%-40s %5.1f%%  (%u killed, %u survived, %u invalid)\n", mf->path, score, k, s,
+                mf->counts[MUT_INVALID]);
+        else
+            MSG(GREEN, "%-40s %5.1f%%  (%u killed, %u invalid)\n", mf->path, score, k, mf->counts[MUT_INVALID]);
+        for (size_t i = 0; i < mutant_count; i++) {
+            const Mutant* m = &mutants[i];
+            if (m->file != f || m->status != MUT_SURVIVED) continue;
+            printIndent();
+            MSG(YELLOW, "  %s:%u: %s `%s` -> `%s`\n", mf->path, m->line, mut_kind_names[m->kind], m->orig,
+                m->repl);
+        }
+    }
+    double total = killed + survived ? 100.0 * killed / (killed + survived) : 100.0;
+    printIndent();
+    if (survived)
+        MSG(YELLOW, "total %5.1f%% (%u of %u valid mutants killed)\n", total, killed, killed + survived);
+    else
+        MSG(GREEN, "total %5.1f%% (%u of %u valid mutants killed)\n", total, killed, killed + survived);
+    depth--;
+    return total;
+}
+
+/**
+ * @brief Print usage.
+ */
+static void mutUsage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s -b BUILD -t TEST [options] FILE...\n"
+            "  -b BUILD   shell command building the tree (run in each slot)\n"
+            "  -t TEST    shell command running the tests (run in each slot)\n"
+            "  -r ROOT    source tree to copy, FILEs are relative to it (default .)\n"
+            "  -j JOBS    parallel slots (default: online CPUs)\n"
+            "  -T SECS    test timeout, counted as killed (default 60)\n"
+            "  -n MAX     test at most MAX mutants, evenly spaced\n"
+            "  -m SCORE   exit with 1 if the total score is below SCORE percent\n"
+            "  -w DIR     work directory for the slots (default $TMPDIR/test_mutate.PID)\n"
+            "  -k         keep the work directory\n",
+            argv0);
+}
+
+int main(int argc, char** argv) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max = 0;
+    double min_score = 0;
+    bool keep = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:t:r:j:T:n:m:w:kh")) != -1) {
+        switch (opt) {
+        case 'b': mut_build = optarg; break;
+        case 't': mut_test = optarg; break;
+        case 'r': mut_root = optarg; break;
+        case 'j': jobs = atol(optarg); break;
+        case 'T': mut_timeout = (unsigned)atoi(optarg); break;
+        case 'n': max = (size_t)atol(optarg); break;
+        case 'm': min_score = atof(optarg); break;
+        case 'w': snprintf(mut_work, sizeof(mut_work), "%s", optarg); break;
+        case 'k': keep = true; break;
+        default: mutUsage(argv[0]); return 2;
+        }
+    }
+    if (!mut_build || !mut_test || optind >= argc) {
+        mutUsage(argv[0]);
+        return 2;
+    }
+    setenv("TEST_FAIL_FAST", "1", 1); // test binaries stop at the first failed case
+    if (jobs < 1) jobs = 1;
+    if (jobs > MUT_MAX_JOBS) jobs = MUT_MAX_JOBS;
+    if (!*mut_work) {
+        const char* tmp = getenv("TMPDIR");
+        snprintf(mut_work, sizeof(mut_work), "%s/test_mutate.%d", tmp && *tmp ? tmp : "/tmp", (int)getpid());
+    }
+
+    size_t root_len = strlen(mut_root);
+    for (int a = optind; a < argc && mut_file_count < MUT_MAX_FILES; a++) {
+        MutFile* f = &mut_files[mut_file_count];
+        char path[1200];
+        f->path = argv[a];
+        if (!strncmp(f->path, mut_root, root_len) && f->path[root_len] == '/') f->path += root_len + 1;
+        snprintf(path, sizeof(path), "%s/%s", mut_root, f->path);
+        f->data = mutRead(path, &f->size);
+        if (!f->data) {
+            LOG_ERROR("MUTATE: cannot read %s\n", path);
+            return 2;
+        }
+        mutScan(mut_file_count++);
+    }
+    if (max && mutant_count > max) { // keep an evenly spaced subset
+        for (size_t i = 0; i < max; i++) mutants[i] = mutants[i * mutant_count / max];
+        mutant_count = max;
+    }
+    MSG(MAGENTA, "%zu mutants in %u files, %ld jobs\n", mutant_count, mut_file_count, jobs);
+
+    int rc = 2;
+    if (mutSetup((unsigned)jobs)) {
+        depth++;
+        mutRunAll((unsigned)jobs);
+        depth--;
+        rc = mutReport() < min_score ? 1 : 0;
+    }
+    if (!keep) {
+        char* rm_argv[] = { "rm", "-rf", mut_work, NULL };
+        mutExec(rm_argv, NULL, NULL, 0);
+    }
+    return rc;
+}